@@ -21,12 +21,40 @@
 #include "hash.h"
 
 
-struct bloom_filter *bloom_filter_new(uint64_t bits_addr, unsigned int num_hash, unsigned int bit_size)
+/*
+ * Bit indexes of @data, the same as the server's CountingBloomFilter.
+ * Blocked (@block_bits > 0), all fall in one block of @block_bits bits:
+ * the hash with salt 0 picks the block, double hashing on the one with
+ * salt 1 the bits in it. Otherwise the hash with salt i is bit i.
+ */
+void bloom_filter_indexes(const void *data, unsigned int datalen, unsigned int nr_hash,
+			  uint64_t bit_size, unsigned int block_bits, uint64_t *idx)
+{
+	uint64_t base, h1, step;
+	int i;
+
+	if (!block_bits) {
+		for (i = 0 ; i < nr_hash; i++ )
+			idx[i] = hash_funcs[1](data, datalen, i) % bit_size;
+		return;
+	}
+
+	base = hash_funcs[1](data, datalen, 0) % (bit_size / block_bits) * block_bits;
+	h1 = hash_funcs[1](data, datalen, 1);
+	step = (h1 >> 16) | 1;
+	for (i = 0 ; i < nr_hash; i++ )
+		idx[i] = base + ((h1 + i * step) & (block_bits - 1));
+}
+
+struct bloom_filter *bloom_filter_new(uint64_t bits_addr, unsigned int num_hash, unsigned int bit_size, unsigned int block_bits)
 {
 	struct bloom_filter *filter;
 	unsigned long bitmap_size = BITS_TO_LONGS(bit_size)
 		* sizeof(unsigned long);
 
+	if (num_hash == 0 || num_hash > NUM_HASHES_MAX)
+		return ERR_PTR(-EINVAL);
+
 	filter = kzalloc(sizeof(*filter), GFP_KERNEL);
 
 	if (!filter)
@@ -37,6 +65,7 @@ struct bloom_filter *bloom_filter_new(uint64_t bits_addr, unsigned int num_hash,
 	filter->bitmap_size = bit_size;
 	filter->bitmap_size_in_byte = bitmap_size;
 	filter->nr_hash = num_hash;
+	filter->block_bits = block_bits;
 	filter->bitmap = (unsigned long *)bits_addr;
 
 	return filter;
@@ -63,10 +92,12 @@ int bloom_filter_add(struct bloom_filter *filter,
 {
 	int ret = 0;
 	int i;
-	unsigned int index;
+	uint64_t index;
+	uint64_t idx[NUM_HASHES_MAX];
 
+	bloom_filter_indexes(data, datalen, filter->nr_hash, filter->bitmap_size, filter->block_bits, idx);
 	for (i = 0 ; i < filter->nr_hash; i++ ) {
-		index = hash_funcs[1](data, datalen, i) % filter->bitmap_size;
+		index = idx[i];
 
 		unsigned int j = index / 64;
 		uint8_t bitShift = 64 - 1 - (index % 64);   // i == 65 -> 62
@@ -84,13 +115,15 @@ int bloom_filter_check(struct bloom_filter *filter,
 		       bool *result)
 {
 	int ret = 0;
-	unsigned int index;
+	uint64_t index;
+	uint64_t idx[NUM_HASHES_MAX];
 	int i;
 
 	*result = true;
 
+	bloom_filter_indexes(data, datalen, filter->nr_hash, filter->bitmap_size, filter->block_bits, idx);
 	for (i = 0 ; i < filter->nr_hash; i++ ) {
-		index = hash_funcs[1](data, datalen, i) % filter->bitmap_size;
+		index = idx[i];
 		/*
 		if (*(uint64_t *)data == 0) {
 			pr_info("data=%lx index = %lu, ", *(uint64_t *)data, index);
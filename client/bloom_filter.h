@@ -1,16 +1,20 @@
 #ifndef _BLOOM_H_
 #define _BLOOM_H_
 
+/* bit indexes of one key are kept on the stack */
+#define NUM_HASHES_MAX		16
+
 struct bloom_filter {
 	struct kref		kref;
 	struct mutex		lock;
 	unsigned int		bitmap_size;
 	unsigned int 		bitmap_size_in_byte;
 	unsigned int		nr_hash;
+	unsigned int		block_bits;
 	unsigned long		*bitmap;
 };
 
-struct bloom_filter *bloom_filter_new(uint64_t, unsigned int ,unsigned int bit_size);
+struct bloom_filter *bloom_filter_new(uint64_t, unsigned int ,unsigned int bit_size, unsigned int block_bits);
 struct bloom_filter *bloom_filter_ref(struct bloom_filter *filter);
 void bloom_filter_unref(struct bloom_filter *filter);
 
@@ -22,5 +26,7 @@ int bloom_filter_check(struct bloom_filter *filter,
 void bloom_filter_set(struct bloom_filter *filter,
 		      const void *bit_data);
 int bloom_filter_bitsize(struct bloom_filter *filter);
+void bloom_filter_indexes(const void *data, unsigned int datalen, unsigned int nr_hash,
+			  uint64_t bit_size, unsigned int block_bits, uint64_t *idx);
 
 #endif /* _BLOOM_H_ */
@@ -973,7 +973,17 @@ int rdpma_get(struct page *page, uint64_t key, int batch)
 	struct rdma_req *req[2];
 	uint8_t *indexes;
 	bool isIn= false;
-	int index;
+	/* server counters are 4 bits, two per byte: odd ones in the high nibble */
+	uint64_t bf_idx[NUM_HASHES];
+	uint8_t bf_byte;
+#if BF_BLOCK_BITS
+	/* all counters of a key are in one block, read it with one READ */
+	const int bf_nr_reads = 1;
+	const size_t bf_read_len = BF_BLOCK_BITS / 2;
+#else
+	const int bf_nr_reads = NUM_HASHES;
+	const size_t bf_read_len = 1;
+#endif
 	struct ib_sge bf_sge[NUM_HASHES];
 	struct ib_rdma_wr bf_rdma_wr[NUM_HASHES] = {};
 
@@ -988,26 +998,30 @@ int rdpma_get(struct page *page, uint64_t key, int batch)
 #ifdef SBLOOMFILTER
 	// Bloom filter 
 	{
-		indexes = kzalloc(NUM_HASHES, GFP_ATOMIC);
+		indexes = kzalloc(bf_nr_reads * bf_read_len, GFP_ATOMIC);
 		if (!indexes) {
 			pr_err("[ FAIL ] kzalloc(indexes) rdpma_get failed\n");
 			return -ENOMEM;
 		}
 
-		ret = get_req_for_buf(&req[0], dev, indexes, NUM_HASHES , DMA_TO_DEVICE);
-		for ( i = 0 ; i < NUM_HASHES ; i++ ) {
-			bf_sge[i].addr = req[0]->dma + i;
-			bf_sge[i].length = 1;
+		bloom_filter_indexes(&key, sizeof(key), NUM_HASHES, BF_SIZE, BF_BLOCK_BITS, bf_idx);
+		ret = get_req_for_buf(&req[0], dev, indexes, bf_nr_reads * bf_read_len , DMA_TO_DEVICE);
+		for ( i = 0 ; i < bf_nr_reads ; i++ ) {
+			bf_sge[i].addr = req[0]->dma + i * bf_read_len;
+			bf_sge[i].length = bf_read_len;
 			bf_sge[i].lkey = q->ctrl->rdev->pd->local_dma_lkey;
 
-			bf_rdma_wr[i].wr.next    = (i == NUM_HASHES - 1) ? NULL : &(bf_rdma_wr[i+1].wr);
+			bf_rdma_wr[i].wr.next    = (i == bf_nr_reads - 1) ? NULL : &(bf_rdma_wr[i+1].wr);
 			bf_rdma_wr[i].wr.sg_list = &bf_sge[i];
 			bf_rdma_wr[i].wr.num_sge = 1;
 			bf_rdma_wr[i].wr.opcode  = IB_WR_RDMA_READ;
-			bf_rdma_wr[i].wr.send_flags = (i == NUM_HASHES - 1 ) ? IB_SEND_SIGNALED : 0 || IB_SEND_INLINE;
-			index = hash_funcs[1](&key, sizeof(key), i) % BF_SIZE;
-//			pr_info("[ INFO ] query index %d\n", index);
-			bf_rdma_wr[i].remote_addr = q->ctrl->bfmr.baseaddr + index; 
+			bf_rdma_wr[i].wr.send_flags = (i == bf_nr_reads - 1 ) ? IB_SEND_SIGNALED : 0 || IB_SEND_INLINE;
+//			pr_info("[ INFO ] query index %llu\n", bf_idx[i]);
+#if BF_BLOCK_BITS
+			bf_rdma_wr[i].remote_addr = q->ctrl->bfmr.baseaddr + bf_idx[0] / BF_BLOCK_BITS * bf_read_len;
+#else
+			bf_rdma_wr[i].remote_addr = q->ctrl->bfmr.baseaddr + bf_idx[i] / 2; 
+#endif
 			bf_rdma_wr[i].rkey = q->ctrl->bfmr.key;
 		}
 
@@ -1034,14 +1048,19 @@ int rdpma_get(struct page *page, uint64_t key, int batch)
 		}
 
 		for ( i = 0 ; i < NUM_HASHES ; i++ ) {
-			if (indexes[i] == 0) {
+#if BF_BLOCK_BITS
+			bf_byte = indexes[bf_idx[i] % BF_BLOCK_BITS / 2];
+#else
+			bf_byte = indexes[i];
+#endif
+			if (((bf_byte >> ((bf_idx[i] & 1) * 4)) & 0xf) == 0) {
 //				pr_info("[ INFO ] Key not exist, skip get\n");
 				kfree(indexes); 	// kfree error why??
 				return -1;
 			}
 		}
 
-		ib_dma_unmap_page(q->ctrl->rdev->dev, req[0]->dma, NUM_HASHES, DMA_TO_DEVICE); /* XXX Needed? reuse it */
+		ib_dma_unmap_page(q->ctrl->rdev->dev, req[0]->dma, bf_nr_reads * bf_read_len, DMA_TO_DEVICE); /* XXX Needed? reuse it */
 		kmem_cache_free(req_cache, req[0]);
 		kfree(indexes);
 	}
@@ -1485,7 +1504,7 @@ static struct julee_rdma_dev *julee_rdma_get_device(struct rdma_queue *q)
 			pr_info("[ PASS ] ib_dma_alloc_coherent, bitmap_size: %lu KB", bitmap_size/1024);
 		}
 
-		gctrl->bf = bloom_filter_new(rdev->local_bf_bits, NUM_HASHES, BF_SIZE);
+		gctrl->bf = bloom_filter_new(rdev->local_bf_bits, NUM_HASHES, BF_SIZE, BF_BLOCK_BITS);
 		pr_info("[ INFO ] cbloomfilter created. nr_hash= %d, size= %dB\n", gctrl->bf->nr_hash, gctrl->bf->bitmap_size_in_byte);
 #endif
 
@@ -2113,6 +2132,7 @@ static int __init rdma_connection_init_module(void)
 #ifdef CBLOOMFILTER 
 	pr_info("\t  +-- Filter     \t: CBLOOMFILTER\n");
 	pr_info("\t  +-- BF_SIZE    \t: %d\n", BF_SIZE);
+	pr_info("\t  +-- BF_BLOCK_BITS\t: %d\n", BF_BLOCK_BITS);
 	pr_info("\t  +-- NUM_HASHES\t: %d\n", NUM_HASHES);
 #endif
 #ifdef SBLOOMFILTER 
@@ -34,6 +34,8 @@
 //#define BF_SIZE 200000000
 #define BF_SIZE 1000000000
 //#define BF_SIZE 1969760731
+/* bloom filter positions per block, a key's bits all fall in one (0: unblocked), same as the server */
+#define BF_BLOCK_BITS 128
 
 enum qp_type {
 	QP_READ_SYNC,
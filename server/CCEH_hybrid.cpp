@@ -1,5 +1,8 @@
 #include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <mutex>
+#include <numa.h>
 #include <thread>
 #include <bitset>
 #include <cassert>
@@ -15,6 +18,40 @@
 using namespace std;
 extern size_t perfCounter;
 
+/* per node bump allocator over kNodeChunkSize chunks bound to the node */
+struct NodePool {
+	mutex lock;
+	char* next = NULL;
+	size_t left = 0;
+};
+static NodePool pools[NUM_NUMA];
+
+void* Segment::operator new(size_t size, int node) {
+	auto& pool = pools[node];
+	size = (size + 63) & ~(size_t)63;
+	lock_guard<mutex> guard(pool.lock);
+	if (pool.left < size) {
+		auto chunk = max(size, kNodeChunkSize);
+		void* mem = NULL;
+		if (numa_available() < 0) {
+			if (posix_memalign(&mem, 64, chunk))
+				mem = NULL;
+		} else {
+			mem = numa_alloc_onnode(chunk, node % (numa_max_node() + 1));
+		}
+		if (!mem) {
+			fprintf(stderr, "[ FAIL ] no memory for segments on node %d\n", node);
+			exit(EXIT_FAILURE);
+		}
+		pool.next = (char*)mem;
+		pool.left = chunk;
+	}
+	void* ret = pool.next;
+	pool.next += size;
+	pool.left -= size;
+	return ret;
+}
+
 void Segment::Insert4split(Key_t& key, Value_t value, size_t loc) {
 	for (unsigned i = 0; i < kNumPairPerCacheLine * kNumCacheLine; ++i) {
 		auto slot = (loc+i) % kNumSlot;
@@ -27,11 +64,12 @@ void Segment::Insert4split(Key_t& key, Value_t value, size_t loc) {
 	cerr << "[" << __func__ << "]: something wrong -- need to adjust linear probing distance" << endl;
 }
 
-Segment** Segment::Split(void){
+/* halves go to @node, the node of the segment's hash prefix */
+Segment** Segment::Split(int node){
 #ifdef INPLACE
 	Segment** split = new Segment*[2];
 	split[0] = this;
-	split[1] = new Segment(local_depth+1);
+	split[1] = new (node) Segment(local_depth+1);
 
 	auto pattern = ((size_t)1 << (sizeof(Key_t)*8 - local_depth - 1));
 	for (unsigned i = 0; i < kNumSlot; ++i) {
@@ -46,8 +84,8 @@ Segment** Segment::Split(void){
 	return split;
 #else
 	Segment** split = new Segment*[2];
-	split[0] = new Segment(local_depth+1);
-	split[1] = new Segment(local_depth+1);
+	split[0] = new (node) Segment(local_depth+1);
+	split[1] = new (node) Segment(local_depth+1);
 
 	auto pattern = ((size_t)1 << (sizeof(Key_t)*8 - local_depth - 1));
 	for (unsigned i = 0; i < kNumSlot; ++i) {
@@ -68,19 +106,23 @@ Segment** Segment::Split(void){
 
 
 CCEH::CCEH(void)
-	: dir{new Directory(0)}
-{
-	for (unsigned i = 0; i < dir->capacity; ++i) {
-		dir->_[i] = new Segment(0);
-	}
-
-}
+	: CCEH(1, 1)
+{ }
 
-CCEH::CCEH(size_t initCap)
-	: dir{new Directory(static_cast<size_t>(log2(initCap)))}
+CCEH::CCEH(size_t initCap, int _nr_nodes)
+	: nr_nodes{min(max(_nr_nodes, 1), NUM_NUMA)}, node_bits{0}, freq{}, gtime{0}, lrfu{}
 {
+	while (((size_t)1 << node_bits) < (size_t)nr_nodes)
+		node_bits++;
+	/* no segment may span two nodes */
+	auto depth = max(static_cast<size_t>(log2(max(initCap, (size_t)1))), node_bits);
+	dir = new Directory(depth);
+	for (int n = 0; n < NUM_NUMA; ++n)
+		segments_in_node[n] = 0;
 	for (unsigned i = 0; i < dir->capacity; ++i) {
-		dir->_[i] = new Segment(static_cast<size_t>(log2(initCap)));
+		auto node = NodeOf(depth ? (size_t)i << (8*sizeof(size_t) - depth) : 0);
+		dir->_[i] = new (node) Segment(depth);
+		segments_in_node[node]++;
 	}
 }
 
@@ -192,7 +234,9 @@ RETRY:
 	}
 #endif
 
-	Segment** s = target->Split();
+	auto node = NodeOf(key_hash);
+	Segment** s = target->Split(node);
+	segments_in_node[node] += (s[0] == target) ? 1 : 2;
 
 	/* need to double the directory */
 	if(target->local_depth == dir->depth){
@@ -324,7 +368,7 @@ bool CCEH::Delete(Key_t& key) {
 }
 
 int CCEH::GetNodeID(Key_t& key) {
-	return 0;
+	return NodeOf(h(&key, sizeof(key)));
 }
 
 Value_t CCEH::Get_extent(Key_t& key){
@@ -6,6 +6,7 @@
 #include <vector>
 #include <pthread.h>
 #include <iostream>
+#include <atomic>
 
 #include "util/pair.h"
 #include "ICCEH.h"
@@ -17,6 +18,8 @@ constexpr size_t kShift = kSegmentBits;
 constexpr size_t kSegmentSize = (1 << kSegmentBits) * 16 * 4;
 constexpr size_t kNumPairPerCacheLine = 4;
 constexpr size_t kNumCacheLine = 8;
+/* bytes a node's segment pool takes from that node at a time */
+constexpr size_t kNodeChunkSize = 64UL << 20;
 
 struct Metric {
 	unsigned atime;
@@ -76,22 +79,15 @@ struct Segment {
       }
   }
 
-  void* operator new(size_t size) {
-    void* ret;
-	if (posix_memalign(&ret, 64, size) ) ret=NULL;
-    return ret;
-  }
-
-  void* operator new[](size_t size) {
-    void* ret;
-	if (posix_memalign(&ret, 64, size) ) ret=NULL;
-    return ret;
-  }
+  /* segments come from the pool of NUMA node @node and are never freed */
+  void* operator new(size_t size, int node);
+  void operator delete(void*) {  }
+  void operator delete(void*, int) {  }
 
   int Insert(Key_t&, Value_t, size_t, size_t);
   void Insert4split(Key_t&, Value_t, size_t);
   bool Put(Key_t&, Value_t, size_t);
-  Segment** Split(void);
+  Segment** Split(int);
   size_t numElem(void); 
 
   Pair _[kNumSlot];
@@ -169,10 +165,18 @@ struct Directory {
   void LSBUpdate(int, int, int, int, Segment**);
 };
 
+/*
+ * CCEH whose segments are spread over NUMA nodes. The top bits of a key's
+ * hash pick its node, and since segments cover hash prefixes at least
+ * node_bits long, every segment belongs to one node and is allocated
+ * there, splits included. NUMA_KV runs the requests of a key on workers
+ * of the key's node, so a segment is only touched by its own node.
+ */
 class CCEH : public ICCEH {
   public:
     CCEH(void);
-    CCEH(size_t);
+    /* @initCap segments over @nr_nodes nodes, logical node n lives on physical node n % nodes */
+    CCEH(size_t, int = 1);
     ~CCEH(void);
 
 	int GetNodeID(Key_t&);
@@ -197,10 +201,17 @@ class CCEH : public ICCEH {
 		if (posix_memalign(&ret, 64, size) ) ret=NULL;
 		return ret;
 	}
+	void operator delete(void* p) { free(p); }
 
   private:
+	int NodeOf(size_t key_hash) {
+		return node_bits ? (key_hash >> (8*sizeof(key_hash) - node_bits)) % nr_nodes : 0;
+	}
+
     Directory* dir;
-	size_t segments_in_node[NUM_NUMA];
+	int nr_nodes;
+	size_t node_bits;
+	std::atomic<size_t> segments_in_node[NUM_NUMA];
 	unsigned freq[NUM_NUMA];
 	unsigned gtime;
 	struct Metric lrfu[NUM_NUMA];
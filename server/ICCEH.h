@@ -1,5 +1,5 @@
-#ifndef HASH_INTERFACE_H_
-#define HASH_INTERFACE_H_
+#ifndef ICCEH_H_
+#define ICCEH_H_
 
 #define CAS(_p, _u, _v)  (__atomic_compare_exchange_n (_p, _u, _v, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
 
@@ -27,4 +27,4 @@ class ICCEH {
 };
 
 
-#endif  // _HASH_INTERFACE_H_
+#endif  // ICCEH_H_
@@ -10,6 +10,7 @@ class IHash {
   public:
     IHash(void) = default;
     ~IHash(void) = default;
+    /* returns the evicted key, INVALID if none, SENTINEL if @value is refused */
     virtual Key_t Insert(Key_t&, Value_t) = 0;
 	virtual void Insert_extent(Key_t, uint64_t, uint64_t, Value_t) = 0;
     virtual bool Delete(Key_t&) = 0;
@@ -19,6 +20,23 @@ class IHash {
     virtual double Utilization(void) = 0;
     virtual size_t Capacity(void) = 0;
 	virtual bool Recovery(void) = 0;
+
+	/* backends work on batches of at most this many keys at a time */
+	static constexpr size_t kMaxBatch = 64;
+
+	/*
+	 * @n keys at once, @evicted[i] as Insert() of keys[i] returns it.
+	 * These go key by key; backends with locks or persistence fences
+	 * per bucket override them to take each one once per batch.
+	 */
+	virtual void InsertBatch(Key_t* keys, Value_t* values, Key_t* evicted, size_t n) {
+		for (size_t i = 0; i < n; ++i)
+			evicted[i] = Insert(keys[i], values[i]);
+	}
+	virtual void GetBatch(Key_t* keys, Value_t* values, size_t n) {
+		for (size_t i = 0; i < n; ++i)
+			values[i] = Get(keys[i]);
+	}
 };
 
 
@@ -9,7 +9,7 @@
 class KVStore {
   public:
     KVStore(void) = default;
-    ~KVStore(void) = default;
+    virtual ~KVStore(void) = default;
     virtual bool Insert(Key_t&, Value_t) = 0;
 	virtual void InsertExtent(Key_t&, Value_t, uint64_t) = 0;
     virtual bool Delete(Key_t&) = 0;
@@ -20,6 +20,18 @@ class KVStore {
     virtual double Utilization(void) = 0;
     virtual size_t Capacity(void) = 0;
 	virtual void PrintStats(void) = 0;
+
+	/* returns how many of the @n inserts evicted a key */
+	virtual size_t InsertBatch(Key_t* keys, Value_t* values, size_t n) {
+		size_t nr_evicted = 0;
+		for (size_t i = 0; i < n; ++i)
+			nr_evicted += Insert(keys[i], values[i]);
+		return nr_evicted;
+	}
+	virtual void GetBatch(Key_t* keys, Value_t* values, size_t n) {
+		for (size_t i = 0; i < n; ++i)
+			values[i] = Get(keys[i]);
+	}
 };
 
 
@@ -2,6 +2,8 @@
 #include "src/cuckoo_hash.h"
 #elif defined DCCEH 
 #include "src/cceh.h"
+#elif defined DASH
+#include "src/dash.h"
 #elif defined PATH
 #include "src/path_hashing.hpp"
 #elif defined EXT
@@ -10,6 +12,16 @@
 #include "src/Level_hashing.h"
 #elif defined CCP
 #include "src/cuckoo_probing.h"
+#elif defined OCUCKOO
+#include "src/optimistic_cuckoo.h"
+#elif defined LPSOA
+#include "src/linear_probing_soa.h"
+#elif defined LPCOMPACT
+#include "src/linear_probing_compact.h"
+#elif defined RACE
+#include "src/race_hash.h"
+#elif defined HOTRING
+#include "src/hotring.h"
 #else
 #include "src/linear_probing.h"
 #endif
@@ -17,6 +29,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <algorithm>
+#include <cmath>
 #include <atomic>
 #include <condition_variable>
 #include <cstdlib>
@@ -31,6 +44,7 @@
 
 #include "KV.h"
 #include "variables.h"
+#include "util/sharded_counter.h"
 
 extern bool verbose_flag;
 extern size_t numData;
@@ -38,15 +52,13 @@ extern struct bitmask *netcpubuf;
 extern struct bitmask *kvcpubuf;
 extern struct bitmask *pollcpubuf;
 
-atomic<int> deletecnt = 0;
-atomic<int> kv_putcnt = 0;
-atomic<int> kv_getcnt = 0;
+/* shared by every backend linked in, defined in KV_registry.cpp */
+extern ShardedCounter deletecnt;
+extern ShardedCounter kv_putcnt;
+extern ShardedCounter kv_getcnt;
 
 using namespace std;
 
-void *global_chunk = NULL;
-atomic<int> offset = 0;
-
 static void dprintf( const char* format, ... ) {
 	if (verbose_flag) {
 		va_list args;
@@ -56,28 +68,10 @@ static void dprintf( const char* format, ... ) {
 	}
 }
 
-/*
- * @size:
- * table size: Cuckoo, path, extendible, level
- */
-KV::KV(size_t size, CountingBloomFilter<Key_t>* _bf)
+template <class Backend>
+KV<Backend>::KV(Backend* _hash, CountingBloomFilter<Key_t>* _bf)
 {
-#ifdef CUCKOO 
-	hash = new CuckooHash(static_cast<size_t>(size));
-#elif defined DCCEH 
-	hash = new CCEH(static_cast<size_t>(size));
-#elif defined PATH
-	hash = new PathHashing(static_cast<size_t>(size));
-#elif defined EXT
-	hash = new ExtendibleHash(static_cast<size_t>(size));
-#elif defined LEVEL
-	hash = new LevelHashing(static_cast<size_t>(size));
-#elif defined CCP
-	hash = new CuckooProbingHash(static_cast<size_t>(size));
-#else
-	hash = new LinearProbingHash(static_cast<size_t>(size));
-#endif
-
+	hash = _hash;
 	bf = _bf;
 
 #ifdef KV_DEBUG
@@ -91,22 +85,28 @@ KV::KV(size_t size, CountingBloomFilter<Key_t>* _bf)
 	dprintf("[  OK  ] KV init\n");
 }
 
-KV::~KV(void)
-{ 
-	return;
+template <class Backend>
+KV<Backend>::~KV(void)
+{
+	delete hash;
 }
 
 // return deleted or not
-bool KV::Insert(Key_t& key, Value_t value) {
-	kv_putcnt++;
+template <class Backend>
+bool KV<Backend>::Insert(Key_t& key, Value_t value) {
+	kv_putcnt.inc();
 #ifdef KV_DEBUG
 	struct timespec i_start;
 	struct timespec i_end;
 	clock_gettime(CLOCK_MONOTONIC, &i_start);
 #endif
 	auto deletedKey = hash->Insert(key, value);
+	if (deletedKey == SENTINEL) {
+		fprintf(stderr, "[ FAIL ] Insert: key %lu refused by the index\n", key);
+		return false;
+	}
 	if (deletedKey != (uint64_t)-1) {
-		deletecnt++;
+		deletecnt.inc();
 	}
 //	logger->info("Insert, Key=%lu", key);
 //	std::cout << "Insert, "<< key << endl;
@@ -126,7 +126,54 @@ bool KV::Insert(Key_t& key, Value_t value) {
 	return deletedKey == (uint64_t)-1 ? false : true;
 }
 
-void KV::InsertExtent(Key_t& key, Value_t value, uint64_t len) {
+/*
+ * The index places the whole batch (IHash::InsertBatch), then the bloom
+ * filter takes the inserted keys in one pass and drops the evicted ones.
+ * Returns the number of keys evicted.
+ */
+template <class Backend>
+size_t KV<Backend>::InsertBatch(Key_t* keys, Value_t* values, size_t n) {
+	kv_putcnt.add(n);
+#ifdef KV_DEBUG
+	struct timespec i_start;
+	struct timespec i_end;
+	clock_gettime(CLOCK_MONOTONIC, &i_start);
+#endif
+	size_t nr_evicted = 0;
+	for (size_t off = 0; off < n; off += IHash::kMaxBatch) {
+		auto m = min(n - off, IHash::kMaxBatch);
+		Key_t evicted[IHash::kMaxBatch];
+		hash->InsertBatch(keys + off, values + off, evicted, m);
+
+		/* refused keys stay out of the filter */
+		Key_t inserted[IHash::kMaxBatch];
+		size_t nr = 0, nr_inserted = 0;
+		for (size_t i = 0; i < m; i++) {
+			if (evicted[i] == SENTINEL) {
+				fprintf(stderr, "[ FAIL ] InsertBatch: key %lu refused by the index\n", keys[off + i]);
+				continue;
+			}
+			inserted[nr_inserted++] = keys[off + i];
+			if (evicted[i] != (uint64_t)-1)
+				evicted[nr++] = evicted[i];
+		}
+		if (bf) {
+			bf->Insert(inserted, nr_inserted);
+			for (size_t i = 0; i < nr; i++)
+				bf->Delete(evicted[i]);
+		}
+		nr_evicted += nr;
+	}
+	deletecnt.add(nr_evicted);
+#ifdef KV_DEBUG
+	clock_gettime(CLOCK_MONOTONIC, &i_end);
+	insertTime += i_end.tv_nsec - i_start.tv_nsec + (i_end.tv_sec - i_start.tv_sec)*1000000000;
+#endif
+	return nr_evicted;
+}
+
+template <class Backend>
+void KV<Backend>::InsertExtent(Key_t& key, Value_t value, uint64_t len) {
 #ifdef KV_DEBUG
 	struct timespec i_start;
 	struct timespec i_end;
@@ -142,8 +189,9 @@ void KV::InsertExtent(Key_t& key, Value_t value, uint64_t len) {
 	return;
 }
 
-Value_t KV::Get(Key_t& key) {
-	kv_getcnt++;
+template <class Backend>
+Value_t KV<Backend>::Get(Key_t& key) {
+	kv_getcnt.inc();
 #ifdef KV_DEBUG
 	struct timespec g_start;
 	clock_gettime(CLOCK_MONOTONIC, &g_start);
@@ -157,8 +205,24 @@ Value_t KV::Get(Key_t& key) {
 	return ret; 
 }
 
+template <class Backend>
+void KV<Backend>::GetBatch(Key_t* keys, Value_t* values, size_t n) {
+	kv_getcnt.add(n);
+#ifdef KV_DEBUG
+	struct timespec g_start;
+	clock_gettime(CLOCK_MONOTONIC, &g_start);
+#endif
+	hash->GetBatch(keys, values, n);
+#ifdef KV_DEBUG
+	struct timespec g_end;
+	clock_gettime(CLOCK_MONOTONIC, &g_end);
+	getTime += g_end.tv_nsec - g_start.tv_nsec + (g_end.tv_sec - g_start.tv_sec)*1000000000;
+#endif
+}
+
 /* extented get */
-Value_t KV::GetExtent(Key_t& key) {
+template <class Backend>
+Value_t KV<Backend>::GetExtent(Key_t& key) {
 #ifdef KV_DEBUG
 	struct timespec g_start;
 	clock_gettime(CLOCK_MONOTONIC, &g_start);
@@ -178,40 +242,166 @@ Value_t KV::GetExtent(Key_t& key) {
 	return target;
 }
 
-Value_t KV::FindAnyway(Key_t& key) {
+template <class Backend>
+Value_t KV<Backend>::FindAnyway(Key_t& key) {
 	return hash->FindAnyway(key);
 }
 
-bool KV::Recovery(void) {
+template <class Backend>
+bool KV<Backend>::Recovery(void) {
 	return hash->Recovery();
 }
 
-bool KV::Delete(Key_t& key) {
-	return false;
+template <class Backend>
+bool KV<Backend>::Delete(Key_t& key) {
+	if (!hash->Delete(key))
+		return false;
+
+	if (bf)
+		bf->Delete(key);
+	return true;
 }
 
-double KV::Utilization(void) {
+template <class Backend>
+double KV<Backend>::Utilization(void) {
 	return hash->Utilization();
 }
 
-size_t KV::Capacity(void) {
+template <class Backend>
+size_t KV<Backend>::Capacity(void) {
 	return hash->Capacity();
 }
 
-void KV::PrintStats(void) {
+template <class Backend>
+void KV<Backend>::PrintStats(void) {
 #ifdef KV_DEBUG
 	auto util = hash->Utilization();
 	auto cap = hash->Capacity();
 
 //	printf("Failed Search = %d\n", failedSearch.load());
-	printf("Total put = %d, get = %d\n", kv_putcnt.load(), kv_getcnt.load());
+	printf("Total put = %ld, get = %ld\n", kv_putcnt.read(), kv_getcnt.read());
 	printf("Util =%.3f\t Capa =%lu\n", util, cap);
-	printf("InsertTime = \t%.3f (usec/req)\n", insertTime/1000.0/(kv_putcnt.load() + 1));
-	printf("GetTime= \t%.3f (usec/req)\n", getTime/1000.0/(kv_getcnt.load() + 1));
-	printf("Key deleted %d\n", deletecnt.load());
+	printf("InsertTime = \t%.3f (usec/req)\n", insertTime/1000.0/(kv_putcnt.read() + 1));
+	printf("GetTime= \t%.3f (usec/req)\n", getTime/1000.0/(kv_getcnt.read() + 1));
+	printf("Key deleted %ld\n", deletecnt.read());
 
 //	printf("%.3f, %lu, %d, %d, %d, %d, %zu, %zu, %.3f, %.3f, %.3f, %.3f, %.3f\n", util, cap, freqs[0], freqs[1], miss_cnt[0].load(), miss_cnt[1].load(), segs[0], segs[1], metrics[0], metrics[1], 
 //			perNodeQueueTime/1000.0/numData/2, insertTime/1000.0/numData, getTime/1000.0/numData);
 #endif
 	return;
 }
+
+/*
+ * The backend this object was compiled for (-DCUCKOO, -DDCCEH, ...,
+ * LinearProbing without one). Binaries link one KV_<name>.o per backend
+ * they offer, each registers itself before main().
+ */
+#ifdef CUCKOO
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<CuckooHash>(new CuckooHash(size), bf);
+}
+static const KVBackend backend = { "cuckoo", NewBackendKV, false, NULL };
+#elif defined DCCEH
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits>
+static KVStore* NewCCEHKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	using Table = CCEHT<SegmentBits, ProbeLines, FingerprintBits>;
+	auto table = new Table(size);
+	/* merges and halves in the background once KV::Delete removed keys */
+	table->StartShrinker();
+	return new KV<Table>(table, bf);
+}
+
+/* one KV instance per geometry instantiated in cceh.cpp */
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	const char* geometry = cceh_geometry ? cceh_geometry : "default";
+	KVStore* kv = NULL;
+	if (!strcmp(geometry, "default"))
+		kv = NewCCEHKV<8, 8, 0>(size, bf);
+	else if (!strcmp(geometry, "small"))
+		kv = NewCCEHKV<6, 4, 0>(size, bf);
+	else if (!strcmp(geometry, "large"))
+		kv = NewCCEHKV<10, 16, 0>(size, bf);
+	else if (!strcmp(geometry, "fp8"))
+		kv = NewCCEHKV<8, 8, 8>(size, bf);
+	else if (!strcmp(geometry, "fp16"))
+		kv = NewCCEHKV<8, 8, 16>(size, bf);
+	else if (!strcmp(geometry, "large-fp8"))
+		kv = NewCCEHKV<10, 16, 8>(size, bf);
+	if (!kv) {
+		fprintf(stderr, "[ FAIL ] unknown CCEH geometry %s (%s)\n", cceh_geometry, CCEHGeometries());
+		exit(EXIT_FAILURE);
+	}
+	dprintf("[ INFO ] CCEH geometry %s\n", geometry);
+	return kv;
+}
+static const KVBackend backend = { "cceh", NewBackendKV, false, NULL };
+#elif defined DASH
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<Dash>(new Dash(size), bf);
+}
+static const KVBackend backend = { "dash", NewBackendKV, false, NULL };
+#elif defined PATH
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<PathHashing>(new PathHashing(size), bf);
+}
+static const KVBackend backend = { "path", NewBackendKV, false, NULL };
+#elif defined EXT
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<ExtendibleHash>(new ExtendibleHash(size), bf);
+}
+static const KVBackend backend = { "ext", NewBackendKV, false, NULL };
+#elif defined LEVEL
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	/* LevelHashing takes the number of top level address bits */
+	return new KV<LevelHashing>(new LevelHashing(static_cast<size_t>(log2(size / ASSOC_NUM))), bf);
+}
+static const KVBackend backend = { "level", NewBackendKV, false, NULL };
+#elif defined CCP
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<CuckooProbingHash>(new CuckooProbingHash(size), bf);
+}
+static const KVBackend backend = { "cuckoop", NewBackendKV, false, NULL };
+#elif defined OCUCKOO
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<OptimisticCuckooHash>(new OptimisticCuckooHash(size), bf);
+}
+static const KVBackend backend = { "ocuckoo", NewBackendKV, false, NULL };
+#elif defined LPSOA
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<LinearProbingSoAHash>(new LinearProbingSoAHash(size), bf);
+}
+static const KVBackend backend = { "lpsoa", NewBackendKV, false, NULL };
+#elif defined LPCOMPACT
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	if (!page_region) {
+		fprintf(stderr, "[ FAIL ] compact index needs a page region\n");
+		exit(EXIT_FAILURE);
+	}
+	auto hash = new LinearProbingCompactHash(size, page_region, page_region_size);
+	dprintf("[ INFO ] compact index over %lu pages at %lx\n", page_region_size >> 12, page_region);
+	return new KV<LinearProbingCompactHash>(hash, bf);
+}
+static const KVBackend backend = { "lpcompact", NewBackendKV, true, NULL };
+#elif defined RACE
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	/* buckets go into index_region when the server registered one for clients */
+	auto hash = new RaceHash(size, index_region, index_region_size);
+	dprintf("[ INFO ] one-sided index at %lx\n", hash->RegionBase());
+	return new KV<RaceHash>(hash, bf);
+}
+static const KVBackend backend = { "race", NewBackendKV, false, RaceHash::RegionSize };
+#elif defined HOTRING
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	return new KV<HotRing>(new HotRing(size), bf);
+}
+static const KVBackend backend = { "hotring", NewBackendKV, false, NULL };
+#else
+static KVStore* NewBackendKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	auto hash = new LinearProbingHash(size, clock_eviction ? EVICT_CLOCK : EVICT_FIFO);
+	dprintf("[ INFO ] LinearProbing eviction %s\n", clock_eviction ? "CLOCK" : "FIFO");
+	return new KV<LinearProbingHash>(hash, bf);
+}
+static const KVBackend backend = { "linear", NewBackendKV, false, NULL };
+#endif
+
+static KVBackendRegistrar registrar(&backend);
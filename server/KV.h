@@ -1,5 +1,5 @@
-#ifndef NUMA_KV_H_
-#define NUMA_KV_H_
+#ifndef KV_H_
+#define KV_H_
 
 #include <atomic>
 #include <cstring>
@@ -46,21 +46,26 @@ struct Extent{
 	}
 };
 
+/*
+ * KV store over one hash backend. Backend is the concrete (final) table
+ * class, so calls into the index are direct instead of through IHash.
+ * KV.cpp is compiled once per backend macro and registers its instance,
+ * see KVBackend below.
+ */
+template <class Backend>
 class KV : public KVStore {
 	public:
-		KV(void);
-		KV(size_t);
-		KV(size_t, CountingBloomFilter<Key_t>*);
+		KV(Backend*, CountingBloomFilter<Key_t>*);
 		~KV(void);
 		bool Insert(Key_t&, Value_t);
+		size_t InsertBatch(Key_t*, Value_t*, size_t);
 		void InsertExtent(Key_t&, Value_t, uint64_t);
 		bool Delete(Key_t&);
 		Value_t Get(Key_t&);
+		void GetBatch(Key_t*, Value_t*, size_t);
 		Value_t GetExtent(Key_t&);
-		int GetNodeID(Key_t&);
 		Value_t FindAnyway(Key_t&);
 		bool Recovery(void);
-		bool WaitComplete(void);
 		double Utilization(void);
 		size_t Capacity(void);
 		void PrintStats(void);
@@ -70,23 +75,38 @@ class KV : public KVStore {
 			if (posix_memalign(&ret, 64, size) ) ret=NULL;
 			return ret;
 		}
+		void operator delete(void* p) { free(p); }
 
 	private:
-		IHash* hash;
+		Backend* hash;
 		CountingBloomFilter<Key_t>* bf;
-		Logger *logger;
-		ofstream * _logfile;
-		void* global_chunk = NULL;
-		vector<thread> receivers;
-		vector<thread> cq_pollers;
-		vector<thread> numakvThreads;
-		atomic<int> nr_completed = 0;
-		int nr_data;
-		std::mutex m;
 #ifdef KV_DEBUG
 		uint64_t insertTime = 0;
 		uint64_t getTime = 0;
 #endif
 };
 
+/*
+ * Backends linked into a binary, selected at runtime with --backend.
+ * Every KV_<name>.o adds one entry when the binary starts.
+ */
+struct KVBackend {
+	const char* name;
+	/* table size in entries, bloom filter or NULL */
+	KVStore* (*create)(size_t, CountingBloomFilter<Key_t>*);
+	/* values must be pages of page_region (compact index entries) */
+	bool needs_page_region;
+	/* bytes of index clients read one-sided for @size entries, 0 if the backend has none */
+	size_t (*one_sided_index_size)(size_t);
+};
+
+struct KVBackendRegistrar {
+	KVBackendRegistrar(const KVBackend*);
+};
+
+/* NULL picks the only linked backend, or linear if there are several */
+const KVBackend* FindKVBackend(const char* name);
+/* comma separated names of the linked backends */
+const char* KVBackends(void);
+
 #endif  // KV_H_
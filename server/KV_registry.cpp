@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "KV.h"
+#include "util/sharded_counter.h"
+
+using namespace std;
+
+/* request counters of KV<>, shared by all backends and shards in the binary */
+ShardedCounter deletecnt;
+ShardedCounter kv_putcnt;
+ShardedCounter kv_getcnt;
+
+/* on first use, KV_<name>.o registrars run before main() in any order */
+static vector<const KVBackend*>& registry(void) {
+	static vector<const KVBackend*> backends;
+	return backends;
+}
+
+KVBackendRegistrar::KVBackendRegistrar(const KVBackend* backend) {
+	auto& backends = registry();
+	auto it = backends.begin();
+	while (it != backends.end() && strcmp((*it)->name, backend->name) < 0)
+		++it;
+	backends.insert(it, backend);
+}
+
+const KVBackend* FindKVBackend(const char* name) {
+	auto& backends = registry();
+	if (!name) {
+		if (backends.size() == 1)
+			return backends[0];
+		name = "linear";
+	}
+	for (auto backend : backends) {
+		if (!strcmp(backend->name, name))
+			return backend;
+	}
+	return NULL;
+}
+
+const char* KVBackends(void) {
+	static string names;
+	if (names.empty()) {
+		for (auto backend : registry()) {
+			if (!names.empty())
+				names += ", ";
+			names += backend->name;
+		}
+	}
+	return names.c_str();
+}
@@ -2,33 +2,31 @@
 #include <stdarg.h>
 #include <algorithm>
 #include <atomic>
-#include <condition_variable>
 #include <cstdlib>
 #include <ctime>
-#include <fstream>
 #include <iostream>
-#include <mutex>
 #include <numa.h>
+#include <sched.h>
 #include <thread>
 #include <unistd.h>
 #include <vector>
 
 #include "NuMA_KV.h"
 #include "variables.h"
+#include "util/sharded_counter.h"
 
 extern bool verbose_flag;
-extern size_t numData;
-extern struct bitmask *netcpubuf;
 extern struct bitmask *kvcpubuf;
-extern struct bitmask *pollcpubuf;
-extern int putcnt;
-extern int getcnt;
 
+/* shared by every backend linked in, defined in KV_registry.cpp */
+extern ShardedCounter deletecnt;
+extern ShardedCounter kv_putcnt;
+extern ShardedCounter kv_getcnt;
 
 using namespace std;
 
-void *global_chunk = NULL;
-atomic<int> offset = 0;
+/* each poller collects its finished work_requests here */
+static thread_local MPSCRing<work_request*, NUMA_KV_CQ_SIZE> completionQueue;
 
 static void dprintf( const char* format, ... ) {
 	if (verbose_flag) {
@@ -39,115 +37,179 @@ static void dprintf( const char* format, ... ) {
 	}
 }
 
-NUMA_KV::NUMA_KV(void)
-	: cceh{new CCEH}
+NUMA_KV::NUMA_KV(size_t size, CountingBloomFilter<Key_t>* _bf, struct bitmask* cpus, int _nr_nodes)
+	: cceh{new CCEH(size / Segment::kNumSlot, _nr_nodes)}, bf{_bf},
+	nr_nodes{min(max(_nr_nodes, 1), NUM_NUMA)}
 {
-	dprintf("[  OK  ] NUMA_KV \n");
-}
-
-NUMA_KV::NUMA_KV(size_t initCap)
-	: cceh{new CCEH(static_cast<size_t>(initCap))}
-{
-	int numable = numa_available();
-	if (numable == 0)
+	bool numable = numa_available() >= 0;
+	if (numable)
 		dprintf("[  OK  ] NUMA feature ON\n");
 	else
 		dprintf("[ FAIL ] NUMA feature OFF\n");
+	nr_phys = numable ? numa_max_node() + 1 : 1;
 
-#ifdef KV_DEBUG
-	insertTime = 0;
-	getTime = 0;
-#endif
+	/* without --kvcpubind, one worker on the first CPU of every node */
+	struct bitmask* mask = cpus;
+	if (!mask) {
+		mask = numa_allocate_cpumask();
+		for (int phys = 0; phys < nr_phys; ++phys) {
+			for (int cpu = 0; cpu < numa_num_configured_cpus(); ++cpu) {
+				if (!numable || numa_node_of_cpu(cpu) == phys) {
+					numa_bitmask_setbit(mask, cpu);
+					break;
+				}
+			}
+		}
+	}
+	executor = new Executor(mask);
+	if (!cpus)
+		numa_free_cpumask(mask);
 
-	dprintf("[  OK  ] NUMA_KV init\n");
+	for (int phys = 0; phys < nr_phys && phys < nr_nodes; ++phys) {
+		if (numable && !executor->Workers(phys))
+			dprintf("[ INFO ] no KV CPU on node %d, its requests are stolen\n", phys);
+	}
+	dprintf("[  OK  ] NUMA_KV init, %d nodes, %lu workers\n", nr_nodes, executor->Workers());
 }
 
 NUMA_KV::~NUMA_KV(void)
-{ 
+{
+	delete executor;
 }
 
-void NUMA_KV::InsertExtent(Key_t& key, Value_t value, uint64_t len) {
-#ifdef KV_DEBUG
-	struct timespec i_start;
-	struct timespec i_end;
-	clock_gettime(CLOCK_MONOTONIC, &i_start);
-#endif
-	auto extent = new Extent(key, value, len);
-	cceh->Insert_extent(extent->_key, (Value_t)extent, extent->_len);
-#ifdef KV_DEBUG
-	clock_gettime(CLOCK_MONOTONIC, &i_end);
-	insertTime += i_end.tv_nsec - i_start.tv_nsec + (i_end.tv_sec - i_start.tv_sec)*1000000000;
-#endif
+void NUMA_KV::execute(work_request* wr) {
+	if (wr->msg_type == MSG_INSERT) {
+		for (size_t i = 0; i < wr->n; ++i)
+			cceh->Insert(wr->keys[i], wr->values[i]);
+	} else {
+		for (size_t i = 0; i < wr->n; ++i)
+			wr->values[i] = cceh->Get(wr->keys[i]);
+	}
 
-	return;
+	while (!wr->completion->push(wr))
+		this_thread::yield();
+}
+
+/*
+ * Splits the keys by node (counting sort, up to IHash::kMaxBatch keys at
+ * a time), submits one work_request per node to the workers of its
+ * physical node (logical node n runs on n % nr_phys) and waits for all of
+ * them on this thread's completion queue. The nodes work on a batch in
+ * parallel.
+ */
+void NUMA_KV::submit(uint16_t msg_type, Key_t* keys, Value_t* values, size_t n) {
+	for (size_t off = 0; off < n; off += IHash::kMaxBatch) {
+		auto m = min(n - off, IHash::kMaxBatch);
+		size_t start[NUM_NUMA + 1] = {0};
+		uint8_t owner[IHash::kMaxBatch];
+		for (size_t i = 0; i < m; ++i) {
+			owner[i] = cceh->GetNodeID(keys[off + i]);
+			start[owner[i] + 1]++;
+		}
+		for (int node = 0; node < nr_nodes; ++node)
+			start[node + 1] += start[node];
+
+		Key_t part_keys[IHash::kMaxBatch];
+		Value_t part_values[IHash::kMaxBatch];
+		uint8_t pos[IHash::kMaxBatch];
+		size_t fill[NUM_NUMA];
+		copy(start, start + nr_nodes, fill);
+		for (size_t i = 0; i < m; ++i) {
+			auto at = fill[owner[i]]++;
+			part_keys[at] = keys[off + i];
+			if (msg_type == MSG_INSERT)
+				part_values[at] = values[off + i];
+			pos[i] = at;
+		}
+
+		work_request reqs[NUM_NUMA];
+		size_t nr_queued = 0;
+		for (int node = 0; node < nr_nodes; ++node) {
+			reqs[node].n = start[node + 1] - start[node];
+			if (!reqs[node].n)
+				continue;
+			reqs[node].msg_type = msg_type;
+			reqs[node].keys = part_keys + start[node];
+			reqs[node].values = part_values + start[node];
+			reqs[node].completion = &completionQueue;
+			auto wr = &reqs[node];
+			executor->Submit([this, wr] { execute(wr); }, node % nr_phys);
+			nr_queued++;
+		}
+		/* the filter is global, update it while the nodes insert */
+		if (msg_type == MSG_INSERT && bf)
+			bf->Insert(keys + off, m);
+
+		work_request* done;
+		for (size_t i = 0; i < nr_queued; ++i) {
+			while (!completionQueue.pop(&done))
+				this_thread::yield();
+		}
+		if (msg_type == MSG_GET) {
+			for (size_t i = 0; i < m; ++i)
+				values[off + i] = part_values[pos[i]];
+		}
+	}
 }
 
-void NUMA_KV::Insert(Key_t& key, Value_t value, int unique_id, int thisNode) {
+// CCEH_hybrid grows instead of evicting, return deleted or not
+bool NUMA_KV::Insert(Key_t& key, Value_t value) {
+	InsertBatch(&key, &value, 1);
+	return false;
+}
+
+size_t NUMA_KV::InsertBatch(Key_t* keys, Value_t* values, size_t n) {
+	kv_putcnt.add(n);
 #ifdef KV_DEBUG
 	struct timespec i_start;
 	struct timespec i_end;
 	clock_gettime(CLOCK_MONOTONIC, &i_start);
 #endif
-	cceh->Insert(key, value);
+	submit(MSG_INSERT, keys, values, n);
 #ifdef KV_DEBUG
 	clock_gettime(CLOCK_MONOTONIC, &i_end);
 	insertTime += i_end.tv_nsec - i_start.tv_nsec + (i_end.tv_sec - i_start.tv_sec)*1000000000;
 #endif
+	return 0;
+}
 
+/* extents run on the caller, CCEH_hybrid is safe for concurrent use */
+void NUMA_KV::InsertExtent(Key_t& key, Value_t value, uint64_t len) {
+	auto extent = new Extent(key, value, len);
+	cceh->Insert_extent(extent->_key, (Value_t)extent, extent->_len);
 	return;
 }
 
-/* extented get */
-Value_t NUMA_KV::GetExtent(Key_t& key) {
-#ifdef KV_DEBUG
-	struct timespec g_start;
-	clock_gettime(CLOCK_MONOTONIC, &g_start);
-#endif
-	auto ret = cceh->Get_extent(key); /*  XXX */
-	if (!ret)
-		return ret;
-	auto extent = (Extent *)ret; /*  XXX */
-	auto key_diff = key - extent->_key;
-	auto target = extent->_value + 4096 * key_diff;
-	dprintf("key_diff=%lu, value=%llx\n", key_diff, target);
-#ifdef KV_DEBUG
-	struct timespec g_end;
-	clock_gettime(CLOCK_MONOTONIC, &g_end);
-	getTime += g_end.tv_nsec - g_start.tv_nsec + (g_end.tv_sec - g_start.tv_sec)*1000000000;
-#endif
-	return target;
+Value_t NUMA_KV::Get(Key_t& key) {
+	Value_t value = NONE;
+	GetBatch(&key, &value, 1);
+	return value;
 }
 
-/* Normal get non-queue */
-Value_t NUMA_KV::Get(Key_t& key, int thisNode) {
+void NUMA_KV::GetBatch(Key_t* keys, Value_t* values, size_t n) {
+	kv_getcnt.add(n);
 #ifdef KV_DEBUG
 	struct timespec g_start;
 	clock_gettime(CLOCK_MONOTONIC, &g_start);
 #endif
-	auto ret = cceh->Get(key);
+	submit(MSG_GET, keys, values, n);
 #ifdef KV_DEBUG
 	struct timespec g_end;
 	clock_gettime(CLOCK_MONOTONIC, &g_end);
 	getTime += g_end.tv_nsec - g_start.tv_nsec + (g_end.tv_sec - g_start.tv_sec)*1000000000;
 #endif
-	return ret; 
 }
 
-void NUMA_KV::Get(Key_t& key, int unique_id, int thisNode) {
-	auto node = 0;
-#ifdef NUMAQ
-	node = cceh->GetNodeID(key);
-#else
-	node = rand() % kNumNodes;
-#endif
-
-	struct work_request *wr = (struct work_request *)malloc(sizeof(struct work_request));
-	wr->unique_id = unique_id;
-	wr->msg_type = MSG_GET;
-	wr->key = key;
-	
-	enqueue( perNodeQueue[node], wr );
-	return; 
+/* extented get */
+Value_t NUMA_KV::GetExtent(Key_t& key) {
+	auto ret = cceh->Get_extent(key); /*  XXX */
+	if (!ret)
+		return ret;
+	auto extent = (Extent *)ret; /*  XXX */
+	auto key_diff = key - extent->_key;
+	auto target = extent->_value + 4096 * key_diff;
+	dprintf("key_diff=%lu, value=%llx\n", key_diff, target);
+	return target;
 }
 
 int NUMA_KV::GetNodeID(Key_t& key) {
@@ -158,17 +220,17 @@ Value_t NUMA_KV::FindAnyway(Key_t& key) {
 	return cceh->FindAnyway(key);
 }
 
-bool NUMA_KV::WaitComplete(void) {
-	for(auto& t: cq_pollers) t.join();
-	return true;
-}
-
 bool NUMA_KV::Recovery(void) {
 	return cceh->Recovery();
 }
 
 bool NUMA_KV::Delete(Key_t& key) {
-	return false;
+	if (!cceh->Delete(key))
+		return false;
+
+	if (bf)
+		bf->Delete(key);
+	return true;
 }
 
 double NUMA_KV::Utilization(void) {
@@ -183,22 +245,24 @@ void NUMA_KV::PrintStats(void) {
 #ifdef KV_DEBUG
 	auto util = cceh->Utilization();
 	auto cap = cceh->Capacity();
-//	auto freqs = cceh->Freqs();
-//	auto segs = cceh->SegmentLoads();
-//	auto metrics = cceh->Metrics();
+	auto segs = cceh->SegmentLoads();
 
-//	printf("Failed Search = %d\n", failedSearch.load());
+	printf("Total put = %ld, get = %ld\n", kv_putcnt.read(), kv_getcnt.read());
 	printf("Util =%.3f\t Capa =%lu\n", util, cap);
-//	printf("Freqeuncy on Node \t0= %d, 1= %d   ( counted on only Insert )\n", freqs[0], freqs[1]);
-//	printf("Remote request on Node \t0= %d, 1= %d\n", miss_cnt[0].load(), miss_cnt[1].load());
-//	printf("Segments in Node \t0= %zu, 1= %zu\n", segs[0], segs[1]);
-//	printf("LRFU Value on Node \t0= %f, 1=%f\n", metrics[0], metrics[1]);
-//	printf("QueueTime = \t%.3f (usec/req)\n", perNodeQueueTime/1000.0/numData/2);
-	printf("InsertTime = \t%.3f (usec/req)\n", insertTime/1000.0/putcnt);
-	printf("GetTime= \t%.3f (usec/req)\n", getTime/1000.0/getcnt);
-
-//	printf("%.3f, %lu, %d, %d, %d, %d, %zu, %zu, %.3f, %.3f, %.3f, %.3f, %.3f\n", util, cap, freqs[0], freqs[1], miss_cnt[0].load(), miss_cnt[1].load(), segs[0], segs[1], metrics[0], metrics[1], \
-			perNodeQueueTime/1000.0/numData/2, insertTime/1000.0/numData, getTime/1000.0/numData);
+	for (int node = 0; node < nr_nodes; ++node)
+		printf("Segments in Node %d = %zu, workers = %zu\n", node, segs[node], executor->Workers(node % nr_phys));
+	printf("Steals = %lu, remote = %lu\n", executor->Steals(), executor->RemoteSteals());
+	printf("InsertTime = \t%.3f (usec/req)\n", insertTime/1000.0/(kv_putcnt.read() + 1));
+	printf("GetTime= \t%.3f (usec/req)\n", getTime/1000.0/(kv_getcnt.read() + 1));
 #endif
 	return;
 }
+
+/* one logical node per NUMA node of the machine */
+static KVStore* NewNumaKV(size_t size, CountingBloomFilter<Key_t>* bf) {
+	int nr_nodes = numa_available() < 0 ? 1 : numa_max_node() + 1;
+	return new NUMA_KV(size, bf, kvcpubuf, nr_nodes);
+}
+static const KVBackend backend = { "numa", NewNumaKV, false, NULL };
+
+static KVBackendRegistrar registrar(&backend);
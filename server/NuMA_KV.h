@@ -8,72 +8,55 @@
 #include <thread>
 #include <pthread.h>
 #include <iostream>
-#include <bitset>
-#include <mutex>
-#include <condition_variable>
 #include <numa.h>
 
-#include "ICCEH.h"
-#include "Ikvstore.h"
+#include "KV.h"
 #include "CCEH_hybrid.h"
-#include "circular_queue.h"
-#include "util/atomic.h"
-
-#define kNumNodes 2
-
-#define MSG_EMPTY 0
-#define MSG_INSERT 1
-#define MSG_GET 2
+#include "util/executor.h"
+#include "util/mpsc_ring.h"
 
 using namespace std;
 
+/* completions a poller can have outstanding, one per node and call */
+#define NUMA_KV_CQ_SIZE 16
+
 struct work_request
 {
 	uint16_t msg_type;
-	Key_t key;
-	Value_t value;
-	int unique_id;
-#if KV_DEBUG
-	struct timespec time; 
-#endif
-};
-
-struct Extent{
-	uint64_t _key;
-	uint64_t _len;
-	Value_t _value;
-
-
-	Extent(void)
-	{  
-		_key = 0;
-		_len = 0;
-		_value = NULL;
-	}
-
-	Extent(uint64_t key, Value_t value, uint64_t len)
-	{  
-		_key = key;
-		_len = len;
-		_value = value;
-	}
+	Key_t* keys;
+	Value_t* values;
+	size_t n;
+	/* the issuing poller's completion queue */
+	MPSCRing<work_request*, NUMA_KV_CQ_SIZE>* completion;
 };
 
+/*
+ * NUMA partitioned KV over CCEH_hybrid: the key hash picks a node, whose
+ * segments live in that node's memory. Requests run on a work-stealing
+ * Executor (util/executor.h) with workers on --kvcpubind, or the first
+ * CPU of every node. A caller splits its keys by node and submits one
+ * work_request per node to a worker of that node, then collects them back
+ * from its own completion queue, in any order. An idle worker steals from
+ * its own node first, so segments are mostly touched from their node, and
+ * parks when there is nothing left.
+ *
+ * Registered as the "numa" backend.
+ */
 class NUMA_KV : public KVStore {
 	public:
-		NUMA_KV(void);
-		NUMA_KV(size_t);
+		/* @nr_nodes: logical nodes, more than the machine has share its nodes */
+		NUMA_KV(size_t, CountingBloomFilter<Key_t>*, struct bitmask*, int);
 		~NUMA_KV(void);
-		void Insert(Key_t&, Value_t, int, int);
+		bool Insert(Key_t&, Value_t);
+		size_t InsertBatch(Key_t*, Value_t*, size_t);
 		void InsertExtent(Key_t&, Value_t, uint64_t);
 		bool Delete(Key_t&);
-		void Get(Key_t&, int, int);
-		Value_t Get(Key_t&, int);
+		Value_t Get(Key_t&);
+		void GetBatch(Key_t*, Value_t*, size_t);
 		Value_t GetExtent(Key_t&);
 		int GetNodeID(Key_t&);
 		Value_t FindAnyway(Key_t&);
 		bool Recovery(void);
-		bool WaitComplete(void);
 		double Utilization(void);
 		size_t Capacity(void);
 		void PrintStats(void);
@@ -83,20 +66,21 @@ class NUMA_KV : public KVStore {
 			if (posix_memalign(&ret, 64, size) ) ret=NULL;
 			return ret;
 		}
+		void operator delete(void* p) { free(p); }
 
 	private:
-		ICCEH* cceh;
-		void* global_chunk = NULL;
-		queue_t **perNodeQueue = NULL;
-		queue_t **completionQueue = NULL;
-		vector<thread> receivers;
-		vector<thread> cq_pollers;
-		vector<thread> numakvThreads;
-		atomic<int> nr_completed = 0;
-		int nr_data;
+		void execute(work_request*);
+		void submit(uint16_t, Key_t*, Value_t*, size_t);
+
+		CCEH* cceh;
+		CountingBloomFilter<Key_t>* bf;
+		int nr_nodes;
+		/* physical node of every logical node */
+		int nr_phys;
+		Executor* executor;
 #ifdef KV_DEBUG
-		uint64_t insertTime = 0;
-		uint64_t getTime = 0;
+		atomic<uint64_t> insertTime{0};
+		atomic<uint64_t> getTime{0};
 #endif
 };
 
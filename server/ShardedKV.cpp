@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <cstdlib>
+#include <numa.h>
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+
+#include "ShardedKV.h"
+
+extern bool verbose_flag;
+
+using namespace std;
+
+static void dprintf( const char* format, ... ) {
+	if (verbose_flag) {
+		va_list args;
+		va_start( args, format );
+		vprintf( format, args );
+		va_end( args );
+	}
+}
+
+ShardedKV::ShardedKV(const KVBackend* backend, size_t size,
+		CountingBloomFilter<Key_t>* bf, size_t _nr_shards, struct bitmask* cpus)
+	: nr_shards(_nr_shards), steering(cpus != NULL), nr_ready(0), stop(false)
+{
+	if (nr_shards == 0 || nr_shards > kMaxShards) {
+		fprintf(stderr, "[ FAIL ] %lu shards, 1 to %lu supported\n", nr_shards, kMaxShards);
+		exit(EXIT_FAILURE);
+	}
+	if (backend->one_sided_index_size) {
+		/* clients find buckets in one registered index, there is no shard to pick */
+		fprintf(stderr, "[ FAIL ] backend %s can not be sharded\n", backend->name);
+		exit(EXIT_FAILURE);
+	}
+
+	shards = new Shard[nr_shards];
+	if (!steering) {
+		for (size_t i = 0; i < nr_shards; ++i)
+			shards[i].kv = backend->create(size / nr_shards, bf);
+		dprintf("[  OK  ] %lu shards, requests run on the caller\n", nr_shards);
+		return;
+	}
+
+	vector<int> cpu_ids;
+	for (int cpu = 0; cpu < numa_num_configured_cpus(); ++cpu) {
+		if (numa_bitmask_isbitset(cpus, cpu))
+			cpu_ids.push_back(cpu);
+	}
+	if (cpu_ids.empty()) {
+		fprintf(stderr, "[ FAIL ] no CPU given for shard workers\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < nr_shards; ++i) {
+		int cpu = cpu_ids[i % cpu_ids.size()];
+		shards[i].worker = thread(&ShardedKV::serve, this, i, backend, size / nr_shards, bf, cpu);
+	}
+	while (nr_ready.load(memory_order_acquire) < nr_shards)
+		this_thread::yield();
+	dprintf("[  OK  ] %lu shards on %lu worker CPUs\n", nr_shards, cpu_ids.size());
+}
+
+ShardedKV::~ShardedKV(void)
+{
+	stop.store(true, memory_order_release);
+	if (steering) {
+		for (size_t i = 0; i < nr_shards; ++i)
+			shards[i].worker.join();
+	}
+	delete[] shards;
+}
+
+/*
+ * Shard worker: pinned before it builds the shard, so the table is first
+ * touched (and placed) on the worker's node, then the only thread serving
+ * the shard.
+ */
+void ShardedKV::serve(size_t id, const KVBackend* backend, size_t size,
+		CountingBloomFilter<Key_t>* bf, int cpu)
+{
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+	if (rc != 0)
+		fprintf(stderr, "[ FAIL ] shard %lu can not bind to CPU %d: %d\n", id, cpu, rc);
+
+	Shard& shard = shards[id];
+	shard.kv = backend->create(size, bf);
+	nr_ready.fetch_add(1, memory_order_release);
+
+	Request* req;
+	while (!stop.load(memory_order_acquire)) {
+		if (shard.ring.pop(&req))
+			execute(shard, req);
+		else
+			this_thread::yield();
+	}
+}
+
+void ShardedKV::execute(Shard& shard, Request* req)
+{
+	switch (req->op) {
+		case OP_INSERT:
+			req->result = shard.kv->InsertBatch(req->keys, req->values, req->n);
+			break;
+		case OP_GET:
+			shard.kv->GetBatch(req->keys, req->values, req->n);
+			break;
+		case OP_DELETE:
+			req->result = shard.kv->Delete(req->keys[0]);
+			break;
+	}
+	req->done.store(true, memory_order_release);
+}
+
+void ShardedKV::submit(size_t id, Request* req)
+{
+	req->done.store(false, memory_order_relaxed);
+	if (!steering) {
+		execute(shards[id], req);
+		return;
+	}
+	while (!shards[id].ring.push(req))
+		this_thread::yield();
+}
+
+void ShardedKV::wait(Request* req)
+{
+	while (!req->done.load(memory_order_acquire))
+		this_thread::yield();
+}
+
+bool ShardedKV::Insert(Key_t& key, Value_t value) {
+	Request req;
+	req.op = OP_INSERT;
+	req.keys = &key;
+	req.values = &value;
+	req.n = 1;
+	submit(ShardOf(key), &req);
+	wait(&req);
+	return req.result != 0;
+}
+
+/*
+ * A batch is split by shard (counting sort, up to IHash::kMaxBatch keys
+ * at a time), every part is handed to its shard before waiting on any,
+ * so the shards work on one batch in parallel.
+ */
+size_t ShardedKV::InsertBatch(Key_t* keys, Value_t* values, size_t n) {
+	size_t nr_evicted = 0;
+	for (size_t off = 0; off < n; off += IHash::kMaxBatch) {
+		auto m = min(n - off, IHash::kMaxBatch);
+		size_t start[kMaxShards + 1] = {0};
+		uint8_t owner[IHash::kMaxBatch];
+		for (size_t i = 0; i < m; ++i) {
+			owner[i] = ShardOf(keys[off + i]);
+			start[owner[i] + 1]++;
+		}
+		for (size_t s = 0; s < nr_shards; ++s)
+			start[s + 1] += start[s];
+
+		Key_t part_keys[IHash::kMaxBatch];
+		Value_t part_values[IHash::kMaxBatch];
+		size_t fill[kMaxShards];
+		copy(start, start + nr_shards, fill);
+		for (size_t i = 0; i < m; ++i) {
+			auto at = fill[owner[i]]++;
+			part_keys[at] = keys[off + i];
+			part_values[at] = values[off + i];
+		}
+
+		Request reqs[kMaxShards];
+		for (size_t s = 0; s < nr_shards; ++s) {
+			reqs[s].n = start[s + 1] - start[s];
+			if (!reqs[s].n)
+				continue;
+			reqs[s].op = OP_INSERT;
+			reqs[s].keys = part_keys + start[s];
+			reqs[s].values = part_values + start[s];
+			submit(s, &reqs[s]);
+		}
+		for (size_t s = 0; s < nr_shards; ++s) {
+			if (!reqs[s].n)
+				continue;
+			wait(&reqs[s]);
+			nr_evicted += reqs[s].result;
+		}
+	}
+	return nr_evicted;
+}
+
+/* extents span keys of many shards, they all live in shard 0 */
+void ShardedKV::InsertExtent(Key_t& key, Value_t value, uint64_t len) {
+	shards[0].kv->InsertExtent(key, value, len);
+}
+
+bool ShardedKV::Delete(Key_t& key) {
+	Request req;
+	req.op = OP_DELETE;
+	req.keys = &key;
+	req.n = 1;
+	submit(ShardOf(key), &req);
+	wait(&req);
+	return req.result != 0;
+}
+
+Value_t ShardedKV::Get(Key_t& key) {
+	Value_t value;
+	Request req;
+	req.op = OP_GET;
+	req.keys = &key;
+	req.values = &value;
+	req.n = 1;
+	submit(ShardOf(key), &req);
+	wait(&req);
+	return value;
+}
+
+void ShardedKV::GetBatch(Key_t* keys, Value_t* values, size_t n) {
+	for (size_t off = 0; off < n; off += IHash::kMaxBatch) {
+		auto m = min(n - off, IHash::kMaxBatch);
+		size_t start[kMaxShards + 1] = {0};
+		uint8_t owner[IHash::kMaxBatch];
+		for (size_t i = 0; i < m; ++i) {
+			owner[i] = ShardOf(keys[off + i]);
+			start[owner[i] + 1]++;
+		}
+		for (size_t s = 0; s < nr_shards; ++s)
+			start[s + 1] += start[s];
+
+		Key_t part_keys[IHash::kMaxBatch];
+		Value_t part_values[IHash::kMaxBatch];
+		uint8_t pos[IHash::kMaxBatch];
+		size_t fill[kMaxShards];
+		copy(start, start + nr_shards, fill);
+		for (size_t i = 0; i < m; ++i) {
+			auto at = fill[owner[i]]++;
+			part_keys[at] = keys[off + i];
+			pos[i] = at;
+		}
+
+		Request reqs[kMaxShards];
+		for (size_t s = 0; s < nr_shards; ++s) {
+			reqs[s].n = start[s + 1] - start[s];
+			if (!reqs[s].n)
+				continue;
+			reqs[s].op = OP_GET;
+			reqs[s].keys = part_keys + start[s];
+			reqs[s].values = part_values + start[s];
+			submit(s, &reqs[s]);
+		}
+		for (size_t s = 0; s < nr_shards; ++s) {
+			if (reqs[s].n)
+				wait(&reqs[s]);
+		}
+		for (size_t i = 0; i < m; ++i)
+			values[off + i] = part_values[pos[i]];
+	}
+}
+
+Value_t ShardedKV::GetExtent(Key_t& key) {
+	return shards[0].kv->GetExtent(key);
+}
+
+/* debugging lookup, runs on the caller */
+Value_t ShardedKV::FindAnyway(Key_t& key) {
+	return shards[ShardOf(key)].kv->FindAnyway(key);
+}
+
+bool ShardedKV::Recovery(void) {
+	bool ret = true;
+	for (size_t i = 0; i < nr_shards; ++i)
+		ret &= shards[i].kv->Recovery();
+	return ret;
+}
+
+double ShardedKV::Utilization(void) {
+	double used = 0;
+	size_t cap = 0;
+	for (size_t i = 0; i < nr_shards; ++i) {
+		auto c = shards[i].kv->Capacity();
+		used += shards[i].kv->Utilization() * c;
+		cap += c;
+	}
+	return cap ? used / cap : 0;
+}
+
+size_t ShardedKV::Capacity(void) {
+	size_t cap = 0;
+	for (size_t i = 0; i < nr_shards; ++i)
+		cap += shards[i].kv->Capacity();
+	return cap;
+}
+
+/* request counters are shared, each shard adds its table and timing */
+void ShardedKV::PrintStats(void) {
+	for (size_t i = 0; i < nr_shards; ++i)
+		shards[i].kv->PrintStats();
+}
@@ -0,0 +1,96 @@
+#ifndef SHARDED_KV_H_
+#define SHARDED_KV_H_
+
+#include <atomic>
+#include <thread>
+#include <numa.h>
+
+#include "KV.h"
+#include "util/mpsc_ring.h"
+
+/*
+ * Shared-nothing KV: the table is split into shards by key hash, each one
+ * a KV of its own built by the backend with 1/n of the capacity.
+ *
+ * With worker CPUs (--kvcpubind) every shard gets a worker pinned to one
+ * of them, which builds the shard (so its memory is local to that node)
+ * and is the only thread touching it. Callers steer requests to the
+ * owning worker through its ring and wait for the reply; a batch is split
+ * by shard and its parts run on their workers in parallel. Without
+ * workers requests run on the calling thread, against the smaller shard.
+ *
+ * The bloom filter stays one for all shards, since clients read it whole.
+ */
+class ShardedKV : public KVStore {
+	public:
+		static constexpr size_t kMaxShards = 64;
+
+		/* @cpus: worker CPUs, used round robin; NULL runs requests on the caller */
+		ShardedKV(const KVBackend*, size_t, CountingBloomFilter<Key_t>*, size_t, struct bitmask*);
+		~ShardedKV(void);
+		bool Insert(Key_t&, Value_t);
+		size_t InsertBatch(Key_t*, Value_t*, size_t);
+		void InsertExtent(Key_t&, Value_t, uint64_t);
+		bool Delete(Key_t&);
+		Value_t Get(Key_t&);
+		void GetBatch(Key_t*, Value_t*, size_t);
+		Value_t GetExtent(Key_t&);
+		Value_t FindAnyway(Key_t&);
+		bool Recovery(void);
+		double Utilization(void);
+		size_t Capacity(void);
+		void PrintStats(void);
+
+		/* independent of the backends' hash, so a shard still uses its whole table */
+		size_t ShardOf(Key_t key) const {
+			key ^= key >> 33;
+			key *= 0xff51afd7ed558ccdULL;
+			key ^= key >> 33;
+			key *= 0xc4ceb9fe1a85ec53ULL;
+			key ^= key >> 33;
+			return key % nr_shards;
+		}
+
+		void* operator new(size_t size) {
+			void *ret;
+			if (posix_memalign(&ret, 64, size) ) ret=NULL;
+			return ret;
+		}
+		void operator delete(void* p) { free(p); }
+
+	private:
+		enum Op {
+			OP_INSERT,
+			OP_GET,
+			OP_DELETE,
+		};
+
+		struct Request {
+			Op op;
+			Key_t* keys;
+			Value_t* values;
+			size_t n;
+			/* keys evicted (OP_INSERT), deleted or not (OP_DELETE) */
+			size_t result;
+			std::atomic<bool> done;
+		};
+
+		struct alignas(64) Shard {
+			KVStore* kv;
+			MPSCRing<Request*, 256> ring;
+			std::thread worker;
+		};
+
+		void execute(Shard&, Request*);
+		void submit(size_t, Request*);
+		void wait(Request*);
+		void serve(size_t, const KVBackend*, size_t, CountingBloomFilter<Key_t>*, int);
+
+		size_t nr_shards;
+		bool steering;
+		Shard* shards;
+		std::atomic<size_t> nr_ready;
+		std::atomic<bool> stop;
+};
+
+#endif  // SHARDED_KV_H_
@@ -0,0 +1,120 @@
+/*
+ * Check of CCEH shrinking (src/cceh.h): merges and directory halving.
+ *
+ * Writer threads fill the table, then delete all but every kKeepEvery-th
+ * key while other threads keep inserting fresh keys, so segments split
+ * while a shrinker thread merges them and halves the directory. Once the
+ * threads are done, the table is shrunk until it stops changing. The
+ * directory and the capacity must have shrunk, every key left must be
+ * found with its value and no deleted key may be found.
+ *
+ *   g++ -std=c++17 -O2 -I./ cceh_test.cpp src/cceh.cpp -lpthread -o cceh_test
+ */
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "src/cceh.h"
+
+static const size_t kThreads = 2;
+static const size_t kKeysPerThread = 1 << 17;
+static const size_t kFreshPerThread = 1 << 12;
+/* keys of the first phase that survive the deletes */
+static const size_t kKeepEvery = 16;
+
+static Key_t key_of(size_t thread, size_t i) {
+	return (thread << 32) | (i + 1);
+}
+
+static Key_t fresh_key_of(size_t thread, size_t i) {
+	return (1UL << 40) | (thread << 32) | (i + 1);
+}
+
+static Value_t value_of(Key_t key) {
+	return (Value_t)(key << 1);
+}
+
+static void run(size_t nr_threads, std::function<void(size_t)> f) {
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < nr_threads; ++t)
+		threads.emplace_back(f, t);
+	for (auto& t : threads)
+		t.join();
+}
+
+int main(void) {
+	auto table = new CCEH(CCEH::Segment::kNumSlot * 2);
+	auto min_depth = table->Depth();
+
+	run(kThreads, [&](size_t t) {
+		for (size_t i = 0; i < kKeysPerThread; ++i) {
+			auto key = key_of(t, i);
+			table->Insert(key, value_of(key));
+		}
+	});
+	auto depth = table->Depth();
+	auto capacity = table->Capacity();
+
+	std::atomic<size_t> writers{2 * kThreads};
+	std::atomic<size_t> passes{0};
+	std::thread shrinker([&] {
+		while (writers.load() > 0) {
+			table->Shrink();
+			passes++;
+		}
+	});
+	run(2 * kThreads, [&](size_t t) {
+		if (t < kThreads) {
+			for (size_t i = 0; i < kKeysPerThread; ++i) {
+				auto key = key_of(t, i);
+				if (i % kKeepEvery && !table->Delete(key))
+					std::cout << "Error: key " << key << " could not be deleted" << std::endl;
+			}
+		} else {
+			t -= kThreads;
+			for (size_t i = 0; i < kFreshPerThread; ++i) {
+				auto key = fresh_key_of(t, i);
+				table->Insert(key, value_of(key));
+			}
+		}
+		writers--;
+	});
+	shrinker.join();
+
+	size_t last;
+	do {
+		last = table->Capacity();
+		table->Shrink();
+	} while (table->Capacity() != last);
+
+	size_t wrong = 0;
+	for (size_t t = 0; t < kThreads; ++t) {
+		for (size_t i = 0; i < kKeysPerThread; ++i) {
+			auto key = key_of(t, i);
+			auto v = table->Get(key);
+			if (v != (i % kKeepEvery ? NONE : value_of(key))) {
+				std::cout << "Error: key " << key << ((i % kKeepEvery) ? " still found" : " lost") << std::endl;
+				wrong++;
+			}
+		}
+		for (size_t i = 0; i < kFreshPerThread; ++i) {
+			auto key = fresh_key_of(t, i);
+			if (table->Get(key) != value_of(key)) {
+				std::cout << "Error: fresh key " << key << " lost" << std::endl;
+				wrong++;
+			}
+		}
+	}
+
+	std::cout << "depth " << depth << " -> " << table->Depth() << " (min " << min_depth << ")"
+		<< " capacity " << capacity << " -> " << table->Capacity()
+		<< " concurrent passes " << passes << " wrong " << wrong << std::endl;
+	if (table->Depth() >= depth || table->Capacity() >= capacity) {
+		std::cout << "Error: table did not shrink" << std::endl;
+		wrong++;
+	}
+
+	delete table;
+	return wrong ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Speed and quality of the hash policies in util/hash_policy.h.
+ *
+ *   speed      ns per hash, each key depending on the previous hash so the
+ *              loop measures latency, the way a probe waits for its index
+ *   chi-square 2^16 buckets from the low bits (% / & capacity, linear
+ *              probing, cuckoo) and the high bits (CCEH, Dash directory),
+ *              over sequential and random keys; |z| < 3 is uniform, far
+ *              below 0 is more even than random (CRC on sequential keys)
+ *   avalanche  probability that output bit j flips when input bit i does,
+ *              ideally 0.5 for all 64x64 pairs; mean and worst |p - 0.5|
+ *
+ * It first checks that crc32c gives the same hashes with the SSE4.2
+ * instruction as with the bitwise fallback, and fails if not.
+ *
+ *   g++ -std=c++17 -O2 -msse4.2 -I./ hashbench.cpp -o hashbench
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "util/hash_policy.h"
+
+static const size_t kSpeedKeys = 1 << 24;
+static const size_t kChiBits = 16;
+static const size_t kChiKeys = 1 << 22;
+static const size_t kAvalancheKeys = 1 << 16;
+
+static std::vector<Key_t> random_keys(size_t n) {
+	std::mt19937_64 rng(951125);
+	std::vector<Key_t> keys(n);
+	for (auto& k : keys)
+		k = rng();
+	return keys;
+}
+
+template <class Hash>
+static double speed(bool sequential) {
+	auto keys = random_keys(sequential ? 0 : kSpeedKeys);
+	size_t acc = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < kSpeedKeys; ++i) {
+		Key_t key = sequential ? i : keys[i];
+		acc = Hash::hash(key ^ (acc & 1));
+	}
+	auto end = std::chrono::steady_clock::now();
+	if (acc == 42)
+		std::cout << "";
+	return std::chrono::duration<double, std::nano>(end - start).count() / kSpeedKeys;
+}
+
+/* z-score of the chi-square statistic, normal with 2^kChiBits - 1 degrees of freedom */
+template <class Hash>
+static double chi_square(bool sequential, bool high_bits) {
+	const size_t nbuckets = 1 << kChiBits;
+	std::vector<size_t> count(nbuckets, 0);
+	std::mt19937_64 rng(42);
+	for (size_t i = 0; i < kChiKeys; ++i) {
+		Key_t key = sequential ? i : rng();
+		size_t hv = Hash::hash(key);
+		count[high_bits ? hv >> (64 - kChiBits) : hv & (nbuckets - 1)]++;
+	}
+	double expected = (double)kChiKeys / nbuckets, chi = 0;
+	for (auto c : count)
+		chi += (c - expected) * (c - expected) / expected;
+	double df = nbuckets - 1;
+	return (chi - df) / std::sqrt(2 * df);
+}
+
+template <class Hash>
+static void avalanche(double* mean, double* worst) {
+	static size_t flips[64][64];
+	memset(flips, 0, sizeof(flips));
+	std::mt19937_64 rng(7);
+	for (size_t n = 0; n < kAvalancheKeys; ++n) {
+		Key_t key = rng();
+		size_t base = Hash::hash(key);
+		for (int i = 0; i < 64; ++i) {
+			size_t diff = base ^ Hash::hash(key ^ (1ULL << i));
+			for (int j = 0; j < 64; ++j)
+				flips[i][j] += (diff >> j) & 1;
+		}
+	}
+	*mean = *worst = 0;
+	for (int i = 0; i < 64; ++i) {
+		for (int j = 0; j < 64; ++j) {
+			double bias = std::fabs((double)flips[i][j] / kAvalancheKeys - 0.5);
+			*mean += bias / (64 * 64);
+			*worst = std::max(*worst, bias);
+		}
+	}
+}
+
+template <class Hash>
+static void bench(void) {
+	double mean, worst;
+	avalanche<Hash>(&mean, &worst);
+	std::cout << std::left << std::setw(8) << Hash::name() << std::right << std::fixed
+		<< std::setprecision(2)
+		<< std::setw(8) << speed<Hash>(true)
+		<< std::setw(8) << speed<Hash>(false)
+		<< std::setprecision(1)
+		<< std::setw(10) << chi_square<Hash>(true, false)
+		<< std::setw(10) << chi_square<Hash>(true, true)
+		<< std::setw(10) << chi_square<Hash>(false, false)
+		<< std::setw(10) << chi_square<Hash>(false, true)
+		<< std::setprecision(4)
+		<< std::setw(9) << mean
+		<< std::setw(9) << worst << std::endl;
+}
+
+/* the crc32 instruction and the bitwise fallback must hash every key alike */
+static bool crc32c_agree(void) {
+#if defined(__SSE4_2__)
+	for (auto k : random_keys(kAvalancheKeys)) {
+		auto crc = (uint32_t)(k >> 17);
+		if (Crc32cHash::crc32c(crc, k) != Crc32cHash::crc32c_soft(crc, k)) {
+			std::cout << "Error: crc32c of " << k << " differs from the bitwise fallback" << std::endl;
+			return false;
+		}
+	}
+#endif
+	return true;
+}
+
+int main(void) {
+#if !defined(__SSE4_2__)
+	std::cout << "built without -msse4.2, crc32c uses the bitwise fallback" << std::endl;
+#endif
+	if (!crc32c_agree())
+		return 1;
+	std::cout << "                ns/hash      chi-square z (seq lo/hi, rand lo/hi)   avalanche bias" << std::endl;
+	std::cout << "policy     seq    rand     seq-lo    seq-hi   rand-lo   rand-hi     mean    worst" << std::endl;
+	bench<StdHash>();
+	bench<Crc32cHash>();
+	bench<Xxh3Hash>();
+	bench<WyHash>();
+	return 0;
+}
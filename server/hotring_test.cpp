@@ -0,0 +1,111 @@
+/*
+ * Stress check of the lock-free HotRing (src/hotring.h).
+ *
+ * kThreads threads insert their own keys into a table that starts at
+ * HotRing::kInitialBuckets buckets, so it doubles several times while
+ * they run. Each thread deletes every kDeleteEvery-th key it inserted,
+ * rewrites every kUpdateEvery-th one and looks up a skewed mix of its
+ * recent keys, which keeps the hotspot shifts busy. A lookup must find
+ * the value last written. Once the threads are done, every ring must be
+ * in order, in the right bucket and hold each key once, every kept key
+ * must be found with its value and no deleted key may be found.
+ *
+ *   g++ -std=c++17 -O2 -I./ hotring_test.cpp src/hotring.cpp -lpthread -o hotring_test
+ *
+ * Add -fsanitize=thread (or address) to run it under a sanitizer.
+ */
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "src/hotring.h"
+
+static const size_t kThreads = 8;
+static const size_t kKeysPerThread = 1 << 15;
+/* big enough that the table keeps doubling instead of evicting */
+static const size_t kCapacity = kThreads * kKeysPerThread * 64;
+static const size_t kDeleteEvery = 4;
+static const size_t kUpdateEvery = 8;
+static const size_t kGetsPerInsert = 2;
+
+static Key_t key_of(size_t thread, size_t i) {
+	return (thread << 32) | (i + 1);
+}
+
+static Value_t value_of(Key_t key, bool updated) {
+	return (Value_t)((key << 1) | updated);
+}
+
+static bool deleted(size_t i) {
+	return i % kDeleteEvery == kDeleteEvery - 1;
+}
+
+static bool updated(size_t i) {
+	return !deleted(i) && i % kUpdateEvery == 0;
+}
+
+int main(void) {
+	auto table = new HotRing(kCapacity);
+	std::atomic<size_t> wrong{0};
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < kThreads; ++t) {
+		threads.emplace_back([&, t] {
+			std::mt19937_64 rng(t);
+			for (size_t i = 0; i < kKeysPerThread; ++i) {
+				auto key = key_of(t, i);
+				if (table->Insert(key, value_of(key, false)) != (Key_t)-1) {
+					std::cout << "Error: key " << key << " evicted another" << std::endl;
+					wrong++;
+				}
+				if (updated(i))
+					table->Insert(key, value_of(key, true));
+				if (deleted(i) && !table->Delete(key)) {
+					std::cout << "Error: key " << key << " could not be deleted" << std::endl;
+					wrong++;
+				}
+
+				/* mostly the last few keys, the hot ones */
+				for (size_t g = 0; g < kGetsPerInsert; ++g) {
+					auto r = rng();
+					auto j = (r & 3) ? i - (r >> 2) % std::min<size_t>(i + 1, 16) : (r >> 2) % (i + 1);
+					auto k = key_of(t, j);
+					auto v = table->Get(k);
+					auto expect = deleted(j) ? NONE : value_of(k, updated(j));
+					if (v != expect) {
+						std::cout << "Error: key " << k << " returned " << (void*)v << " instead of " << (void*)expect << std::endl;
+						wrong++;
+					}
+				}
+			}
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+
+	size_t nr_nodes;
+	auto bad = table->Verify(&nr_nodes);
+	size_t expected = 0;
+	for (size_t t = 0; t < kThreads; ++t) {
+		for (size_t i = 0; i < kKeysPerThread; ++i) {
+			auto key = key_of(t, i);
+			auto expect = deleted(i) ? NONE : value_of(key, updated(i));
+			if (table->Get(key) != expect) {
+				std::cout << "Error: key " << key << (deleted(i) ? " still found" : " lost") << std::endl;
+				wrong++;
+			}
+			expected += !deleted(i);
+		}
+	}
+	if (nr_nodes != expected) {
+		std::cout << "Error: " << nr_nodes << " nodes for " << expected << " keys" << std::endl;
+		wrong++;
+	}
+
+	std::cout << "nodes " << nr_nodes << " bad " << bad << " wrong " << wrong << std::endl;
+	delete table;
+	return (bad || wrong) ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Userspace check of one-sided lookups on the RACE index (src/race_hash.h).
+ *
+ * Server threads insert keys into a small table, each with a fresh page
+ * stamped with its key, so the table keeps evicting and updating slots.
+ * Client threads meanwhile look keys up the way an RDMA client would,
+ * through read_remote() standing in for one RDMA READ: the cached
+ * directory, both combined buckets, then the page. A hit must return a
+ * page stamped with the key it was looked up with. Once the server
+ * threads are done, every key must resolve to what the server's own
+ * Get returns.
+ *
+ *   g++ -std=c++17 -O2 -I./ race_test.cpp src/race_hash.cpp -lpthread -o race_test
+ */
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+
+#include "src/race_hash.h"
+
+#define PAGE_SIZE 4096
+
+static const size_t kCapacity = 4096;
+static const size_t kServerThreads = 2;
+static const size_t kClientThreads = 2;
+static const size_t kInsertsPerThread = 16384;
+/* every kUpdateEvery-th insert of a server thread rewrites an earlier key */
+static const size_t kUpdateEvery = 4;
+
+static std::atomic<uint64_t> nreads{0};
+
+/* one RDMA READ */
+static void read_remote(uint64_t remote_addr, void* buf, size_t len) {
+	memcpy(buf, (void*)remote_addr, len);
+	nreads.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void cache_directory(uint64_t base, race_directory* dir) {
+	read_remote(base, &dir->hdr, sizeof(dir->hdr));
+	read_remote(base + sizeof(dir->hdr), dir->subtable, dir->hdr.nsubtables * sizeof(uint64_t));
+}
+
+/* page address of @key, or 0 */
+static uint64_t lookup(const race_directory* dir, uint64_t key) {
+	uint64_t addr[2];
+	race_bucket combined[2][2];
+
+	race_candidates(dir, key, addr);
+	read_remote(addr[0], combined[0], RACE_COMBINED_SIZE);
+	read_remote(addr[1], combined[1], RACE_COMBINED_SIZE);
+	return race_search(combined, key);
+}
+
+static Key_t key_of(size_t thread, size_t i) {
+	return (thread << 32) | (i + 1);
+}
+
+int main(int argc, char *argv[]) {
+	auto npages = kServerThreads * kInsertsPerThread;
+	auto pages = (char*)mmap(NULL, npages * PAGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pages == MAP_FAILED) {
+		perror("mmap pages");
+		return 1;
+	}
+
+	auto hash = new RaceHash(kCapacity, 0, 0);
+	std::atomic<size_t> inserted[kServerThreads];
+	std::atomic<size_t> servers_done{0};
+	std::atomic<uint64_t> lookups{0}, hits{0}, wrong{0}, evicted{0};
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < kServerThreads; ++t) {
+		inserted[t] = 0;
+		threads.emplace_back([&, t] {
+			std::mt19937_64 rng(t);
+			for (size_t i = 0; i < kInsertsPerThread; ++i) {
+				/* pages are handed out once and never reused, like rdma_svr */
+				auto page = pages + (t * kInsertsPerThread + i) * PAGE_SIZE;
+				Key_t key = (i % kUpdateEvery == kUpdateEvery - 1) ?
+					key_of(t, rng() % i) : key_of(t, i);
+				memcpy(page, &key, sizeof(key));
+				if (hash->Insert(key, page) != (Key_t)-1)
+					evicted++;
+				inserted[t].store(i + 1, std::memory_order_release);
+			}
+			servers_done++;
+		});
+	}
+
+	for (size_t c = 0; c < kClientThreads; ++c) {
+		threads.emplace_back([&, c] {
+			race_directory dir;
+			cache_directory(hash->RegionBase(), &dir);
+			if (dir.hdr.magic != RACE_MAGIC) {
+				std::cout << "Error: bad index magic " << std::hex << dir.hdr.magic << std::endl;
+				exit(1);
+			}
+
+			std::mt19937_64 rng(100 + c);
+			char page[PAGE_SIZE];
+			while (servers_done.load() < kServerThreads) {
+				auto t = rng() % kServerThreads;
+				auto n = inserted[t].load(std::memory_order_acquire);
+				if (!n)
+					continue;
+				Key_t key = key_of(t, rng() % n);
+				lookups++;
+				auto addr = lookup(&dir, key);
+				if (!addr)
+					continue;
+				read_remote(addr, page, PAGE_SIZE);
+				Key_t stamp;
+				memcpy(&stamp, page, sizeof(stamp));
+				if (stamp != key) {
+					std::cout << "Error: key " << key << " resolved to the page of " << stamp << std::endl;
+					wrong++;
+				}
+				hits++;
+			}
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+	/* two for the directory per client, two per lookup plus one per hit */
+	double reads_per_lookup = (double)(nreads - 2 * kClientThreads) / lookups;
+
+	/* quiescent: the client view must match the server's */
+	race_directory dir;
+	cache_directory(hash->RegionBase(), &dir);
+	size_t resident = 0;
+	for (size_t t = 0; t < kServerThreads; ++t) {
+		for (size_t i = 0; i < kInsertsPerThread; ++i) {
+			Key_t key = key_of(t, i);
+			auto addr = lookup(&dir, key);
+			if (addr != (uint64_t)hash->Get(key)) {
+				std::cout << "Error: client and server disagree on key " << key << std::endl;
+				wrong++;
+			}
+			resident += addr != 0;
+		}
+	}
+
+	std::cout << "lookups " << lookups << " hits " << hits << " wrong " << wrong
+		<< " evicted " << evicted << " resident " << resident << "/" << hash->Capacity()
+		<< " reads/lookup " << reads_per_lookup << std::endl;
+
+	munmap(pages, npages * PAGE_SIZE);
+	return wrong ? 1 : 0;
+}
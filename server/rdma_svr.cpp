@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,6 +20,7 @@
 
 #include "circular_queue.h"
 #include "rdma_svr.h"
+#include "ShardedKV.h"
 #include "variables.h"
 
 #define CBLOOMFILTER 1
@@ -35,7 +37,21 @@ bool numa_on = false;
 bool verbose_flag = false;
 bool bf_flag = false;
 bool human = false;
+const char* kv_backend = NULL;
+const char* cceh_geometry = "default";
+bool clock_eviction = false;
+uint64_t page_region = 0;
+size_t page_region_size = 0;
+uint64_t index_region = 0;
+size_t index_region_size = 0;
+/* send the index region on connect, only to clients posting a receive for it */
+bool index_flag = false;
 struct bitmask *netcpubuf;
+struct bitmask *kvcpubuf;
+/* KV shards by key hash, served by kvcpubind CPUs if given */
+size_t nr_shards = 1;
+/* one KV per client, picked by the connection a request arrives on */
+bool partition_flag = false;
 size_t BUFFER_SIZE = ((1UL << 30) * 10); // 10GB
 
 /*  Global values */
@@ -50,6 +66,19 @@ struct ibv_mr *global_mr_buffer = NULL;
 
 std::atomic<uint64_t> page_offset(0);
 
+/* @n consecutive free pages, out of the calling thread's chunk */
+static void *alloc_pages(size_t n) {
+	thread_local uint64_t next = 0, end = 0;
+	if (next + n > end) {
+		uint64_t chunk = std::max<uint64_t>(n, PAGE_CHUNK);
+		next = page_offset.fetch_add(chunk, std::memory_order_relaxed);
+		end = next + chunk;
+	}
+	void *page = (void *)(GET_FREE_PAGE_REGION(global_mr) + PAGE_SIZE * next);
+	next += n;
+	return page;
+}
+
 #ifdef SRQ
 struct ibv_srq *srq[16]; /* 1 SRQ per Client */
 #endif
@@ -134,7 +163,16 @@ static void rdpma_print_stats() {
 	printf("BF send: %.3f (us)\n",
 			rdpma_bf_send_elapsed/bfsendcnt/1000.0);
 
-	gctrl[0]->kv->PrintStats();
+	if (partition_flag) {
+		for (unsigned int c = 0; c < NUM_CLIENT; ++c) {
+			printf("Client %u: puts %lu, gets %lu, util %.3f, capacity %lu\n", c,
+					gctrl[c]->putcnt.load(), gctrl[c]->getcnt.load(),
+					gctrl[c]->kv->Utilization(), gctrl[c]->kv->Capacity());
+			gctrl[c]->kv->PrintStats();
+		}
+	} else {
+		gctrl[0]->kv->PrintStats();
+	}
 
 	printf("--------------------FIN------------------------\n");
 }
@@ -153,98 +191,112 @@ void rdpma_indicator() {
  * send_bf - Send bloomfilter of server to client.
  * It uses onesided RDMA and overwrite client side bloomfilter,
  * so it don't involve client side CPUs.
+ *
+ * The first send writes the whole bit array, later ones only the
+ * SENDINGBLOCKSIZE blocks that changed since (consecutive ones merged),
+ * BF_SEND_BATCH writes per post. A send that fails leaves what the client
+ * was last sent alone, so the next one writes the same blocks again.
  */
 void send_bf(struct queue *q, int cid) {
-	struct ibv_sge sge;
-	struct ibv_sge *sges;
-	struct ibv_send_wr wr = {}; 
+	/* block versions each client was last sent, only its sender touches them */
+	static std::vector<uint32_t> seen[NUM_CLIENT];
+	std::vector<uint64_t> blocks;
+	std::vector<std::pair<uint64_t, uint64_t>> ranges;
+	struct ibv_sge sges[BF_SEND_BATCH];
+	struct ibv_send_wr wrs[BF_SEND_BATCH];
 	struct ibv_send_wr *bad_wr = NULL; 
 	struct ibv_wc wc;
 	int ne;
 	int ret;
-	int i = 0;
 #if defined(TIME_CHECK)
 	struct timespec start, end;
 #endif
 
-	// TODO:
-	// Only updated part of bloomfilter
-	// ibv_post_send returns errno 12 (ENOMEM)
-	// Maybe related to max_send_wr
-	if (false)
-	{
-		std::set updatedBlocks = global_bf->GetUpdatedBlocks();
-		size_t sge_size = updatedBlocks.size();
-		cout << "BF send for " << sge_size << " blocks\n";
-
-		if (sge_size == 0) return;
-
-		sges = (struct ibv_sge *)malloc(sge_size * sizeof(struct ibv_sge));
+	auto bf = gctrl[cid]->bf;
+	uint64_t bitAddr = bf->GetBoolBitArray();
+	size_t size = bf->GetNumLongs() * sizeof(long);
+	bool full = seen[cid].empty();
+	/* becomes seen[cid] once every write completed */
+	std::vector<uint32_t> sent = seen[cid];
 
-		for(auto it = updatedBlocks.begin(); it != updatedBlocks.end(); it++){
-			uint64_t bitAddr = global_bf->GetBoolBitArray() + SENDINGBLOCKSIZE * *it;
+//	printf("First bits of bf = %lu\n", global_bf->GetLong(0)); :: PASS
+//	printf("Existence of Key 0 = %s \n", global_bf->QueryBitBloom(0)?"true":"false");
+//	printf("Existence of Key 300 = %s \n", global_bf->Query(0)?"true":"false");
 
-			sges[i].addr = bitAddr;
-			sges[i].length = SENDINGBLOCKSIZE;
-			sges[i].lkey = gctrl[cid]->bf_mr_bits_buffer->lkey;
-
-			i++;
+	bf->CollectDirtyBlocks(sent, blocks);
+	if (full) {
+		ranges.push_back({0, size});
+	} else {
+		for (auto b : blocks) {
+			uint64_t off = b * SENDINGBLOCKSIZE;
+			uint64_t len = std::min((uint64_t)SENDINGBLOCKSIZE, size - off);
+			if (!ranges.empty() && ranges.back().first + ranges.back().second == off)
+				ranges.back().second += len;
+			else
+				ranges.push_back({off, len});
 		}
-		global_bf->ResetUpdatedBlocks();
-	}
-	else
-	{
-		uint64_t bitAddr = global_bf->GetBoolBitArray();
-		size_t size = global_bf->GetNumLongs() * sizeof(long);
-
-//		printf("First bits of bf = %lu\n", global_bf->GetLong(0)); :: PASS
-//		printf("Existence of Key 0 = %s \n", global_bf->QueryBitBloom(0)?"true":"false");
-//		printf("Existence of Key 300 = %s \n", global_bf->Query(0)?"true":"false");
-
-		sge.addr = bitAddr;
-		sge.length = size;
-		sge.lkey = gctrl[cid]->bf_mr_bits_buffer->lkey;
 	}
-
-	wr.opcode = IBV_WR_RDMA_WRITE; /* IBV_WR_SEND_WITH_IMM same */
-	wr.sg_list = &sge;
-	wr.num_sge = 1;
-//	wr.sg_list = sges;
-	wr.send_flags = IBV_SEND_SIGNALED;
-	wr.wr.rdma.remote_addr = gctrl[cid]->bfmr.baseaddr;
-	wr.wr.rdma.rkey        = gctrl[cid]->bfmr.key;
-
-	q->m.lock(); // TODO: should we need a lock?
-	ret = ibv_post_send(q->qp, &wr, &bad_wr);
-	if(ret){
-		fprintf(stderr, "[%s] ibv_post_send to node failed with %d\n", __func__, ret);
+	if (ranges.empty()) {
+		dprintf("[ INFO ] bloomfilter unchanged\n");
+		return;
 	}
 
 #if defined(TIME_CHECK)
-		clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
 #endif
-	do{
-		ne = ibv_poll_cq(q->qp->send_cq, 1, &wc);
-		if(ne < 0){
-			fprintf(stderr, "[%s] ibv_poll_cq failed\n", __func__);
+	q->m.lock(); // TODO: should we need a lock?
+	for (size_t first = 0; first < ranges.size(); first += BF_SEND_BATCH) {
+		size_t n = std::min(ranges.size() - first, (size_t)BF_SEND_BATCH);
+		memset(wrs, 0, sizeof(wrs));
+		for (size_t i = 0; i < n; i++) {
+			sges[i].addr = bitAddr + ranges[first + i].first;
+			sges[i].length = ranges[first + i].second;
+			sges[i].lkey = gctrl[cid]->bf_mr_bits_buffer->lkey;
+
+			wrs[i].next = (i == n - 1) ? NULL : &wrs[i + 1];
+			wrs[i].opcode = IBV_WR_RDMA_WRITE; /* IBV_WR_SEND_WITH_IMM same */
+			wrs[i].sg_list = &sges[i];
+			wrs[i].num_sge = 1;
+			/* one completion per post, it covers the writes before it */
+			wrs[i].send_flags = (i == n - 1) ? IBV_SEND_SIGNALED : 0;
+			wrs[i].wr.rdma.remote_addr = gctrl[cid]->bfmr.baseaddr + ranges[first + i].first;
+			wrs[i].wr.rdma.rkey        = gctrl[cid]->bfmr.key;
+		}
+
+		ret = ibv_post_send(q->qp, &wrs[0], &bad_wr);
+		if(ret){
+			fprintf(stderr, "[%s] ibv_post_send to node failed with %d\n", __func__, ret);
+			q->m.unlock();
 			return;
 		}
-	}while(ne < 1);
 
-	if(wc.status != IBV_WC_SUCCESS){
-		fprintf(stderr, "[%s] sending rdma_write failed status %s (%d)\n", __func__, ibv_wc_status_str(wc.status), wc.status);
-		return;
+		do{
+			ne = ibv_poll_cq(q->qp->send_cq, 1, &wc);
+			if(ne < 0){
+				fprintf(stderr, "[%s] ibv_poll_cq failed\n", __func__);
+				q->m.unlock();
+				return;
+			}
+		}while(ne < 1);
+
+		if(wc.status != IBV_WC_SUCCESS){
+			fprintf(stderr, "[%s] sending rdma_write failed status %s (%d)\n", __func__, ibv_wc_status_str(wc.status), wc.status);
+			q->m.unlock();
+			return;
+		}
 	}
+	q->m.unlock();
+	seen[cid] = std::move(sent);
 
 #if defined(TIME_CHECK)
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		rdpma_bf_send_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rdpma_bf_send_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
 #endif
-	q->m.unlock();
-
-//	free(sges);
 
-	printf("[ INFO ] Send bloomfilter to client\n");
+	if (full)
+		printf("[ INFO ] Send bloomfilter to client\n");
+	else
+		printf("[ INFO ] Send bloomfilter to client, %lu blocks in %lu writes\n", blocks.size(), ranges.size());
 	bfsendcnt++;
 
 	return;
@@ -256,10 +308,9 @@ void send_bf(struct queue *q, int cid) {
 void rdpma_bf_sender(int c) {
 	while (!done) {
 		sleep(10);
-		if (global_bf) {
-			global_bf->ToOrdinaryBloomFilter();  // Zip counting bloomfilter to normal bloomfilter.
+		/* the bit array follows the counters, only changed blocks are sent */
+		if (gctrl[c]->bf)
 			send_bf(&gctrl[c]->queues[0], c);
-		}
 	}
 }
 
@@ -322,6 +373,7 @@ static void process_write_twosided(struct queue *q, uint64_t target, int cid, in
 	struct ibv_sge sge = {};
 	int ret;
 	uint64_t local_keys[BATCH_SIZE];
+	Value_t local_pages[BATCH_SIZE];
 #if defined(TIME_CHECK)
 	struct timespec start, end;
 #endif
@@ -341,16 +393,20 @@ static void process_write_twosided(struct queue *q, uint64_t target, int cid, in
 		fprintf(stderr, "[%s] ibv_post_send to node failed with %d\n", __func__, ret);
 	}
 
-	for ( unsigned int i = 0 ; i < BATCH_SIZE ; i++ ) {
-		uint64_t cur_page = target + PAGE_SIZE * i;
+	/* the whole message in one call, so the index takes each lock and fence once */
+	for ( unsigned int i = 0 ; i < BATCH_SIZE ; i++ )
+		local_pages[i] = (Value_t)(target + PAGE_SIZE * i);
 #if defined(TIME_CHECK)
-		clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
 #endif
-		gctrl[cid]->kv->Insert(local_keys[i], (Value_t)cur_page);
+	gctrl[cid]->kv->InsertBatch(local_keys, local_pages, BATCH_SIZE);
 #if defined(TIME_CHECK)
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		rdpma_handle_write_elapsed+= end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rdpma_handle_write_elapsed+= end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
 #endif
+
+	for ( unsigned int i = 0 ; i < BATCH_SIZE ; i++ ) {
+		uint64_t cur_page = target + PAGE_SIZE * i;
 		dprintf("[ INFO ] MSG_WRITE page %lx, key %ld (decimal) Inserted\n", cur_page, longkeyToKey(local_keys[i]));
 		dprintf("[ INFO ] page %s\n", (char *)cur_page);
 #if 0
@@ -380,8 +436,7 @@ static void process_write_twosided(struct queue *q, uint64_t target, int cid, in
 		}
 	}
 
-	uint64_t local_page_offset = page_offset.fetch_add(BATCH_SIZE, std::memory_order_relaxed);
-	void *save_page = (void *)(GET_FREE_PAGE_REGION(global_mr) + (PAGE_SIZE) * local_page_offset);
+	void *save_page = alloc_pages(BATCH_SIZE);
 	post_recv_with_addr((uint64_t)save_page, cid, qid);
 
 #if defined(TIME_CHECK)
@@ -406,7 +461,7 @@ static void process_write(struct queue *q, int cid, int qid, int mid){
 #if defined(TIME_CHECK)
 	clock_gettime(CLOCK_MONOTONIC, &start);
 #endif
-	void *save_page = (void *)(GET_FREE_PAGE_REGION(global_mr) + PAGE_SIZE * page_offset++);
+	void *save_page = alloc_pages(1);
 #if defined(TIME_CHECK)
 	clock_gettime(CLOCK_MONOTONIC, &end);
 	rdpma_handle_write_malloc_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
@@ -469,7 +524,8 @@ static void process_write(struct queue *q, int cid, int qid, int mid){
 #endif
 }
 
-static void process_read(struct queue *q, int cid, int qid, int mid){
+/* @value: page of the key, looked up by process_reads() */
+static void process_read(struct queue *q, int cid, int qid, int mid, void* value){
 	struct ibv_send_wr wr = {};
 	struct ibv_send_wr *bad_wr = NULL;
 	struct ibv_sge sge = {};
@@ -487,22 +543,14 @@ static void process_read(struct queue *q, int cid, int qid, int mid){
 	uint64_t target_addr = (uint64_t)GET_REMOTE_ADDRESS_BASE(gctrl[cid]->local_mm, qid, mid);
 	dprintf("[ INFO ] key= %ld (decimal), remote address= %lx\n", longkeyToKey(local_key), *remote_addr);
 
-	/* 1. Get page address -> value */
-	void* value;
+	/* 1. page address looked up already */
 	bool abort = false;
 
-	value = (void *)gctrl[cid]->kv->Get((Key_t&)local_key); 
-
 	if(!value){
 		dprintf("Value for key[%lx] not found\n", key);
 		abort = true;
 	}
 
-#if defined(TIME_CHECK)
-	clock_gettime(CLOCK_MONOTONIC, &end);
-	rdpma_handle_read_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
-#endif
-
 	if( !abort ) {
 		found_cnt++;
 		dprintf("[ INFO ] page %lx, key %lx Searched\n", (uint64_t)value, local_key);
@@ -557,11 +605,11 @@ static void process_read(struct queue *q, int cid, int qid, int mid){
 	}
 
 #if defined(TIME_CHECK)
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 	if (abort) {
-		rdpma_handle_read_poll_notfound_elapsed += start.tv_nsec - end.tv_nsec + 1000000000 * (start.tv_sec - end.tv_sec);
+		rdpma_handle_read_poll_notfound_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
 	} else {
-		rdpma_handle_read_poll_found_elapsed += start.tv_nsec - end.tv_nsec + 1000000000 * (start.tv_sec - end.tv_sec);
+		rdpma_handle_read_poll_found_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
 	}
 #endif
 }
@@ -582,7 +630,7 @@ static void process_write_odp(struct queue *q, int cid, int qid, int mid){
 #if defined(TIME_CHECK)
 	clock_gettime(CLOCK_MONOTONIC, &start);
 #endif
-	void *save_page = (void *)(GET_FREE_PAGE_REGION(global_mr) + PAGE_SIZE * page_offset++);
+	void *save_page = alloc_pages(1);
 #if defined(TIME_CHECK)
 	clock_gettime(CLOCK_MONOTONIC, &end);
 	rdpma_handle_write_malloc_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
@@ -656,7 +704,8 @@ static void process_write_odp(struct queue *q, int cid, int qid, int mid){
 #endif
 }
 
-static void process_read_odp(struct queue *q, int cid, int qid, int mid){
+/* @value: page of the key, looked up by process_reads() */
+static void process_read_odp(struct queue *q, int cid, int qid, int mid, void* value){
 	struct ibv_wc wc2;
 	int ne;
 	struct ibv_send_wr wr = {};
@@ -667,7 +716,7 @@ static void process_read_odp(struct queue *q, int cid, int qid, int mid){
 #endif
 
 #if defined(TIME_CHECK)
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 #endif
 
 	uint64_t* key = (uint64_t*)GET_LOCAL_META_REGION(gctrl[cid]->local_mm, qid, mid);
@@ -676,22 +725,14 @@ static void process_read_odp(struct queue *q, int cid, int qid, int mid){
 	uint64_t local_remote_addr = *remote_addr;
 	dprintf("[ INFO ] key= %lx, remote address= %lx\n", local_key, local_remote_addr);
 
-	/* 1. Get page address -> value */
-	void* value;
+	/* 1. page address looked up already */
 	bool abort = false;
 
-	value = (void *)gctrl[cid]->kv->Get((Key_t&)local_key); 
-
 	if(!value){
 		dprintf("Value for key[%ld] not found\n", longkeyToKey(local_key));
 		abort = true;
 	}
 
-#if defined(TIME_CHECK)
-	clock_gettime(CLOCK_MONOTONIC, &end);
-	rdpma_handle_read_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
-#endif
-
 	if( !abort ) {
 		found_cnt++;
 		dprintf("[ INFO ] page %lx, key %ld Searched\n", (uint64_t)value, longkeyToKey(local_key));
@@ -752,85 +793,142 @@ static void process_read_odp(struct queue *q, int cid, int qid, int mid){
 #endif
 }
 
+/* MSG_READ taken off the receive queue, answered by process_reads() */
+struct read_req {
+	int qid;
+	int mid;
+};
+
+/*
+ * Looks up the keys of @nr pending reads together (KVStore::GetBatch, whose
+ * lookups interleave their cache misses), then replies to each in order.
+ */
+static void process_reads(struct queue *q, int cid, struct read_req *reads, int nr) {
+	Key_t keys[POLL_BATCH];
+	Value_t values[POLL_BATCH];
+#if defined(TIME_CHECK)
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+
+	for (int i = 0; i < nr; i++)
+		keys[i] = *(uint64_t*)GET_LOCAL_META_REGION(gctrl[cid]->local_mm, reads[i].qid, reads[i].mid);
+	if (nr == 1)
+		values[0] = gctrl[cid]->kv->Get(keys[0]);
+	else
+		gctrl[cid]->kv->GetBatch(keys, values, nr);
+
+#if defined(TIME_CHECK)
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rdpma_handle_read_elapsed += end.tv_nsec - start.tv_nsec + 1000000000 * (end.tv_sec - start.tv_sec);
+#endif
+
+	for (int i = 0; i < nr; i++) {
+#ifdef NORMALGET
+		process_read(q, cid, reads[i].qid, reads[i].mid, (void *)values[i]);
+#elif BIGMRGET
+		process_read_odp(q, cid, reads[i].qid, reads[i].mid, (void *)values[i]);
+#elif TWOSIDED
+		process_read_odp(q, cid, reads[i].qid, reads[i].mid, (void *)values[i]);
+#endif
+	}
+}
+
 static void server_recv_poll_cq(struct queue *q, int client_id, int queue_id) {
 	std::this_thread::sleep_for(std::chrono::milliseconds(20));
-	struct ibv_wc wc;
+	struct ibv_wc wcs[POLL_BATCH];
+	struct read_req reads[POLL_BATCH];
 	int ne;
 
 	while(1) {
 		ne = 0;
 		do{
-			ne += ibv_poll_cq(q->qp->recv_cq, 1, &wc);
+			ne = ibv_poll_cq(q->qp->recv_cq, POLL_BATCH, wcs);
 			if(ne < 0){
 				fprintf(stderr, "ibv_poll_cq failed %d\n", ne);
 				die("ibv_poll_cq failed");
 			}
 		}while(ne < 1);
 
-		if(wc.status != IBV_WC_SUCCESS){
-			fprintf(stderr, "%s: Failed status %s (%d)\n", __func__, ibv_wc_status_str(wc.status), wc.status);
-			die("Failed status");
-		}
-
-		if((int)wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM){
-			int qid, mid, type, tx_state, num;
+		/* consecutive reads are looked up together, a write answers them first to keep the order */
+		int nr_reads = 0;
+		for (int w = 0; w < ne; w++) {
+			struct ibv_wc &wc = wcs[w];
 
-			bit_unmask(ntohl(wc.imm_data), &num, &mid, &type, &tx_state, &qid);
-			dprintf("[ INFO ] On Q[%d]: qid(%d), mid(%d), type(%d), tx_state(%d), num(%d)\n", queue_id, qid, mid, type, tx_state, num);
-
-			post_recv(client_id, queue_id);
-			if (queue_id != qid)
-				printf("[ ERRR ] Queue ID mismatch!!\n");
-
-			if(type == MSG_WRITE){
-				putcnt++;
-#ifdef NORMALPUT
-				process_write(q, client_id, qid, mid);
-#elif BIGMRPUT 
-				process_write_odp(q, client_id, qid, mid);
-#endif
-			} else if(type == MSG_READ) {
-				getcnt++;
-#ifdef NORMALGET
-				process_read(q, client_id, qid, mid);
-#elif BIGMRGET
-				process_read_odp(q, client_id, qid, mid);
-#elif TWOSIDED
-				process_read_odp(q, client_id, qid, mid);
-#endif
+			if(wc.status != IBV_WC_SUCCESS){
+				fprintf(stderr, "%s: Failed status %s (%d)\n", __func__, ibv_wc_status_str(wc.status), wc.status);
+				die("Failed status");
 			}
-		}
-		else if((int)wc.opcode == IBV_WC_RDMA_READ){
-			dprintf("[%s]: received WC_RDMA_READ\n", __func__);
-			/* the client is reading data from read region*/
-		}
-		else if ( (int)wc.opcode == IBV_WC_RECV ){
-			if ( wc.wr_id != 0 ) {
-				putcnt = putcnt + BATCH_SIZE;
+
+			if((int)wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM){
 				int qid, mid, type, tx_state, num;
 
 				bit_unmask(ntohl(wc.imm_data), &num, &mid, &type, &tx_state, &qid);
-				dprintf("[ INFO ] IBV_WC_RECV On Q[%d]: qid(%d), mid(%d), type(%d), tx_state(%d), num(%d)\n", queue_id, qid, mid, type, tx_state, num);
+				dprintf("[ INFO ] On Q[%d]: qid(%d), mid(%d), type(%d), tx_state(%d), num(%d)\n", queue_id, qid, mid, type, tx_state, num);
 
+				post_recv(client_id, queue_id);
 				if (queue_id != qid)
 					printf("[ ERRR ] Queue ID mismatch!!\n");
 
-				process_write_twosided(q, wc.wr_id, client_id, qid, mid);
+				if(type == MSG_WRITE){
+					putcnt++;
+					q->ctrl->putcnt.fetch_add(1, std::memory_order_relaxed);
+					if (nr_reads) {
+						process_reads(q, client_id, reads, nr_reads);
+						nr_reads = 0;
+					}
+#ifdef NORMALPUT
+					process_write(q, client_id, qid, mid);
+#elif BIGMRPUT 
+					process_write_odp(q, client_id, qid, mid);
+#endif
+				} else if(type == MSG_READ) {
+					getcnt++;
+					q->ctrl->getcnt.fetch_add(1, std::memory_order_relaxed);
+					reads[nr_reads].qid = qid;
+					reads[nr_reads].mid = mid;
+					nr_reads++;
+				}
+			}
+			else if((int)wc.opcode == IBV_WC_RDMA_READ){
+				dprintf("[%s]: received WC_RDMA_READ\n", __func__);
+				/* the client is reading data from read region*/
 			}
-			else {
-				/* only for first connection */
-				dprintf("[ INFO ] connected. receiving memory region info.\n");
-				printf("[ INFO ] *** Client MR key=%u base vaddr=%p size=%lu (KB) ***\n", gctrl[client_id]->clientmr.key, (void *)gctrl[client_id]->clientmr.baseaddr
-						, gctrl[client_id]->clientmr.mr_size/1024);
+			else if ( (int)wc.opcode == IBV_WC_RECV ){
+				if ( wc.wr_id != 0 ) {
+					putcnt = putcnt + BATCH_SIZE;
+					q->ctrl->putcnt.fetch_add(BATCH_SIZE, std::memory_order_relaxed);
+					int qid, mid, type, tx_state, num;
+
+					bit_unmask(ntohl(wc.imm_data), &num, &mid, &type, &tx_state, &qid);
+					dprintf("[ INFO ] IBV_WC_RECV On Q[%d]: qid(%d), mid(%d), type(%d), tx_state(%d), num(%d)\n", queue_id, qid, mid, type, tx_state, num);
+
+					if (queue_id != qid)
+						printf("[ ERRR ] Queue ID mismatch!!\n");
+
+					if (nr_reads) {
+						process_reads(q, client_id, reads, nr_reads);
+						nr_reads = 0;
+					}
+					process_write_twosided(q, wc.wr_id, client_id, qid, mid);
+				}
+				else {
+					/* only for first connection */
+					dprintf("[ INFO ] connected. receiving memory region info.\n");
+					printf("[ INFO ] *** Client MR key=%u base vaddr=%p size=%lu (KB) ***\n", gctrl[client_id]->clientmr.key, (void *)gctrl[client_id]->clientmr.baseaddr
+							, gctrl[client_id]->clientmr.mr_size/1024);
 #ifdef CBLOOMFILTER
-				if (gctrl[client_id]->bfmr.key != 0)
-					printf("[ INFO ] *** Client BF MR key=%u base vaddr=%p size=%lu (KB) ***\n", gctrl[client_id]->bfmr.key, (void *)gctrl[client_id]->bfmr.baseaddr
-							, gctrl[client_id]->bfmr.mr_size/1024);
+					if (gctrl[client_id]->bfmr.key != 0)
+						printf("[ INFO ] *** Client BF MR key=%u base vaddr=%p size=%lu (KB) ***\n", gctrl[client_id]->bfmr.key, (void *)gctrl[client_id]->bfmr.baseaddr
+								, gctrl[client_id]->bfmr.mr_size/1024);
 #endif
+				}
+			}else{
+				fprintf(stderr, "Received a weired opcode (%d)\n", (int)wc.opcode);
 			}
-		}else{
-			fprintf(stderr, "Received a weired opcode (%d)\n", (int)wc.opcode);
 		}
+		if (nr_reads)
+			process_reads(q, client_id, reads, nr_reads);
 	}
 }
 
@@ -885,12 +983,11 @@ static device *get_device(struct queue *q)
 					IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ));
 		printf("[ INFO ] registered perclient memory region key=%u base vaddr=%lx\n", ctrl->mr_buffer->rkey, ctrl->local_mm);
 
-		if (bf_flag && global_bf) {
-			ctrl->bf = global_bf;
+		if (bf_flag && ctrl->bf) {
 			TEST_Z(ctrl->bf_mr_buffer = ibv_reg_mr(
 						dev->pd,
 						(void *)ctrl->bf->GetBaseAddr(),
-						ctrl->bf->GetNumBits(),
+						ctrl->bf->GetCounterBytes(),
 						IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ));
 			printf("[ INFO ] registered perclient BF memory region key=%u base vaddr=%lx\n", ctrl->bf_mr_buffer->rkey, ctrl->bf->GetBaseAddr());
 
@@ -902,6 +999,16 @@ static device *get_device(struct queue *q)
 			printf("[ INFO ] registered perclient BF bitfield MR key=%u base vaddr=%lx\n", ctrl->bf_mr_bits_buffer->rkey, ctrl->bf->GetBoolBitArray());
 		}
 
+		if (index_region) {
+			/* read only, clients look pages up without the server CPU */
+			TEST_Z(ctrl->index_mr_buffer = ibv_reg_mr(
+						dev->pd,
+						(void *)index_region,
+						index_region_size,
+						IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ));
+			printf("[ INFO ] registered perclient index MR key=%u base vaddr=%lx\n", ctrl->index_mr_buffer->rkey, index_region);
+		}
+
 #endif
 		printf("[  OK  ] MEMORY MODE DRAM MR initialized\n");
 		q->ctrl->dev = dev;
@@ -915,6 +1022,8 @@ static void destroy_device(struct ctrl *ctrl)
 	TEST_Z(ctrl->dev);
 
 	ibv_dereg_mr(ctrl->mr_buffer);
+	if (ctrl->index_mr_buffer)
+		ibv_dereg_mr(ctrl->index_mr_buffer);
 	ibv_dereg_mr(global_mr_buffer);
 	free((void*)global_mr);
 	ibv_dealloc_pd(ctrl->dev->pd);
@@ -1035,13 +1144,14 @@ int on_connection(struct queue *q)
 	TEST_Z(q->state == queue::INIT);
 
 	if (q == &ctrl->queues[0]) {
-		struct ibv_send_wr wr[2] = {};
+		struct ibv_send_wr wr[3] = {};
 		struct ibv_recv_wr rwr[2] = {};
 		struct ibv_send_wr *bad_wr = NULL;
 		struct ibv_recv_wr *bad_rwr = NULL;
-		struct ibv_sge sge[2] = {};
+		struct ibv_sge sge[3] = {};
 		struct memregion servermr = {};
 		struct memregion bfmr = {};
+		struct memregion indexmr = {};
 
 		printf("[ INFO ] connected. sending memory region info.\n");
 //		printf("[ INFO ] *** Server per client MR key=%u base vaddr=%lx size=%lu (KB)***\n", ctrl->mr_buffer->rkey, ctrl->local_mm, (LOCAL_META_REGION_SIZE)/1024);
@@ -1053,7 +1163,7 @@ int on_connection(struct queue *q)
 		if (bf_flag) {
 			bfmr.baseaddr = ctrl->bf->GetBaseAddr();
 			bfmr.key  = ctrl->bf_mr_buffer->rkey;
-			bfmr.mr_size  = ctrl->bf->GetNumBits();
+			bfmr.mr_size  = ctrl->bf->GetCounterBytes();
 		} else {
 			bfmr.baseaddr = 0;
 			bfmr.key  = 0;
@@ -1078,6 +1188,23 @@ int on_connection(struct queue *q)
 		sge[1].addr = (uint64_t) &bfmr;
 		sge[1].length = sizeof(bfmr);
 
+		/* clients of the one-sided index also get where its header and directory are */
+		if (index_region && index_flag) {
+			indexmr.baseaddr = index_region;
+			indexmr.key  = ctrl->index_mr_buffer->rkey;
+			indexmr.mr_size  = index_region_size;
+
+			wr[1].next = &wr[2];
+			wr[2].next = NULL;
+			wr[2].opcode = IBV_WR_SEND;
+			wr[2].sg_list = &sge[2];
+			wr[2].num_sge = 1;
+			wr[2].send_flags = IBV_SEND_SIGNALED | IBV_SEND_INLINE;
+
+			sge[2].addr = (uint64_t) &indexmr;
+			sge[2].length = sizeof(indexmr);
+		}
+
 		TEST_NZ(ibv_post_send(q->qp, &wr[0], &bad_wr));
 
 #ifndef ONESIDED
@@ -1154,11 +1281,40 @@ void die(const char *reason)
 int alloc_control()
 {
 	dprintf("[ INFO ] Bloom filter %s\n", bf_flag ? "enabled": "disabled");
-	if (bf_flag) {
-		global_bf = new CountingBloomFilter<Key_t>(NUM_HASHES, BF_SIZE);
+	if (bf_flag && !partition_flag) {
+		global_bf = new CountingBloomFilter<Key_t>(NUM_HASHES, BF_SIZE, BF_BLOCK_BITS);
 		dprintf("[  OK  ] Bloom filter(%d, %d) Initialized\n", global_bf->GetNumHashes(), global_bf->GetNumBits());
 	}
-	KVStore *kv = new KV( BUFFER_SIZE / 4096,  global_bf);
+	auto backend = FindKVBackend(kv_backend);
+	if (!backend) {
+		fprintf(stderr, "[ FAIL ] unknown backend %s (%s)\n", kv_backend, KVBackends());
+		exit(EXIT_FAILURE);
+	}
+	dprintf("[ INFO ] %s backend\n", backend->name);
+#if !defined(ODP) && !defined(ONESIDED)
+	if (backend->needs_page_region) {
+		/* the compact index stores page numbers, so it needs the region base up front */
+		global_mr = (uint64_t)malloc(BUFFER_SIZE +  NUM_CLIENT * LOCAL_META_REGION_SIZE);
+		TEST_Z(global_mr);
+		page_region = GET_FREE_PAGE_REGION(global_mr);
+		page_region_size = BUFFER_SIZE - LOCAL_META_REGION_SIZE;
+	}
+	index_region_size = backend->one_sided_index_size ? backend->one_sided_index_size(BUFFER_SIZE / 4096) : 0;
+	if (index_region_size) {
+		/* registered per client in get_device(), the KV puts its buckets here */
+		TEST_NZ(posix_memalign((void **)&index_region, 4096, index_region_size));
+		dprintf("[  OK  ] one-sided index region %lu MB\n", index_region_size >> 20);
+	}
+#endif
+	/* partitions split the table evenly, pages still come from the shared region */
+	size_t nr_partitions = partition_flag ? NUM_CLIENT : 1;
+	if (partition_flag && backend->one_sided_index_size) {
+		/* clients look up the one registered index themselves */
+		fprintf(stderr, "[ FAIL ] backend %s can not be partitioned\n", backend->name);
+		exit(EXIT_FAILURE);
+	}
+	KVStore *kv = NULL;
+	CountingBloomFilter<Key_t>* bf = global_bf;
 	gctrl = (struct ctrl **)malloc(sizeof(struct ctrl *) * NUM_CLIENT);
 	for ( unsigned int c = 0 ; c < NUM_CLIENT ; ++c) {
 		gctrl[c] = (struct ctrl *) malloc(sizeof(struct ctrl));
@@ -1173,8 +1329,21 @@ int alloc_control()
 			gctrl[c]->queues[i].ctrl = gctrl[c];
 			gctrl[c]->queues[i].state = queue::INIT;
 		}
+		if (c < nr_partitions) {
+			/* a partition's own filter, so keys of other clients add no false positives */
+			if (bf_flag && partition_flag) {
+				bf = new CountingBloomFilter<Key_t>(NUM_HASHES, BF_SIZE, BF_BLOCK_BITS);
+				dprintf("[  OK  ] Bloom filter(%d, %d) Initialized for client %d\n", bf->GetNumHashes(), bf->GetNumBits(), c);
+			}
+			if (nr_shards > 1)
+				kv = new ShardedKV(backend, BUFFER_SIZE / 4096 / nr_partitions, bf, nr_shards, kvcpubuf);
+			else
+				kv = backend->create( BUFFER_SIZE / 4096 / nr_partitions,  bf);
+		}
 		gctrl[c]->kv = kv;
-		dprintf("[  OK  ] Global controler & KVStore Initialized for client %d\n", c);
+		gctrl[c]->bf = bf;
+		dprintf("[  OK  ] Global controler & KVStore Initialized for client %d%s\n", c,
+				partition_flag ? " (own partition)" : "");
 	}
 
 	return 0;
@@ -1192,6 +1361,13 @@ void printUsage() {
     << "  tablesize(s) <size>       set table bucket size to <size>\n"
     << "  buffersize(S) <size>      set memory buffer size to <size>MByte\n"
     << "  netcpubind(W) <set>       set worker threads as <set>\n"
+    << "  shards(k) <n>             split the KV into <n> shards by key hash\n"
+    << "  kvcpubind(K) <set>        serve the shards with workers on <set> (pollers run them inline otherwise)\n"
+    << "  partition(p)              give every client its own KV with 1/NUM_CLIENT of the table, and its own bloom filter\n"
+    << "  backend(B) <name>         hash backend (" << KVBackends() << ")\n"
+    << "  geometry(g) <name>        CCEH geometry (default, small, large, fp8, fp16, large-fp8)\n"
+    << "  clock(c)                  CLOCK eviction for LinearProbing (default FIFO)\n"
+    << "  sendindex(x)              send the one-sided index region on connect (clients must post a third receive)\n"
     << std::endl;
 } 
 
@@ -1204,7 +1380,7 @@ int main(int argc, char **argv)
 	struct rdma_cm_id *listener = NULL;
 	uint16_t port = 0;
 
-	const char *short_options = "vhbs:S:t:i:n:d:z:HK:P:W:";
+	const char *short_options = "vhbs:S:t:i:n:d:z:HK:P:W:B:g:ck:px";
 	static struct option long_options[] =
 	{
 		{"verbose", 0, NULL, 'v'},
@@ -1215,6 +1391,13 @@ int main(int argc, char **argv)
 		{"tablesize", 1, NULL, 's'},
 		{"buffersize", 1, NULL, 'S'},
 		{"netcpubind", 1, NULL, 'W'},
+		{"kvcpubind", 1, NULL, 'K'},
+		{"shards", 1, NULL, 'k'},
+		{"partition", 0, NULL, 'p'},
+		{"backend", 1, NULL, 'B'},
+		{"geometry", 1, NULL, 'g'},
+		{"clock", 0, NULL, 'c'},
+		{"sendindex", 0, NULL, 'x'},
 		{0, 0, 0, 0} 
 	};
 
@@ -1259,6 +1442,37 @@ int main(int argc, char **argv)
 			case 'b':
 				bf_flag = true;
 				break;
+			case 'B':
+				kv_backend = strdup(optarg);
+				break;
+			case 'g':
+				cceh_geometry = strdup(optarg);
+				break;
+			case 'c':
+				clock_eviction = true;
+				break;
+			case 'k':
+				nr_shards = strtol(optarg, NULL, 0);
+				if (nr_shards == 0 || nr_shards > ShardedKV::kMaxShards) {
+					printf ("<%s> is invalid\n", optarg);
+					printUsage();
+					return 0;
+				}
+				break;
+			case 'p':
+				partition_flag = true;
+				break;
+			case 'x':
+				index_flag = true;
+				break;
+			case 'K':
+				kvcpubuf = numa_parse_cpustring(optarg);
+				if (!kvcpubuf) {
+					printf ("<%s> is invalid\n", optarg);
+					printUsage();
+					return 0;
+				}
+				break;
 			default:
 				printf ("%c, <%s> is invalid\n", (char)c,optarg);
 				printUsage();
@@ -1277,8 +1491,16 @@ int main(int argc, char **argv)
 		printf("\t  +-- BUFFER_SIZE \t: %lu = %lu MB \n", BUFFER_SIZE, BUFFER_SIZE/1024/1024);
 		printf("\t  +-- HT SIZE     \t: %lu buckets\n", initialTableSize);
 		printf("\t  +-- Bloomfilter \t: %s \n", bf_flag ? "on" : "off");
+		printf("\t  +-- Backend     \t: %s \n", kv_backend ? kv_backend : "default");
+		printf("\t  +-- Shards      \t: %lu (%s)\n", nr_shards, kvcpubuf ? "workers" : "inline");
+		printf("\t  +-- Partitions  \t: %s \n", partition_flag ? "per client" : "off");
+		printf("\t  +-- Send index  \t: %s \n", index_flag ? "on" : "off");
+#ifdef DCCEH
+		printf("\t  +-- CCEH geometry\t: %s \n", cceh_geometry);
+#endif
 		if (bf_flag) printf("\t        +-- BF_SIZE     \t: %d \n", BF_SIZE);
 		if (bf_flag) printf("\t        +-- NUM_HASHES  \t: %d \n", NUM_HASHES);
+		if (bf_flag) printf("\t        +-- BF_BLOCK_BITS\t: %d \n", BF_BLOCK_BITS);
 #ifdef CBLOOMFILTER 
 		printf("\t        +-- CBLOOMFILTER \t: on \n");
 #else
@@ -1327,8 +1549,7 @@ int main(int argc, char **argv)
 					post_recv(c, i);
 				} else {
 					/* WRITE QUEUE */
-					uint64_t local_page_offset = page_offset.fetch_add(BATCH_SIZE, std::memory_order_relaxed);
-					void *save_page = (void *)(GET_FREE_PAGE_REGION(global_mr) + (PAGE_SIZE) * local_page_offset); 
+					void *save_page = alloc_pages(BATCH_SIZE);
 					post_recv_with_addr((uint64_t) save_page, c, i);
 				}
 #else
@@ -9,6 +9,8 @@ POBJ_LAYOUT_TOID(PM_MR, void);
 POBJ_LAYOUT_END(PM_MR);
 #endif
 
+#include <atomic>
+
 #include "KV.h"
 
 #define PAGE_SIZE 	4096
@@ -33,10 +35,20 @@ POBJ_LAYOUT_END(PM_MR);
 #define GET_OFFSET_FROM_BASE_TO_ADDR(qid, mid) 		(NUM_ENTRY * ENTRY_SIZE * qid + ENTRY_SIZE * mid + 16)
 #define GET_FREE_PAGE_REGION(addr)  (addr + LOCAL_META_REGION_SIZE)
 
+/* receive completions taken per poll, the reads among them are looked up together */
+#define POLL_BATCH 		16
+
+/* pages a poller takes from the free region at once, then hands out without atomics */
+#define PAGE_CHUNK 		256
+
 #define NUM_HASHES 4
 //#define BF_SIZE 200000000
 #define BF_SIZE 1000000000
 //#define BF_SIZE 1969760731
+/* bloom filter positions per block, a key's counters all fall in one (0: unblocked) */
+#define BF_BLOCK_BITS 128
+/* dirty bloom filter blocks written to a client per post */
+#define BF_SEND_BATCH 64
 
 #define TEST_NZ(x) do { if ( (x)) die("error: " #x " failed (returned non-zero)." ); } while (0)
 #define TEST_Z(x)  do { if (!(x)) die("error: " #x " failed (returned zero/null)."); } while (0)
@@ -98,6 +110,7 @@ struct ctrl {
 	struct ibv_mr *mr_buffer;
 	struct ibv_mr *bf_mr_buffer;
 	struct ibv_mr *bf_mr_bits_buffer;
+	struct ibv_mr *index_mr_buffer;
 	uint64_t cid;
 	void *buffer;
 	struct device *dev;
@@ -108,8 +121,12 @@ struct ctrl {
 	struct memregion servermr;
 	struct memregion bfmr;
 
+	/* shared by all clients, or this client's own partition */
 	KVStore* kv;
 	CountingBloomFilter<Key_t>* bf;
+	/* requests of this client */
+	std::atomic<uint64_t> putcnt;
+	std::atomic<uint64_t> getcnt;
 
 	struct ibv_comp_channel *comp_channel;
 };
@@ -9,9 +9,17 @@
 #include <getopt.h>
 #include <vector>
 #include <ctime>
+#include <unordered_map>
+#include <sys/mman.h>
 
 #include "KV.h"
 #include "variables.h"
+#include "util/sharded_counter.h"
+
+/* request counters of the KV, defined in KV_registry.cpp */
+extern ShardedCounter deletecnt;
+extern ShardedCounter kv_putcnt;
+extern ShardedCounter kv_getcnt;
 
 #define ROP 1
 #define WOP 2
@@ -47,7 +55,16 @@ bool numa_on = false;
 bool verbose_flag = false;
 bool bf_flag = false;
 bool human = false;
+const char* kv_backend = NULL;
+const char* cceh_geometry = "default";
+bool clock_eviction = false;
+uint64_t page_region = 0;
+size_t page_region_size = 0;
+uint64_t index_region = 0;
+size_t index_region_size = 0;
+bool compare_eviction = false;
 struct bitmask *netcpubuf;
+struct bitmask *kvcpubuf;
 
 static void dprintf( const char* format, ... ) {
 	if (verbose_flag) {
@@ -61,6 +78,10 @@ static void dprintf( const char* format, ... ) {
 static void usage(){
 	printf("Usage : \n");
 	printf("./bin/kv --dataset <text file> --nr_data 10000000 -W 0-3 -K 4-7,14-17 -P 8-9,18-19 --tablesize 32768 --verbose\n");
+	printf("  --backend <name>   hash backend: %s\n", KVBackends());
+	printf("  --geometry <name>  CCEH geometry: default, small, large, fp8, fp16, large-fp8\n");
+	printf("  --clock            CLOCK eviction for LinearProbing (default FIFO)\n");
+	printf("  --compare          replay with FIFO and CLOCK and report the hit rate difference\n");
 }
 
 void clear_cache(){
@@ -93,7 +114,7 @@ static void printCpuBuf(size_t nr_cpus, struct bitmask *bm, const char *str) {
 int main(int argc, char* argv[]){
 	char *data_path;
 
-	const char *short_options = "vbut:n:d:z:hK:P:W:";
+	const char *short_options = "vbut:n:d:z:hK:P:W:B:g:cC";
 	static struct option long_options[] =
 	{
 		// --verbose 옵션을 만나면 "verbose_flag = 1"이 세팅된다.
@@ -104,6 +125,10 @@ int main(int argc, char* argv[]){
 		{"nr_data", 1, NULL, 'n'},
 		{"netcpubind", 1, NULL, 'W'},
 		{"numa", 0, NULL, 'u'},
+		{"backend", 1, NULL, 'B'},
+		{"geometry", 1, NULL, 'g'},
+		{"clock", 0, NULL, 'c'},
+		{"compare", 0, NULL, 'C'},
 		{0, 0, 0, 0} 
 	};
 
@@ -147,6 +172,18 @@ int main(int argc, char* argv[]){
 			case 'u':
 				numa_on = true;
 				break;
+			case 'B':
+				kv_backend = strdup(optarg);
+				break;
+			case 'g':
+				cceh_geometry = strdup(optarg);
+				break;
+			case 'c':
+				clock_eviction = true;
+				break;
+			case 'C':
+				compare_eviction = true;
+				break;
 			default:
 				usage();
 				return 0;
@@ -154,7 +191,7 @@ int main(int argc, char* argv[]){
 	}
 
 	struct timespec i_start, i_end;
-	uint64_t i_elapsed, g_elapsed;
+	uint64_t i_elapsed;
 
 	dprintf("START MAIN FUNCTION\n");
 
@@ -171,24 +208,6 @@ int main(int argc, char* argv[]){
 	/* Print User specified cpu binding */
 	printCpuBuf(nr_cpus, netcpubuf, "net");
 
-	/* Create KV store */
-	KVStore* kv = NULL;
-	CountingBloomFilter<Key_t>* bf = NULL;
-	if (bf_flag) {
-		bf = new CountingBloomFilter<Key_t>(2,1000000);
-		dprintf("[  OK  ] BF Initialized\n");
-	}
-
-	auto totalSize = 10737418240 * 10 ; // 10GiB
-
-	if (initialTableSize == 0) 
-		initialTableSize = totalSize / 4096;
-
-	dprintf("[ INFO ] Hash Table Size : %lu\n", initialTableSize);
-
-	kv = new KV( initialTableSize, NULL);
-	dprintf("[  OK  ] KVStore Initialized\n");
-
 	vector<uint64_t> keys;
 	vector<int> ops;
 
@@ -202,7 +221,7 @@ int main(int argc, char* argv[]){
 
 	atomic<uint64_t> done(0);
 
-	int op, error;
+	int op;
 	uint64_t key;
 	uint64_t batch;
     string event_line;
@@ -211,8 +230,6 @@ int main(int argc, char* argv[]){
         stringstream ss(event_line);
         event_t e;
 
-        error = 0;
-
         while (ss >> buf) { e.push_back(buf); }
 
 		key = INODE(e);
@@ -252,73 +269,151 @@ int main(int argc, char* argv[]){
 
 	dprintf("[  OK  ] Completed reading dataset\n");
 
-	vector<thread> goThreads;
-	vector<thread> searchingThreads;
-	vector<int> failed(numNetworkThreads);
-	vector<Key_t> notfoundKeys[numNetworkThreads];
-
-	auto goroutine = [&kv, &ops, &keys, &failed, &notfoundKeys](int from, int to, int tid){
-		int fail = 0;
-		for(int i = from; i < to; i++){
-			if (ops[i] == 2)
-				kv->Insert(keys[i], reinterpret_cast<Value_t>(keys[i]));
-			else {
-				auto ret = kv->Get(keys[i]);
-				if(ret != reinterpret_cast<Value_t>(keys[i])){
-					fail++;
-					notfoundKeys[tid].push_back(keys[i]);
+	size_t numGets = 0;
+	for (size_t i = 0; i < numData && i < ops.size(); i++) {
+		if (ops[i] == 1)
+			numGets++;
+	}
+
+	/* Create KV store */
+	KVStore* kv = NULL;
+	CountingBloomFilter<Key_t>* bf = NULL;
+
+	auto backend = FindKVBackend(kv_backend);
+	if (!backend) {
+		printf("unknown backend %s (%s)\n", kv_backend, KVBackends());
+		return 0;
+	}
+	dprintf("[ INFO ] %s backend\n", backend->name);
+
+	auto totalSize = 10737418240 * 10 ; // 10GiB
+
+	if (initialTableSize == 0) 
+		initialTableSize = totalSize / 4096;
+
+	dprintf("[ INFO ] Hash Table Size : %lu\n", initialTableSize);
+
+	if (backend->needs_page_region) {
+		/* address space only, the index never touches page contents */
+		page_region_size = keys.size() * 4096;
+		page_region = (uint64_t)mmap(NULL, page_region_size, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if ((void*)page_region == MAP_FAILED) {
+			perror("mmap page region");
+			return 0;
+		}
+	}
+
+	/* the key itself, or one page of the region per distinct key like the server hands out */
+	vector<Value_t> values(keys.size());
+	unordered_map<Key_t, Value_t> pages;
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (page_region)
+			values[i] = pages.emplace(keys[i], (Value_t)(page_region + 4096 * pages.size())).first->second;
+		else
+			values[i] = reinterpret_cast<Value_t>(keys[i]);
+	}
+
+	/* replay the whole trace on a fresh KV, returns the number of failed searches */
+	auto replay = [&](bool clock) -> int {
+		clock_eviction = clock;
+		kv_putcnt.reset();
+		kv_getcnt.reset();
+		deletecnt.reset();
+		if (bf_flag) {
+			bf = new CountingBloomFilter<Key_t>(2,1000000);
+			dprintf("[  OK  ] BF Initialized\n");
+		}
+		kv = backend->create( initialTableSize, bf);
+		dprintf("[  OK  ] KVStore Initialized\n");
+
+		vector<thread> goThreads;
+		vector<thread> searchingThreads;
+		vector<int> failed(numNetworkThreads);
+		vector<Key_t> notfoundKeys[numNetworkThreads];
+
+		auto goroutine = [&kv, &ops, &keys, &values, &failed, &notfoundKeys](int from, int to, int tid){
+			int fail = 0;
+			for(int i = from; i < to; i++){
+				if (ops[i] == 2)
+					kv->Insert(keys[i], values[i]);
+				else {
+					auto ret = kv->Get(keys[i]);
+					if(ret != values[i]){
+						fail++;
+						notfoundKeys[tid].push_back(keys[i]);
+					}
 				}
 			}
-		}
-		failed[tid] = fail;
-	};
+			failed[tid] = fail;
+		};
+
+	//	if (human) printf("NumData: %lu, NetworkT: %lu, numKVThreads: %lu, PollT %lu\n", numData, numNetworkThreads, numKVThreads, numPollThreads);
+	//	clear_cache();
+		const size_t chunk = numData/numNetworkThreads;
+
+		dprintf("[ INFO ] Start Insertion\n");
+		clock_gettime(CLOCK_MONOTONIC, &i_start);
+
+		/* Equally distribute NetworkThread */
+		unsigned t_id = 0;
+		size_t cpu_id = 0;
+		while(true) {
+			if (numa_bitmask_isbitset(netcpubuf, cpu_id)) {
+				if(t_id != numNetworkThreads-1)
+					goThreads.emplace_back(thread(goroutine, chunk*t_id, chunk*(t_id+1), t_id));
+				else
+					goThreads.emplace_back(thread(goroutine, chunk*t_id, numData, t_id));
+
+				cpu_set_t cpuset;
+				CPU_ZERO(&cpuset);
+				CPU_SET(cpu_id, &cpuset);
+				int rc = pthread_setaffinity_np(goThreads[t_id].native_handle(),
+						sizeof(cpu_set_t), &cpuset);
+				if (rc != 0) {
+					std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+				}
+	//			dprintf("NewtorkT [%d/%d] bind on CPU %d\n", t_id, numNetworkThreads, cpu_id);
 
-//	if (human) printf("NumData: %lu, NetworkT: %lu, numKVThreads: %lu, PollT %lu\n", numData, numNetworkThreads, numKVThreads, numPollThreads);
-//	clear_cache();
-	const size_t chunk = numData/numNetworkThreads;
-
-	dprintf("[ INFO ] Start Insertion\n");
-	clock_gettime(CLOCK_MONOTONIC, &i_start);
-
-	/* Equally distribute NetworkThread */
-	unsigned t_id = 0;
-	size_t cpu_id = 0;
-	while(true) {
-		if (numa_bitmask_isbitset(netcpubuf, cpu_id)) {
-			if(t_id != numNetworkThreads-1)
-				goThreads.emplace_back(thread(goroutine, chunk*t_id, chunk*(t_id+1), t_id));
-			else
-				goThreads.emplace_back(thread(goroutine, chunk*t_id, numData, t_id));
-
-			cpu_set_t cpuset;
-			CPU_ZERO(&cpuset);
-			CPU_SET(cpu_id, &cpuset);
-			int rc = pthread_setaffinity_np(goThreads[t_id].native_handle(),
-					sizeof(cpu_set_t), &cpuset);
-			if (rc != 0) {
-				std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+				t_id++;
 			}
-//			dprintf("NewtorkT [%d/%d] bind on CPU %d\n", t_id, numNetworkThreads, cpu_id);
+			cpu_id++;
 
-			t_id++;
+			if ( cpu_id == nr_cpus )
+				break;
 		}
-		cpu_id++;
 
-		if ( cpu_id == nr_cpus )
-			break;
-	}
+		for(auto& t: goThreads) t.join();
+		dprintf("[ INFO ] goThreads all joined\n");
 
-	for(auto& t: goThreads) t.join();
-	dprintf("[ INFO ] goThreads all joined\n");
+		clock_gettime(CLOCK_MONOTONIC, &i_end);
+		i_elapsed = i_end.tv_nsec - i_start.tv_nsec + (i_end.tv_sec - i_start.tv_sec)*1000000000;
+		if (human) printf("process: %.3f usec/req \t %.3f ops/sec\n", i_elapsed/1000.0/numData , (numData/(i_elapsed/1000000000.0)));
 
-	clock_gettime(CLOCK_MONOTONIC, &i_end);
-	i_elapsed = i_end.tv_nsec - i_start.tv_nsec + (i_end.tv_sec - i_start.tv_sec)*1000000000;
-	if (human) printf("process: %.3f usec/req \t %.3f ops/sec\n", i_elapsed/1000.0/numData , (numData/(i_elapsed/1000000000.0)));
+		int failedSearch = 0;
+		for(auto& v: failed) failedSearch += v;
+		return failedSearch;
+	};
 
-	int failedSearch = 0;
-	for(auto& v: failed) failedSearch += v;
+	auto hitRate = [&numGets](int failedSearch) {
+		return numGets ? (numGets - failedSearch) * 100.0 / numGets : 0.0;
+	};
 
+	int failedSearch = replay(clock_eviction);
 	if (human) cout << failedSearch << " failedSearch" << endl;
+	if (human) printf("hit rate (%s): %.3f %% of %lu gets\n", clock_eviction ? "CLOCK" : "FIFO", hitRate(failedSearch), numGets);
+
+	if (compare_eviction) {
+		bool other = !clock_eviction;
+		if (human) kv->PrintStats();
+		delete kv;
+		delete bf;
+		int otherFailed = replay(other);
+		if (human) printf("hit rate (%s): %.3f %% of %lu gets\n", other ? "CLOCK" : "FIFO", hitRate(otherFailed), numGets);
+		printf("hit rate CLOCK - FIFO: %+.3f %%\n",
+				other ? hitRate(otherFailed) - hitRate(failedSearch) : hitRate(failedSearch) - hitRate(otherFailed));
+	}
+
 
 #if 0
 	vector<Key_t> notFoundKeys;
@@ -3,15 +3,17 @@
 #include <cstring>
 #include <iostream>
 #include "src/Level_hashing.h"
-#include "util/hash.h"
+#include "util/hash_policy.h"
 #include "util/persist.h"
 
 using namespace std;
 
-#define F_HASH(key) (h(&key, sizeof(Key_t), f_seed))
-#define S_HASH(key) (h(&key, sizeof(Key_t), s_seed))
+#define F_HASH(key) (DefaultHash::hash(key, f_seed))
+#define S_HASH(key) (DefaultHash::hash(key, s_seed))
 #define F_IDX(hash, capacity) (hash % (capacity/2))
 #define S_IDX(hash, capacity) ((hash % (capacity/2)) + (capacity/2))
+/* bottom level nodes a writer migrates per insert while resizing */
+#define MIGRATE_NODES 16
 
 void LevelHashing::generate_seeds(void) {
   srand(time(NULL));
@@ -29,8 +31,9 @@ LevelHashing::LevelHashing(void){
 }
 
 LevelHashing::~LevelHashing(void){
-  delete [] mutex;
-  delete [] buckets;
+  delete [] interim_level_buckets;
+  delete [] buckets[0];
+  delete [] buckets[1];
 }
 
 LevelHashing::LevelHashing(size_t _levels)
@@ -39,76 +42,95 @@ LevelHashing::LevelHashing(size_t _levels)
   total_capacity{(uint64_t)pow(2, levels) + (uint64_t)pow(2, levels-1)},
   resize_num{0}
 {
-  locksize = 256;
-  nlocks = (3*addr_capacity/2)/locksize+1;
-  mutex = new std::shared_mutex[nlocks];
-
   generate_seeds();
   buckets[0] = new Node[addr_capacity];
   buckets[1] = new Node[addr_capacity/2];
-  level_item_num[0] = 0;
-  level_item_num[1] = 0;
   interim_level_buckets = NULL;
+  migrate_next = 0;
 }
 
 
-void LevelHashing::Insert(Key_t& key, Value_t value) {
+Key_t LevelHashing::Insert(Key_t& key, Value_t value) {
+  EpochManager::Guard g(epoch);
 RETRY:
-  while (resizing_lock == 1) {
-    asm("nop");
-  }
+  if (interim_level_buckets)
+    migrate_step();
+
+  uint64_t version = table_lock.read_begin();
   uint64_t f_hash = F_HASH(key);
   uint64_t s_hash = S_HASH(key);
-  uint32_t f_idx = F_IDX(f_hash, addr_capacity);
-  uint32_t s_idx = S_IDX(s_hash, addr_capacity);
+
+  /*
+   * While the old bottom level is migrated, insert into the old top
+   * level and then the new one, which keeps the new level roomy enough
+   * for the items still to be migrated.
+   */
+  Node* interim = interim_level_buckets;
+  Node* level[2] = { buckets[0], interim ? interim : buckets[1] };
+  uint64_t level_capacity[2] = { addr_capacity, interim ? 2*addr_capacity : addr_capacity/2 };
+  uint32_t f_idx = F_IDX(f_hash, level_capacity[0]);
+  uint32_t s_idx = S_IDX(s_hash, level_capacity[0]);
 
   int i, j;
 
   for(i = 0; i < 2; i ++){
     for(j = 0; j < ASSOC_NUM; j ++){
       {
-        std::unique_lock<std::shared_mutex> lock(mutex[f_idx/locksize]);
-	if(buckets[i][f_idx].token[j] == 0){
-          buckets[i][f_idx].slot[j].value = value;
+        std::lock_guard<VersionLock> lock(level[i][f_idx].vlock);
+        if (!table_lock.read_validate(version))
+          goto RETRY;
+	if(level[i][f_idx].token[j] == 0){
+          level[i][f_idx].slot[j].value = value;
           mfence();
-          buckets[i][f_idx].slot[j].key = key;
-	  buckets[i][f_idx].token[j] = 1;
-	  clflush((char*)&buckets[i][f_idx], sizeof(Node));
-	  level_item_num[i]++;
-          return;
+          level[i][f_idx].slot[j].key = key;
+	  level[i][f_idx].token[j] = 1;
+	  clflush((char*)&level[i][f_idx], sizeof(Node));
+	  size.inc();
+          return -1;
         }
       }
       {
-        std::unique_lock<std::shared_mutex> lock(mutex[s_idx/locksize]);
-	if(buckets[i][s_idx].token[j] == 0){
-          buckets[i][s_idx].slot[j].value = value;
+        std::lock_guard<VersionLock> lock(level[i][s_idx].vlock);
+        if (!table_lock.read_validate(version))
+          goto RETRY;
+	if(level[i][s_idx].token[j] == 0){
+          level[i][s_idx].slot[j].value = value;
           mfence();
-          buckets[i][s_idx].slot[j].key = key;
-	  buckets[i][s_idx].token[j] = 1;
-	  clflush((char*)&buckets[i][s_idx], sizeof(Node));
-	  level_item_num[i]++;
-          return;
+          level[i][s_idx].slot[j].key = key;
+	  level[i][s_idx].token[j] = 1;
+	  clflush((char*)&level[i][s_idx], sizeof(Node));
+	  size.inc();
+          return -1;
         }
       }
     }
-    f_idx = F_IDX(f_hash, addr_capacity / 2);
-    s_idx = S_IDX(s_hash, addr_capacity / 2);
+    f_idx = F_IDX(f_hash, level_capacity[1]);
+    s_idx = S_IDX(s_hash, level_capacity[1]);
   }
 
-  f_idx = F_IDX(f_hash, addr_capacity);
-  s_idx = S_IDX(s_hash, addr_capacity);
+  if (interim) {
+    /* both levels full mid-migration, migrate on and retry */
+    std::this_thread::yield();
+    goto RETRY;
+  }
 
   int empty_loc;
   auto lock = 0;
   if (CAS(&resizing_lock, &lock, 1)) {
+    if (!table_lock.read_validate(version)) {
+      resizing_lock = 0;
+      goto RETRY;
+    }
+    f_idx = F_IDX(f_hash, addr_capacity);
+    s_idx = S_IDX(s_hash, addr_capacity);
     for(i=0; i<2; i++){
       if(!try_movement(f_idx, i, key, value)){
         resizing_lock = 0;
-        return;
+        return -1;
       }
       if(!try_movement(s_idx, i, key, value)){
         resizing_lock = 0;
-        return;
+        return -1;
       }
       f_idx = F_IDX(f_hash, addr_capacity / 2);
       s_idx = S_IDX(s_hash, addr_capacity / 2);
@@ -116,7 +138,7 @@ RETRY:
 
     if(resize_num>0){
       {
-        std::unique_lock<std::shared_mutex> lock(mutex[f_idx/locksize]);
+        std::lock_guard<VersionLock> lock(buckets[1][f_idx].vlock);
 #ifdef TIME
 	cuck_timer.Start();
 #endif
@@ -131,13 +153,13 @@ RETRY:
           buckets[1][f_idx].slot[empty_loc].key = key;
 	  buckets[1][f_idx].token[empty_loc] = 1;
 	  clflush((char*)&buckets[1][f_idx], sizeof(Node));
-	  level_item_num[1]++;
+	  size.inc();
           resizing_lock = 0;
-          return;
+          return -1;
         }
       }
       {
-        std::unique_lock<std::shared_mutex> lock(mutex[s_idx/locksize]);
+        std::lock_guard<VersionLock> lock(buckets[1][s_idx].vlock);
 #ifdef TIME
 	cuck_timer.Start();
 #endif
@@ -152,17 +174,14 @@ RETRY:
           buckets[1][s_idx].slot[empty_loc].key = key;
 	  buckets[1][s_idx].token[empty_loc] = 1;
 	  clflush((char*)&buckets[1][s_idx], sizeof(Node));
-	  level_item_num[1]++;
+	  size.inc();
           resizing_lock = 0;
-          return;
+          return -1;
         }
       }
     }
-//    timer.Start();
+    /* the writer that migrates the last node releases resizing_lock */
     resize();
-//    timer.Stop();
-//    breakdown += timer.GetSeconds();
-    resizing_lock = 0;
   }
   goto RETRY;
 }
@@ -171,103 +190,208 @@ bool LevelHashing::InsertOnly(Key_t& key, Value_t value) {
 	return false;
 }
 
+/*
+ * In-place resize: allocate a new top level twice the size of the
+ * current one, the old bottom level is then migrated into it by the
+ * writers, MIGRATE_NODES nodes per insert (see migrate_step). Readers
+ * and writers keep going meanwhile. The caller holds resizing_lock,
+ * which is released once the migration is done.
+ */
 void LevelHashing::resize(void) {
-  std::unique_lock<std::shared_mutex> *lock[nlocks];
-  for(int i=0;i<nlocks;i++){
-    lock[i] = new std::unique_lock<std::shared_mutex>(mutex[i]);
-  }
-  std::shared_mutex* old_mutex = mutex;
-
-  int prev_nlocks = nlocks;
-  nlocks = nlocks + 2*addr_capacity/locksize+1;
-  mutex= new std::shared_mutex[nlocks];
-
-  size_t new_addr_capacity = pow(2, levels + 1);
-  interim_level_buckets = new Node[new_addr_capacity];
-  if(!interim_level_buckets){
+  std::lock_guard<std::mutex> guard(migrate_mutex);
+  Node* interim = new Node[2*addr_capacity];
+  if(!interim){
 	  perror("The expanding fails");
   }
-  clflush((char*)&interim_level_buckets, sizeof(Node));
-
-  uint64_t new_level_item_num = 0;
-  uint64_t old_idx;
-  for (old_idx = 0; old_idx < pow(2, levels - 1); old_idx ++) {
-    uint64_t i, j;
-    for(i = 0; i < ASSOC_NUM; i ++){
-      if (buckets[1][old_idx].token[i] == 1)
-      {
-        Key_t key = buckets[1][old_idx].slot[i].key;
-        Value_t value = buckets[1][old_idx].slot[i].value;
 
-        uint32_t f_idx = F_IDX(F_HASH(key), new_addr_capacity);
-        uint32_t s_idx = S_IDX(S_HASH(key), new_addr_capacity);
+  /* writers that validated the old version retry and see the new level */
+  table_lock.lock();
+  migrate_next = 0;
+  interim_level_buckets = interim;
+  clflush((char*)&interim_level_buckets, sizeof(Node*));
+  table_lock.unlock();
+}
 
-        uint8_t insertSuccess = 0;
-        for(j = 0; j < ASSOC_NUM; j ++){
-          if (interim_level_buckets[f_idx].token[j] == 0)
-          {
-            interim_level_buckets[f_idx].slot[j].value = value;
-#ifndef BATCH
-            mfence();
-#endif
-            interim_level_buckets[f_idx].slot[j].key = key;
-	    interim_level_buckets[f_idx].token[j] = 1;
-#ifndef BATCH
-	    clflush((char*)&interim_level_buckets[f_idx], sizeof(Node));
-#endif
-            insertSuccess = 1;
-	    new_level_item_num++;
-            break;
-          }
-          else if (interim_level_buckets[s_idx].token[j] == 0)
-          {
-            interim_level_buckets[s_idx].slot[j].value = value;
+/*
+ * Move the next MIGRATE_NODES nodes of the old bottom level into the
+ * new top level. Every writer does a step before inserting, so the
+ * migration keeps ahead of the inserts filling the new level. Only the
+ * node being drained and one target node are locked at a time, readers
+ * never wait. The writer that drains the last node swaps the levels,
+ * which is the only step taking the table lock. An item that fits in
+ * neither level stays where it is and the table is rehashed (rehash()).
+ */
+void LevelHashing::migrate_step(void) {
+  std::lock_guard<std::mutex> guard(migrate_mutex);
+  if (interim_level_buckets == NULL)
+    return;
+
+  Node* interim = interim_level_buckets;
+  Node* bottom = buckets[1];
+  uint64_t new_addr_capacity = 2*addr_capacity;
+  uint64_t end = migrate_next + MIGRATE_NODES;
+  if (end > addr_capacity/2)
+    end = addr_capacity/2;
+
+  for (uint64_t old_idx = migrate_next; old_idx < end; old_idx ++) {
+    std::unique_lock<VersionLock> lock(bottom[old_idx].vlock);
+    for(uint64_t i = 0; i < ASSOC_NUM; i ++){
+      if (bottom[old_idx].token[i] == 0)
+        continue;
+      Key_t key = bottom[old_idx].slot[i].key;
+      Value_t value = bottom[old_idx].slot[i].value;
+      uint64_t f_hash = F_HASH(key);
+      uint64_t s_hash = S_HASH(key);
+
+      /*
+       * Writers fill the new level concurrently, so unlike a stop-the-world
+       * rehash its nodes can be full. Fall back to the old top level, which
+       * becomes the bottom level with the same node indices.
+       */
+      Node* target_level[2] = { interim, buckets[0] };
+      uint64_t target_capacity[2] = { new_addr_capacity, addr_capacity };
+
+      bool moved = false;
+      for(int l = 0; l < 2 && !moved; l ++){
+        uint32_t idx[2] = { (uint32_t)F_IDX(f_hash, target_capacity[l]),
+                            (uint32_t)S_IDX(s_hash, target_capacity[l]) };
+        for(uint64_t j = 0; j < ASSOC_NUM && !moved; j ++){
+          for(int k = 0; k < 2 && !moved; k ++){
+            Node* node = &target_level[l][idx[k]];
+            std::lock_guard<VersionLock> target(node->vlock);
+            if (node->token[j] == 0)
+            {
+              node->slot[j].value = value;
 #ifndef BATCH
-            mfence();
+              mfence();
 #endif
-            interim_level_buckets[s_idx].slot[j].key = key;
-	    interim_level_buckets[s_idx].token[j] = 1;
+              node->slot[j].key = key;
+              node->token[j] = 1;
 #ifndef BATCH
-	    clflush((char*)&interim_level_buckets[s_idx], sizeof(Node));
+              clflush((char*)node, sizeof(Node));
 #endif
-            insertSuccess = 1;
-	    new_level_item_num++;
-            break;
+              moved = true;
+            }
           }
         }
+      }
+      if (!moved) {
+        lock.unlock();
+        rehash();
+        return;
+      }
 
-	buckets[1][old_idx].token[i] = 0;
+      /* cleared only after the copy is visible, so lookups never miss it */
+      bottom[old_idx].token[i] = 0;
 #ifndef BATCH
-	clflush((char*)&buckets[1][old_idx].token[i], sizeof(uint8_t));
+      clflush((char*)&bottom[old_idx].token[i], sizeof(uint8_t));
 #endif
-      }
     }
   }
+  migrate_next = end;
+  if (migrate_next < addr_capacity/2)
+    return;
 
 #ifdef BATCH
-  clflush((char*)&buckets[1][0],sizeof(Node)*pow(2,levels-1));
-  clflush((char*)&interim_level_buckets[0], sizeof(Node)*new_addr_capacity);
+  clflush((char*)&bottom[0], sizeof(Node)*addr_capacity/2);
+  clflush((char*)&interim[0], sizeof(Node)*new_addr_capacity);
 #endif
 
-
+  table_lock.lock();
   levels++;
   resize_num++;
 
-  delete [] buckets[1];
   buckets[1] = buckets[0];
-  buckets[0] = interim_level_buckets;
+  buckets[0] = interim;
   interim_level_buckets = NULL;
 
-  level_item_num[1] = level_item_num[0];
-  level_item_num[0] = new_level_item_num;
-
   addr_capacity = new_addr_capacity;
   total_capacity = pow(2, levels) + pow(2, levels - 1);
+  table_lock.unlock();
+
+  epoch.retire(bottom, [](void* p) { delete [] (Node*)p; });
+  resizing_lock = 0;
+}
 
-  for(int i=0;i<prev_nlocks;i++){
-    delete lock[i];
+/*
+ * Stop-the-world fallback of the migration: every item of the three
+ * levels goes into a new pair of levels twice the size the migration
+ * would have ended with, doubled again until all of them fit. The table
+ * lock and every node lock are held meanwhile, so writers wait at their
+ * node and readers retry. The caller holds migrate_mutex.
+ */
+void LevelHashing::rehash(void) {
+  Node* old[3] = { buckets[1], buckets[0], interim_level_buckets };
+  uint64_t old_capacity[3] = { addr_capacity/2, addr_capacity, 2*addr_capacity };
+
+  table_lock.lock();
+  for (int l = 0; l < 3; l ++)
+    for (uint64_t n = 0; n < old_capacity[l]; n ++)
+      old[l][n].vlock.lock();
+
+  uint64_t new_levels = levels + 1;
+  Node* top;
+  Node* bottom;
+  bool fits;
+  do {
+    new_levels ++;
+    uint64_t capacity = (uint64_t)1 << new_levels;
+    top = new Node[capacity];
+    bottom = new Node[capacity/2];
+    Node* level[2] = { top, bottom };
+    uint64_t level_capacity[2] = { capacity, capacity/2 };
+
+    fits = true;
+    for (int l = 0; l < 3 && fits; l ++) {
+      for (uint64_t n = 0; n < old_capacity[l] && fits; n ++) {
+        for (int i = 0; i < ASSOC_NUM && fits; i ++) {
+          if (old[l][n].token[i] == 0)
+            continue;
+          Key_t key = old[l][n].slot[i].key;
+          uint64_t f_hash = F_HASH(key);
+          uint64_t s_hash = S_HASH(key);
+          fits = false;
+          for (int t = 0; t < 2 && !fits; t ++) {
+            uint64_t idx[2] = { F_IDX(f_hash, level_capacity[t]), S_IDX(s_hash, level_capacity[t]) };
+            for (int j = 0; j < ASSOC_NUM && !fits; j ++) {
+              for (int k = 0; k < 2 && !fits; k ++) {
+                Node* node = &level[t][idx[k]];
+                if (node->token[j] == 0) {
+                  node->slot[j] = old[l][n].slot[i];
+                  node->token[j] = 1;
+                  fits = true;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    if (!fits) {
+      delete [] top;
+      delete [] bottom;
+    }
+  } while (!fits);
+  clflush((char*)&top[0], sizeof(Node)*((uint64_t)1 << new_levels));
+  clflush((char*)&bottom[0], sizeof(Node)*((uint64_t)1 << (new_levels - 1)));
+
+  levels = new_levels;
+  resize_num++;
+  buckets[0] = top;
+  buckets[1] = bottom;
+  interim_level_buckets = NULL;
+  migrate_next = 0;
+  addr_capacity = (uint64_t)1 << new_levels;
+  total_capacity = pow(2, levels) + pow(2, levels - 1);
+
+  /* waiting writers get the old nodes, fail the table lock check and retry */
+  for (int l = 0; l < 3; l ++) {
+    for (uint64_t n = 0; n < old_capacity[l]; n ++)
+      old[l][n].vlock.unlock();
+    epoch.retire(old[l], [](void* p) { delete [] (Node*)p; });
   }
-  delete[] old_mutex;
+  table_lock.unlock();
+  resizing_lock = 0;
 }
 
 uint8_t LevelHashing::try_movement(uint64_t idx, uint64_t level_num, Key_t& key, Value_t value) {
@@ -276,8 +400,8 @@ cuck_timer.Start();
 #endif
   uint64_t i, j, jdx;
   {
-    std::unique_lock<std::shared_mutex> *lock[2];
-    lock[0] = new std::unique_lock<std::shared_mutex>(mutex[idx/locksize]);
+    /* only the thread holding resizing_lock moves items, so two node locks cannot deadlock */
+    std::lock_guard<VersionLock> lock(buckets[level_num][idx].vlock);
     for(i=0; i<ASSOC_NUM; i++){
       Key_t m_key = buckets[level_num][idx].slot[i].key;
       Value_t m_value = buckets[level_num][idx].slot[i].value;
@@ -289,9 +413,8 @@ cuck_timer.Start();
       if(f_idx == idx) jdx = s_idx;
       else jdx = f_idx;
 
-      if((jdx/locksize)!=(idx/locksize)){
-        lock[1] = new std::unique_lock<std::shared_mutex>(mutex[jdx/locksize]);
-      }
+      std::unique_lock<VersionLock> jlock(buckets[level_num][jdx].vlock, std::defer_lock);
+      if(jdx != idx) jlock.lock();
 
       for(j=0; j<ASSOC_NUM; j++){
 	  if(buckets[level_num][jdx].token[j] == 0){
@@ -308,10 +431,8 @@ cuck_timer.Start();
           buckets[level_num][idx].slot[i].key = key;
 	  buckets[level_num][idx].token[i] = 1;
 	  clflush((char*)&buckets[level_num][idx], sizeof(Node));
-	  level_item_num[level_num]++;
+	  size.inc();
 
-          if((jdx/locksize) != (idx/locksize)) delete lock[1];
-          delete lock[0];
 #ifdef TIME
 	  cuck_timer.Stop();
 	  displacement += cuck_timer.GetSeconds();
@@ -319,9 +440,7 @@ cuck_timer.Start();
           return 0;
         }
       }
-      if((jdx/locksize) != (idx/locksize)) delete lock[1];
     }
-    delete lock[0];
   }
 #ifdef TIME
   cuck_timer.Stop();
@@ -339,7 +458,6 @@ int LevelHashing::b2t_movement(uint64_t idx){
   uint64_t s_idx, f_idx;
   uint64_t i, j;
 
-  std::unique_lock<shared_mutex> *lock;
   for(i=0; i<ASSOC_NUM; i++){
     key = buckets[1][idx].slot[i].key;
     value = buckets[1][idx].slot[i].value;
@@ -349,8 +467,8 @@ int LevelHashing::b2t_movement(uint64_t idx){
     s_idx = S_IDX(s_hash, addr_capacity);
 
     for(j=0; j<ASSOC_NUM; j++){
-      if((idx/locksize) != (f_idx/locksize))
-        lock = new std::unique_lock<std::shared_mutex>(mutex[f_idx/locksize]);
+      /* the caller holds buckets[1][idx], these are top level nodes */
+      std::unique_lock<VersionLock> flock(buckets[0][f_idx].vlock);
       if(buckets[0][f_idx].token[j] == 0){
         buckets[0][f_idx].slot[j].value = value;
         mfence();
@@ -359,15 +477,11 @@ int LevelHashing::b2t_movement(uint64_t idx){
 	clflush((char*)&buckets[0][f_idx], sizeof(Node));
 	buckets[1][idx].token[i] = 0;
 	clflush((char*)&buckets[1][idx].token[i], sizeof(uint8_t));
-	level_item_num[0]++;
-	level_item_num[1]--;
 
-        if((idx/locksize) != (f_idx/locksize)) delete lock;
         return i;
       }
-      if((idx/locksize)!=(f_idx/locksize)) delete lock;
-      if((idx/locksize)!=(s_idx/locksize))
-        lock = new std::unique_lock<std::shared_mutex>(mutex[s_idx/locksize]);
+      flock.unlock();
+      std::unique_lock<VersionLock> slock(buckets[0][s_idx].vlock);
 
       if(buckets[0][s_idx].token[j] == 0){
         buckets[0][s_idx].slot[j].value = value;
@@ -378,13 +492,8 @@ int LevelHashing::b2t_movement(uint64_t idx){
 	buckets[1][idx].token[i] = 0;
 	clflush((char*)&buckets[0][s_idx].token[j], sizeof(uint8_t));
 
-	level_item_num[0]++;
-	level_item_num[1]--;
-
-        if((idx/locksize) != (s_idx/locksize)) delete lock;
         return i;
       }
-      if((idx/locksize)!=(s_idx/locksize)) delete lock;
     }
   }
   return -1;
@@ -394,36 +503,69 @@ int LevelHashing::b2t_movement(uint64_t idx){
 
 
 
+/* optimistic probe of one node, retried until no writer interfered; @version is what it saw */
+bool LevelHashing::probe(Node* node, Key_t& key, Value_t& value, uint64_t& version) {
+  bool found;
+  do {
+    version = node->vlock.read_begin();
+    found = false;
+    for(int j = 0; j < ASSOC_NUM; j ++){
+      if (node->token[j] == 1 && node->slot[j].key == key)
+      {
+        value = node->slot[j].value;
+        found = true;
+        break;
+      }
+    }
+  } while (!node->vlock.read_validate(version));
+  return found;
+}
+
 Value_t LevelHashing::Get(Key_t& key) {
+  Value_t value;
+  EpochManager::Guard g(epoch);
+RETRY:
+  uint64_t version = table_lock.read_begin();
   uint64_t f_hash = F_HASH(key);
   uint64_t s_hash = S_HASH(key);
   uint32_t f_idx = F_IDX(f_hash, addr_capacity);
   uint32_t s_idx = S_IDX(s_hash, addr_capacity);
-  int i = 0, j;
-
-  for(i = 0; i < 2; i ++){
-    {
-      std::shared_lock<std::shared_mutex> lock(mutex[f_idx/locksize]);
-      for(j = 0; j < ASSOC_NUM; j ++){
-        if (buckets[i][f_idx].token[j] == 1 && buckets[i][f_idx].slot[j].key == key)
-        {
-          return buckets[i][f_idx].slot[j].value;
-        }
-      }
-    }
-    {
-      std::shared_lock<std::shared_mutex> lock(mutex[s_idx/locksize]);
-      for(j = 0; j < ASSOC_NUM; j ++){
-        if (buckets[i][s_idx].token[j] == 1 && buckets[i][s_idx].slot[j].key == key)
-        {
-          return buckets[i][s_idx].slot[j].value;
-        }
-      }
+  int i = 0;
+
+  Node* interim = interim_level_buckets;
+
+  Node* level[3] = { buckets[1], buckets[0], interim };
+  uint64_t level_capacity[3] = { addr_capacity/2, addr_capacity, 2*addr_capacity };
+  Node* probed[6];
+  uint64_t probed_version[6];
+  int n = 0;
+
+  for(i = 0; i < 3 && level[i]; i ++){
+    f_idx = F_IDX(f_hash, level_capacity[i]);
+    s_idx = S_IDX(s_hash, level_capacity[i]);
+    probed[n] = &level[i][f_idx];
+    probed[n+1] = &level[i][s_idx];
+    if (probe(probed[n], key, value, probed_version[n])
+        || probe(probed[n+1], key, value, probed_version[n+1])) {
+      if (!table_lock.read_validate(version))
+        goto RETRY;
+      return value;
     }
-    f_idx = F_IDX(f_hash, addr_capacity/2);
-    s_idx = S_IDX(s_hash, addr_capacity/2);
+    n += 2;
   }
 
+  /*
+   * Items move between the two nodes of a level (try_movement) and
+   * between levels (b2t_movement, migration), copied before cleared.
+   * A key moved to a node probed earlier is missed, so a miss counts
+   * only if none of the probed nodes changed since.
+   */
+  for (int k = 0; k < n; k ++) {
+    if (!probed[k]->vlock.read_validate(probed_version[k]))
+      goto RETRY;
+  }
+  if (!table_lock.read_validate(version))
+    goto RETRY;
   return NONE;
 }
 
@@ -432,20 +574,5 @@ bool LevelHashing::Delete(Key_t& key) {
 }
 
 double LevelHashing::Utilization(void) {
-  size_t sum = 0;
-  for (unsigned i = 0; i < addr_capacity; ++i) {
-    for(unsigned j = 0; j < ASSOC_NUM; ++j) {
-      if (buckets[0][i].slot[j].key != INVALID) {
-        sum++;
-      }
-    }
-  }
-  for (unsigned i = 0; i < addr_capacity/2; ++i) {
-    for(unsigned j = 0; j < ASSOC_NUM; ++j) {
-      if (buckets[1][i].slot[j].key != INVALID) {
-        sum++;
-      }
-    }
-  }
-  return ((double)(sum)/(double)(total_capacity*ASSOC_NUM)*100);
+  return ((double)size.read()/(double)Capacity()*100);
 }
@@ -3,8 +3,11 @@
 
 #include <stdint.h>
 #include <mutex>
-#include <shared_mutex>
+#include <thread>
+#include "util/epoch.h"
 #include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
 #include "IHash.h"
 #define ASSOC_NUM 3
 
@@ -21,36 +24,47 @@ struct Entry {
     posix_memalign(&ret, 64, size);
     return ret;
   }
+  void operator delete[](void* p) { free(p); }
 
   void* operator new (size_t size) {
     void* ret;
     posix_memalign(&ret, 64, size);
     return ret;
   }
+  void operator delete(void* p) { free(p); }
 };
 
 struct Node {
   uint8_t token[ASSOC_NUM];
   Entry slot[ASSOC_NUM];
-  char dummy[13];
+  /* guards this bucket; fills the padding so a Node stays one cache line */
+  VersionLock vlock;
+  Node() : token{0} { }
   void* operator new[] (size_t size) {
     void* ret;
     posix_memalign(&ret, 64, size);
     return ret;
   }
+  void operator delete[](void* p) { free(p); }
 
   void* operator new (size_t size) {
     void* ret;
     posix_memalign(&ret, 64, size);
     return ret;
   }
+  void operator delete(void* p) { free(p); }
 };
 
-class LevelHashing: public IHash {
+static_assert(sizeof(Node) == 64, "Level hashing Node must be one cache line");
+
+class LevelHashing final : public IHash {
   private:
     Node *buckets[2];
     Node *interim_level_buckets;
-    uint64_t level_item_num[2];
+    /* items in all levels, so stats never walk the table */
+    ShardedCounter size;
+    /* next bottom level node to migrate, under migrate_mutex */
+    uint64_t migrate_next;
 
     uint64_t levels;
     uint64_t addr_capacity;
@@ -60,15 +74,25 @@ class LevelHashing: public IHash {
     uint64_t s_seed;
     uint32_t resize_num;
     int32_t resizing_lock = 0;
-    std::shared_mutex *mutex;
-    int nlocks;
-    int locksize;
+    /*
+     * Bumped when resize() publishes the new level and when the
+     * migration swaps it in. Writers validate it after locking a node,
+     * readers after probing, so nobody acts on a node of a swapped out level.
+     */
+    VersionLock table_lock;
+    /* levels swapped out are retired, optimistic readers may still probe them */
+    EpochManager epoch;
+    /* writers take turns migrating MIGRATE_NODES nodes each */
+    std::mutex migrate_mutex;
 
 
     void generate_seeds(void);
     void resize(void);
+    void migrate_step(void);
+    void rehash(void);
     int b2t_movement(uint64_t );
     uint8_t try_movement(uint64_t , uint64_t , Key_t& , Value_t);
+    bool probe(Node*, Key_t&, Value_t&, uint64_t&);
 
   public:
     LevelHashing(void);
@@ -76,7 +100,7 @@ class LevelHashing: public IHash {
     ~LevelHashing(void);
 
     bool InsertOnly(Key_t&, Value_t);
-    void Insert(Key_t&, Value_t);
+    Key_t Insert(Key_t&, Value_t);
     bool Delete(Key_t&);
     Value_t Get(Key_t&);
 
@@ -1,13 +1,14 @@
 #include <iostream>
+#include <algorithm>
 #include <cmath>
 #include <thread>
 #include <bitset>
 #include <cassert>
-#include <unordered_map>
 #include <sys/types.h>
 
 #include "util/persist.h"
-#include "util/hash.h"
+#include "util/hash_policy.h"
+#include "util/amac.h"
 #include "cceh.h"
 
 #define EXTENT_MAX_HEIGHT 30
@@ -15,69 +16,91 @@
 using namespace std;
 extern size_t perfCounter;
 
-void Segment::Insert4split(Key_t& key, Value_t value, size_t loc) {
-	for (unsigned i = 0; i < kNumPairPerCacheLine * kNumCacheLine; ++i) {
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+void SegmentT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Insert4split(Key_t& key, Value_t value, size_t key_hash) {
+	auto loc = bucket(key_hash);
+	for (unsigned i = 0; i < kProbeDistance; ++i) {
 		auto slot = (loc+i) % kNumSlot;
 		if (_[slot].key == INVALID) {
 			_[slot].key = key;
 			_[slot].value = value;
+			this->set_fp(slot, tag(key_hash));
 			return;
 		}
 	}
 	cerr << "[" << __func__ << "]: something wrong -- need to adjust linear probing distance" << endl;
 }
 
-Segment** Segment::Split(void){
+/* same as Insert4split but reports a full probing window instead of dropping the key */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool SegmentT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Insert4merge(Key_t& key, Value_t value, size_t key_hash) {
+	auto loc = bucket(key_hash);
+	for (unsigned i = 0; i < kProbeDistance; ++i) {
+		auto slot = (loc+i) % kNumSlot;
+		if (_[slot].key == INVALID) {
+			_[slot].key = key;
+			_[slot].value = value;
+			this->set_fp(slot, tag(key_hash));
+			return true;
+		}
+	}
+	return false;
+}
+
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+SegmentT<SegmentBits, ProbeLines, FingerprintBits, Hash>** SegmentT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Split(void){
 #ifdef INPLACE
-	Segment** split = new Segment*[2];
+	SegmentT** split = new SegmentT*[2];
 	split[0] = this;
-	split[1] = new Segment(local_depth+1);
+	split[1] = new SegmentT(local_depth+1);
 
 	auto pattern = ((size_t)1 << (sizeof(Key_t)*8 - local_depth - 1));
 	for (unsigned i = 0; i < kNumSlot; ++i) {
-		auto key_hash = h(&_[i].key, sizeof(Key_t));
+		auto key_hash = Hash::hash(_[i].key);
 		if (key_hash & pattern) {
-			split[1]->Insert4split(_[i].key, _[i].value, (key_hash & kMask)*kNumPairPerCacheLine);
+			split[1]->Insert4split(_[i].key, _[i].value, key_hash);
 		}
 	}
 
-	clflush((char*)split[1], sizeof(Segment));
+	clflush((char*)split[1], sizeof(SegmentT));
 
 	return split;
 #else
-	Segment** split = new Segment*[2];
-	split[0] = new Segment(local_depth+1);
-	split[1] = new Segment(local_depth+1);
+	SegmentT** split = new SegmentT*[2];
+	split[0] = new SegmentT(local_depth+1);
+	split[1] = new SegmentT(local_depth+1);
 
 	auto pattern = ((size_t)1 << (sizeof(Key_t)*8 - local_depth - 1));
 	for (unsigned i = 0; i < kNumSlot; ++i) {
-		auto key_hash = h(&_[i].key, sizeof(Key_t));
+		auto key_hash = Hash::hash(_[i].key);
 		if (key_hash & pattern) {
-			split[1]->Insert4split(_[i].key, _[i].value, (key_hash & kMask)*kNumPairPerCacheLine);
+			split[1]->Insert4split(_[i].key, _[i].value, key_hash);
 		} else {
-			split[0]->Insert4split(_[i].key, _[i].value, (key_hash & kMask)*kNumPairPerCacheLine);
+			split[0]->Insert4split(_[i].key, _[i].value, key_hash);
 		}
 	}
 
-	clflush((char*)split[0], sizeof(Segment));
-	clflush((char*)split[1], sizeof(Segment));
+	clflush((char*)split[0], sizeof(SegmentT));
+	clflush((char*)split[1], sizeof(SegmentT));
 
 	return split;
 #endif
 }
 
 
-CCEH::CCEH(void)
-	: dir{new Directory(0)}
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::CCEHT(void)
+	: dir{new Directory(0)}, min_depth{0}
 {
 	for (unsigned i = 0; i < dir->capacity; ++i) {
 		dir->_[i] = new Segment(0);
 	}
-
+	segments.reset(dir->capacity);
 }
 
 // initCap = Number of elements
-CCEH::CCEH(size_t initCap)
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::CCEHT(size_t initCap)
 //	: dir{new Directory(static_cast<size_t>(log2(initCap)))}
 	: dir{new Directory(static_cast<size_t>(log2(initCap/Segment::kNumSlot)))}
 {
@@ -85,15 +108,30 @@ CCEH::CCEH(size_t initCap)
 //		dir->_[i] = new Segment(static_cast<size_t>(log2(initCap)));
 		dir->_[i] = new Segment(static_cast<size_t>(log2(initCap/Segment::kNumSlot)));
 	}
+	min_depth = dir->depth;
+	segments.reset(dir->capacity);
 }
 
-CCEH::~CCEH(void)
-{ }
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::~CCEHT(void)
+{
+	if (shrinking)
+		CCEHShrinker::Get().Remove(this);
+
+	/* every live segment once, from the first entry of its stride */
+	for (size_t i = 0; i < dir->capacity; ) {
+		auto s = dir->_[i];
+		i += (size_t)1 << (dir->depth - s->local_depth);
+		delete s;
+	}
+	delete dir;
+}
 
 
-Key_t CCEH::Insert(Key_t& key, Value_t value) {
-	auto key_hash = h(&key, sizeof(key));
-	auto y = (key_hash & kMask) * kNumPairPerCacheLine;
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+Key_t CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Insert(Key_t& key, Value_t value) {
+	auto key_hash = Hash::hash(key);
+	EpochManager::Guard g(epoch);
 
 RETRY:
 	/*
@@ -101,10 +139,12 @@ RETRY:
 	   asm("nop");
 	   }*/
 
-	auto dir_depth = dir->depth;
+	/* depth and entries from one directory, halving may swap in a smaller one */
+	auto d = dir;
+	auto dir_depth = d->depth;
 
 	auto x = (key_hash >> (8*sizeof(key_hash) - dir_depth));
-	auto target = dir->_[x];
+	auto target = d->_[x];
 
 	/* acquire segment exclusive lock */
 	if(!target->lock()){
@@ -112,8 +152,7 @@ RETRY:
 		goto RETRY;
 	}
 
-	auto target_check = (key_hash >> (8*sizeof(key_hash) - dir_depth));
-	if(target != dir->_[target_check]){
+	if(d != dir || target != d->_[x]){
 		target->unlock();
 		std::this_thread::yield();
 		goto RETRY;
@@ -121,37 +160,14 @@ RETRY:
 
 	/* pattern : MSB 중 해당 세그먼트에서 유효한 bit */
 	auto pattern = (x >> (dir_depth - target->local_depth)); 
-	if(dir_depth != dir->depth){
-		target->unlock();
-		std::this_thread::yield();
-		goto RETRY;
-	}
 
-	for(unsigned i=0; i<kNumPairPerCacheLine * kNumCacheLine; ++i){
-		auto loc = (y + i) % Segment::kNumSlot;
-		auto _key = target->_[loc].key;
-		/* validity check for entry keys */
-		// pattern이 일치하지 않거나, INVALID한 곳에 새로운 key value를 추가할 수 있음.
-		// SENTINEL 인 곳에는 추가 불가.
-		if(
-				(
-					((h(&target->_[loc].key, sizeof(Key_t)) >> (8*sizeof(key_hash)-target->local_depth)) != pattern) 
-					|| (target->_[loc].key == INVALID)
-//					|| (target->_[loc].key == _key) /* Overwrite */
-				) 
-				&& (target->_[loc].key != SENTINEL)
-		  ){
-			// 아래 CAS가 무슨 의미?
-			if(CAS(&target->_[loc].key, &_key, SENTINEL)){
-				target->_[loc].value = value;
-				mfence();
-				target->_[loc].key = key;
-				clflush((char*)&target->_[loc], sizeof(Pair));
-				/* release segment exclusive lock */
-				target->unlock();
-				return -1;
-			}
-		}
+	char* line;
+	if(place(target, pattern, key, value, key_hash, &line)){
+		clflush(line, sizeof(Pair));
+		/* release segment exclusive lock */
+		target->unlock();
+		elements.inc();
+		return -1;
 	}
 
 	// COLLISION!!
@@ -164,50 +180,53 @@ RETRY:
 		goto RETRY;
 	}
 
+	/* directory may have been resized meanwhile, so re-index it */
+	d = dir;
+	x = (key_hash >> (8*sizeof(key_hash) - d->depth));
+
 	/* need to check whether the target segment has been split */
 #ifdef INPLACE
 	if(target_local_depth != target->local_depth){
-		target->sema = 0;
-		std::this_thread::yield();
-		goto RETRY;
-	}
 #else
-	if(target_local_depth != dir->_[x]->local_depth){
+	if(target_local_depth != target->local_depth || target != d->_[x]){
+#endif
 		target->sema = 0;
 		std::this_thread::yield();
 		goto RETRY;
 	}
-#endif
 
 	Segment** s = target->Split();
 
 	/* need to double the directory */
-	if(target->local_depth == dir->depth){
-		if(!dir->suspend()){
+	if(target->local_depth == d->depth){
+		/* a replaced directory stays suspended, so this one is still current */
+		if(!d->suspend()){
 			target->sema = 0;
+#ifndef INPLACE
+			delete s[0];
+#endif
 			delete s[1];
-			delete s;
+			delete [] s;
 			std::this_thread::yield();
 			goto RETRY;
 		}
 
-//		auto dir_old = dir;
-		auto d = dir->_;
-		auto _dir = new Directory(dir->depth+1);
-		for(unsigned i = 0; i < dir->capacity; ++i){
+		auto _dir = new Directory(d->depth+1);
+		for(unsigned i = 0; i < d->capacity; ++i){
 			if (i == x){
 				_dir->_[2*i] = s[0];
 				_dir->_[2*i+1] = s[1];
 			}
 			else{
-				_dir->_[2*i] = d[i];
-				_dir->_[2*i+1] = d[i];
+				_dir->_[2*i] = d->_[i];
+				_dir->_[2*i+1] = d->_[i];
 			}
 		}
 		clflush((char*)&_dir->_[0], sizeof(Segment*)*_dir->capacity);
-		clflush((char*)&_dir, sizeof(Directory));
+		clflush((char*)_dir, sizeof(Directory));
 		dir = _dir;
 		clflush((char*)&dir, sizeof(void*));
+		segments.inc();
 #ifdef INPLACE
 		s[0]->local_depth++;
 		clflush((char*)&s[0]->local_depth, sizeof(size_t));
@@ -215,41 +234,60 @@ RETRY:
 		s[0]->sema = 0;
 #endif
 
-		/* TBD */
-		// delete dir_old;
+		epoch.retire(d);
 	}
 	else{ // normal segment split
-		if(!dir->lock()){
+		if(!d->lock()){
+			target->sema = 0;
+#ifndef INPLACE
+			delete s[0];
+#endif
+			delete s[1];
+			delete [] s;
+			std::this_thread::yield();
+			goto RETRY;
+		}
+
+		/*
+		 * The directory may have been halved since local_depth was compared
+		 * with it above. Then the segment fills its whole stride and the
+		 * split has to double the directory instead: start over.
+		 */
+		if(d->depth <= target->local_depth){
+			d->unlock();
 			target->sema = 0;
-			//delete s[1];
-			delete s;
+#ifndef INPLACE
+			delete s[0];
+#endif
+			delete s[1];
+			delete [] s;
 			std::this_thread::yield();
 			goto RETRY;
 		}
 
-		x = (key_hash >> (8 * sizeof(key_hash) - dir->depth));
-		if(dir->depth == target->local_depth+1){
+		if(d->depth == target->local_depth+1){
 			if(x%2 == 0){
-				dir->_[x+1] = s[1];
+				d->_[x+1] = s[1];
 #ifdef INPLACE
-				clflush((char*)&dir->_[x+1], 8);
+				clflush((char*)&d->_[x+1], 8);
 #else
 				mfence();
-				dir->_[x] = s[0];
-				clflush((char*)&dir->_[x], 16);
+				d->_[x] = s[0];
+				clflush((char*)&d->_[x], 16);
 #endif
 			}
 			else{
-				dir->_[x] = s[1];
+				d->_[x] = s[1];
 #ifdef INPLACE
-				clflush((char*)&dir->_[x], 8);
+				clflush((char*)&d->_[x], 8);
 #else
 				mfence();
-				dir->_[x-1] = s[0];
-				clflush((char*)&dir->_[x-1], 16);
+				d->_[x-1] = s[0];
+				clflush((char*)&d->_[x-1], 16);
 #endif
 			}	    
-			dir->unlock();
+			d->unlock();
+			segments.inc();
 #ifdef INPLACE
 			s[0]->local_depth++;
 			clflush((char*)&s[0]->local_depth, sizeof(size_t));
@@ -258,20 +296,21 @@ RETRY:
 #endif
 		}
 		else{
-			int stride = pow(2, dir->depth - target->local_depth);
+			int stride = pow(2, d->depth - target->local_depth);
 			auto loc = x - (x%stride);
 			for(int i=0; i<stride/2; ++i){
-				dir->_[loc+stride/2+i] = s[1];
+				d->_[loc+stride/2+i] = s[1];
 			}
 #ifdef INPLACE
-			clflush((char*)&dir->_[loc+stride/2], sizeof(void*)*stride/2);
+			clflush((char*)&d->_[loc+stride/2], sizeof(void*)*stride/2);
 #else 
 			for(int i=0; i<stride/2; ++i){
-				dir->_[loc+i] = s[0];
+				d->_[loc+i] = s[0];
 			}
-			clflush((char*)&dir->_[loc], sizeof(void*)*stride);
+			clflush((char*)&d->_[loc], sizeof(void*)*stride);
 #endif
-			dir->unlock();
+			d->unlock();
+			segments.inc();
 #ifdef INPLACE
 			s[0]->local_depth++;
 			clflush((char*)&s[0]->local_depth, sizeof(size_t));
@@ -280,25 +319,156 @@ RETRY:
 #endif
 		}
 	}
+#ifndef INPLACE
+	/* replaced by both halves, stays suspended so stale writers retry */
+	epoch.retire(target);
+#endif
+	delete [] s;
 	std::this_thread::yield();
 	goto RETRY;
 }
 
+/*
+ * Puts @key into the probing window of @target, locked by the caller, and
+ * returns false if the window is full. The pair written is left to the
+ * caller to flush, at *@line.
+ */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::place(Segment* target, size_t pattern, Key_t& key, Value_t value, size_t key_hash, char** line) {
+	auto y = Segment::bucket(key_hash);
+	for(unsigned i=0; i<Segment::kProbeDistance; ++i){
+		auto loc = (y + i) % Segment::kNumSlot;
+		auto _key = target->_[loc].key;
+		/* validity check for entry keys */
+		// pattern이 일치하지 않거나, INVALID한 곳에 새로운 key value를 추가할 수 있음.
+		// SENTINEL 인 곳에는 추가 불가.
+		if(
+				(
+					((Hash::hash(target->_[loc].key) >> (8*sizeof(key_hash)-target->local_depth)) != pattern) 
+					|| (target->_[loc].key == INVALID)
+//					|| (target->_[loc].key == _key) /* Overwrite */
+				) 
+				&& (target->_[loc].key != SENTINEL)
+		  ){
+			// 아래 CAS가 무슨 의미?
+			if(CAS(&target->_[loc].key, &_key, SENTINEL)){
+				target->_[loc].value = value;
+				if (FingerprintBits) {
+					target->set_fp(loc, Segment::tag(key_hash));
+					clflush(target->fp_addr(loc), FingerprintBits/8);
+				}
+				mfence();
+				target->_[loc].key = key;
+				*line = (char*)&target->_[loc];
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Keys are sorted by hash, so keys of one segment are adjacent and keep
+ * their order, and the buckets are prefetched before the first lock.
+ * Each segment is then locked once for its run of keys and the pairs
+ * written are flushed behind one pair of fences. Keys whose window is
+ * full go through Insert() afterwards, which splits the segment.
+ */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+void CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::InsertBatch(Key_t* keys, Value_t* values, Key_t* evicted, size_t n) {
+	EpochManager::Guard g(epoch);
+	for (size_t off = 0; off < n; off += kMaxBatch) {
+		auto m = min(n - off, kMaxBatch);
+		size_t hashes[kMaxBatch];
+		unsigned order[kMaxBatch];
+		/* directory entries first, then the buckets behind them */
+		auto d = dir;
+		for (size_t i = 0; i < m; ++i) {
+			hashes[i] = Hash::hash(keys[off + i]);
+			order[i] = i;
+			__builtin_prefetch(&d->_[hashes[i] >> (8*sizeof(size_t) - d->depth)]);
+		}
+		for (size_t i = 0; i < m; ++i) {
+			auto target = d->_[hashes[i] >> (8*sizeof(size_t) - d->depth)];
+			__builtin_prefetch(&target->_[Segment::bucket(hashes[i])], 1);
+		}
+		sort(order, order + m, [&hashes](unsigned a, unsigned b) {
+			return hashes[a] < hashes[b] || (hashes[a] == hashes[b] && a < b);
+		});
+
+		unsigned full[kMaxBatch];
+		size_t nr_full = 0;
+		size_t b = 0;
+		while (b < m) {
+			/*
+			 * A locked segment cannot split, so while the directory is
+			 * the same one, the keys it maps to target belong there.
+			 */
+			d = dir;
+			auto dir_depth = d->depth;
+			auto x = (hashes[order[b]] >> (8*sizeof(size_t) - dir_depth));
+			auto target = d->_[x];
+
+			/* acquire segment exclusive lock */
+			if(!target->lock()){
+				std::this_thread::yield();
+				continue;
+			}
+			if(d != dir || target != d->_[x]){
+				target->unlock();
+				std::this_thread::yield();
+				continue;
+			}
+
+			auto pattern = (x >> (dir_depth - target->local_depth));
+			char* lines[kMaxBatch];
+			size_t nr_lines = 0;
+			for (; b < m && d->_[hashes[order[b]] >> (8*sizeof(size_t) - dir_depth)] == target; ++b) {
+				auto i = order[b];
+				if (place(target, pattern, keys[off + i], values[off + i], hashes[i], &lines[nr_lines])) {
+					evicted[off + i] = -1;
+					++nr_lines;
+				} else {
+					full[nr_full++] = i;
+				}
+			}
+			clflush_lines(lines, nr_lines);
+			/* release segment exclusive lock */
+			target->unlock();
+			for (size_t i = 0; i < nr_lines; ++i)
+				elements.inc();
+		}
+
+		for (size_t f = 0; f < nr_full; ++f) {
+			auto i = off + full[f];
+			evicted[i] = Insert(keys[i], values[i]);
+		}
+	}
+}
+
 // This function does not allow resizing
-bool CCEH::InsertOnly(Key_t& key, Value_t value) {
-	auto key_hash = h(&key, sizeof(key));
-	auto x = (key_hash >> (8*sizeof(key_hash)-dir->depth));
-	auto y = (key_hash & kMask) * kNumPairPerCacheLine;
-
-	auto target = dir->_[x];
-	auto pattern = (x >> (dir->depth - target->local_depth));
-	for(unsigned i=0; i<kNumPairPerCacheLine * kNumCacheLine; ++i){
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::InsertOnly(Key_t& key, Value_t value) {
+	auto key_hash = Hash::hash(key);
+	EpochManager::Guard g(epoch);
+	auto d = dir;
+	auto x = (key_hash >> (8*sizeof(key_hash)-d->depth));
+	auto y = Segment::bucket(key_hash);
+
+	auto target = d->_[x];
+	auto pattern = (x >> (d->depth - target->local_depth));
+	for(unsigned i=0; i<Segment::kProbeDistance; ++i){
 		auto loc = (y + i) % Segment::kNumSlot;
-		if(((h(&target->_[loc].key, sizeof(Key_t)) >> (8*sizeof(key_hash) - target->local_depth)) != pattern) || (target->_[loc].key == INVALID)){
+		if(((Hash::hash(target->_[loc].key) >> (8*sizeof(key_hash) - target->local_depth)) != pattern) || (target->_[loc].key == INVALID)){
 			target->_[loc].value = value;
+			if (FingerprintBits) {
+				target->set_fp(loc, Segment::tag(key_hash));
+				clflush(target->fp_addr(loc), FingerprintBits/8);
+			}
 			mfence();
 			target->_[loc].key = key;
 			clflush((char*)&target->_[loc], sizeof(Pair));
+			elements.inc();
 			return true;
 		}
 	}
@@ -306,7 +476,8 @@ bool CCEH::InsertOnly(Key_t& key, Value_t value) {
 }
 
 // [ key, pointer to Extent ]
-void CCEH::Insert_extent(Key_t key, uint64_t cluster_num,  uint64_t len, Value_t value){
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+void CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Insert_extent(Key_t key, uint64_t cluster_num,  uint64_t len, Value_t value){
 	if (len <= 0) return;
 	uint64_t subextent_size = 0;
 	uint64_t order = 0;
@@ -330,19 +501,65 @@ void CCEH::Insert_extent(Key_t key, uint64_t cluster_num,  uint64_t len, Value_t
 	return;
 }
 
-Value_t CCEH::Get(Key_t& key) {
-	auto key_hash = h(&key, sizeof(key));
-	auto y = (key_hash & kMask) * kNumPairPerCacheLine;
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+Value_t CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Get(Key_t& key) {
+	return lookup(key, Hash::hash(key));
+}
+
+/* lookups interleaved by amac_run, so their directory and segment misses overlap */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+void CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::GetBatch(Key_t* keys, Value_t* values, size_t n) {
+	EpochManager::Guard g(epoch);
+	for (size_t off = 0; off < n; off += kMaxBatch) {
+		auto m = min(n - off, kMaxBatch);
+		Lookup ops[kMaxBatch];
+		for (size_t i = 0; i < m; ++i)
+			ops[i] = {this, &keys[off + i], &values[off + i], 0, nullptr, 0, 0};
+		amac_run(ops, m);
+	}
+}
+
+/*
+ * Prefetches go through the directory seen in the first step. If it is
+ * replaced meanwhile, the probe in lookup() still reads the current one.
+ */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Lookup::step(void) {
+	switch (stage++) {
+		case 0:
+			key_hash = Hash::hash(*key);
+			dir = table->dir;
+			x = (key_hash >> (8*sizeof(key_hash) - dir->depth));
+			__builtin_prefetch(&dir->_[x]);
+			return false;
+		case 1: {
+			auto target = dir->_[x];
+			auto y = Segment::bucket(key_hash);
+			__builtin_prefetch(&target->_[y]);
+			if (FingerprintBits)
+				__builtin_prefetch(target->fp_addr(y));
+			return false;
+		}
+		default:
+			*value = table->lookup(*key, key_hash);
+			return true;
+	}
+}
+
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+Value_t CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::lookup(Key_t& key, size_t key_hash) {
+	auto y = Segment::bucket(key_hash);
+	EpochManager::Guard g(epoch);
 
 RETRY:
 	while(dir->sema < 0){
 		asm("nop");
 	}
 
-	auto dir_depth = dir->depth;
-	auto x = (key_hash >> (8*sizeof(key_hash) - dir_depth)); 
-	auto target = dir->_[x];
-
+	/* depth and entries from one directory, halving may swap in a smaller one */
+	auto d = dir;
+	auto x = (key_hash >> (8*sizeof(key_hash) - d->depth)); 
+	auto target = d->_[x];
 
 #ifdef INPLACE
 	/* acquire segment shared lock */
@@ -352,16 +569,17 @@ RETRY:
 	}
 #endif
 	/* release directory entry shared lock */
-	auto target_check = (key_hash >> (8*sizeof(key_hash) - dir_depth));
-	if(target != dir->_[target_check]){
+	if(d != dir || target != d->_[x]){
+#ifdef INPLACE
 		target->unlock();
+#endif
 		std::this_thread::yield();
 		goto RETRY;
 	}
 
-	for (unsigned i = 0; i < kNumPairPerCacheLine * kNumCacheLine; ++i) {
+	for (unsigned i = 0; i < Segment::kProbeDistance; ++i) {
 		auto loc = (y+i) % Segment::kNumSlot;
-		if (target->_[loc].key == key) {
+		if (target->match_fp(loc, Segment::tag(key_hash)) && target->_[loc].key == key) {
 			Value_t v = target->_[loc].value;
 #ifdef INPLACE
 			/* key found, relese segment shared lock */
@@ -378,7 +596,8 @@ RETRY:
 	return NONE;
 }
 
-Value_t CCEH::Get_extent(Key_t& key, uint64_t cluster_num){
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+Value_t CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Get_extent(Key_t& key, uint64_t cluster_num){
 	Key_t current_key = key + cluster_num;
 	unsigned int mask = (1 << __builtin_ctz(current_key));
 	while(true) {
@@ -392,12 +611,270 @@ Value_t CCEH::Get_extent(Key_t& key, uint64_t cluster_num){
 
 
 
-// TODO
-bool CCEH::Delete(Key_t& key) {
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Delete(Key_t& key) {
+	auto key_hash = Hash::hash(key);
+	auto y = Segment::bucket(key_hash);
+	EpochManager::Guard g(epoch);
+
+RETRY:
+	auto d = dir;
+	auto dir_depth = d->depth;
+	auto x = (key_hash >> (8*sizeof(key_hash) - dir_depth));
+	auto target = d->_[x];
+
+	/* shared lock keeps split and merge away while the slot is cleared */
+	if(!target->lock()){
+		std::this_thread::yield();
+		goto RETRY;
+	}
+
+	if(d != dir || target != d->_[x]){
+		target->unlock();
+		std::this_thread::yield();
+		goto RETRY;
+	}
+
+	auto pattern = (x >> (dir_depth - target->local_depth));
+	for (unsigned i = 0; i < Segment::kProbeDistance; ++i) {
+		auto loc = (y+i) % Segment::kNumSlot;
+		Key_t _key = key;
+		if (target->match_fp(loc, Segment::tag(key_hash))
+				&& target->_[loc].key == key
+				&& (Hash::hash(target->_[loc].key) >> (8*sizeof(key_hash) - target->local_depth)) == pattern
+				&& CAS(&target->_[loc].key, &_key, INVALID)) {
+			clflush((char*)&target->_[loc], sizeof(Pair));
+			target->unlock();
+			elements.dec();
+			if (!deleted.load(std::memory_order_relaxed))
+				deleted.store(true, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	target->unlock();
 	return false;
 }
 
-bool CCEH::Recovery(void) {
+/*
+ * Merge the segment at directory index @i with its buddy when both are at
+ * the same local depth and their valid entries fit into one segment.
+ * Readers are never blocked: the merged segment is published by rewriting
+ * the directory entries and the old ones are retired to the epoch.
+ */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::merge(size_t i) {
+	EpochManager::Guard g(epoch);
+	auto d = dir;
+	if (i >= d->capacity)
+		return false;
+
+	auto target = d->_[i];
+	auto depth = target->local_depth;
+	if (depth <= min_depth || depth > d->depth)
+		return false;
+
+	size_t stride = (size_t)1 << (d->depth - depth);
+	size_t base = i - (i % stride);
+	size_t buddy_base = base ^ stride;
+	auto buddy = d->_[buddy_base];
+	if (buddy == target || buddy->local_depth != depth)
+		return false;
+
+	auto pattern = base >> (d->depth - depth);
+	auto buddy_pattern = buddy_base >> (d->depth - depth);
+	if (target->numValid(pattern) + buddy->numValid(buddy_pattern) > Segment::kNumSlot * kMergeThreshold)
+		return false;
+
+	/* take both segments exclusively, always in address order */
+	Segment* first = target < buddy ? target : buddy;
+	Segment* second = target < buddy ? buddy : target;
+	if (!first->suspend())
+		return false;
+	if (!second->suspend()) {
+		first->sema = 0;
+		return false;
+	}
+
+	/* somebody split or merged them before we got the locks */
+	if (d != dir || d->_[base] != target || d->_[buddy_base] != buddy
+			|| target->local_depth != depth || buddy->local_depth != depth) {
+		second->sema = 0;
+		first->sema = 0;
+		return false;
+	}
+
+	auto merged = new Segment(depth-1);
+	bool fit = true;
+	Segment* src[2] = {target, buddy};
+	size_t pat[2] = {pattern, buddy_pattern};
+	for (int s = 0; s < 2 && fit; ++s) {
+		for (unsigned j = 0; j < Segment::kNumSlot; ++j) {
+			auto& p = src[s]->_[j];
+			if (p.key == INVALID || p.key == SENTINEL)
+				continue;
+			auto key_hash = Hash::hash(p.key);
+			if ((key_hash >> (8*sizeof(key_hash) - depth)) != pat[s])
+				continue;
+			if (!merged->Insert4merge(p.key, p.value, key_hash)) {
+				fit = false;
+				break;
+			}
+		}
+	}
+
+	if (!fit || !d->lock()) {
+		delete merged;
+		second->sema = 0;
+		first->sema = 0;
+		return false;
+	}
+
+	/* directory was swapped while we were copying */
+	if (d != dir) {
+		d->unlock();
+		delete merged;
+		second->sema = 0;
+		first->sema = 0;
+		return false;
+	}
+
+	clflush((char*)merged, sizeof(Segment));
+
+	auto loc = base < buddy_base ? base : buddy_base;
+	for (size_t j = 0; j < 2*stride; ++j) {
+		d->_[loc+j] = merged;
+	}
+	clflush((char*)&d->_[loc], sizeof(void*)*2*stride);
+	d->unlock();
+
+	/* old segments stay suspended so stale writers retry on the new one */
+	epoch.retire(target);
+	epoch.retire(buddy);
+	segments.dec();
+	return true;
+}
+
+/*
+ * Halve the directory once no segment uses the highest directory bit.
+ * Same copy-on-write protocol as doubling, so readers keep going.
+ */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::halve(void) {
+	EpochManager::Guard g(epoch);
+	auto d = dir;
+	if (d->depth <= min_depth)
+		return false;
+
+	for (size_t i = 0; i < d->capacity; ++i) {
+		if (d->_[i]->local_depth >= d->depth)
+			return false;
+	}
+
+	if (!d->suspend())
+		return false;
+
+	/*
+	 * A split may have raced in before the suspend. A suspended segment may
+	 * also be in the middle of a split that compared its depth with this
+	 * directory's, leave the directory alone until it is done.
+	 */
+	for (size_t i = 0; i < d->capacity; ++i) {
+		if (d->_[i]->local_depth >= d->depth || d->_[i]->sema < 0) {
+			d->sema = 0;
+			return false;
+		}
+	}
+
+	auto _dir = new Directory(d->depth-1);
+	for (size_t i = 0; i < _dir->capacity; ++i) {
+		_dir->_[i] = d->_[2*i];
+	}
+	clflush((char*)&_dir->_[0], sizeof(Segment*)*_dir->capacity);
+	clflush((char*)_dir, sizeof(Directory));
+	dir = _dir;
+	clflush((char*)&dir, sizeof(void*));
+
+	epoch.retire(d);
+	return true;
+}
+
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+void CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Shrink(void) {
+	for (size_t i = 0; ; ) {
+		EpochManager::Guard g(epoch);
+		auto d = dir;
+		if (i >= d->capacity)
+			break;
+		auto depth = d->_[i]->local_depth;
+		size_t stride = (size_t)1 << (d->depth - (depth < d->depth ? depth : d->depth));
+		/* only visit each buddy pair once, from its left half */
+		if ((i / stride) % 2 == 0 && merge(i))
+			stride *= 2;
+		i += stride;
+	}
+
+	while (halve());
+}
+
+/* a pass walks every segment, so only tables with deletes since the last one get it */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+void CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::StartShrinker(void) {
+	if (shrinking)
+		return;
+	shrinking = true;
+	CCEHShrinker::Get().Add(this, [this] {
+		if (deleted.exchange(false))
+			Shrink();
+	});
+}
+
+CCEHShrinker& CCEHShrinker::Get(void) {
+	static CCEHShrinker shrinker;
+	return shrinker;
+}
+
+CCEHShrinker::~CCEHShrinker(void) {
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		stop = true;
+	}
+	cv.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+void CCEHShrinker::Add(void* table, std::function<void(void)> shrink) {
+	std::lock_guard<std::mutex> lk(lock);
+	tables.emplace_back(table, std::move(shrink));
+	if (!thread.joinable())
+		thread = std::thread(&CCEHShrinker::run, this);
+}
+
+void CCEHShrinker::Remove(void* table) {
+	/* a pass runs under the lock, so none is left on @table after this */
+	std::lock_guard<std::mutex> lk(lock);
+	for (size_t i = 0; i < tables.size(); ++i) {
+		if (tables[i].first == table) {
+			tables.erase(tables.begin() + i);
+			break;
+		}
+	}
+}
+
+void CCEHShrinker::run(void) {
+	std::unique_lock<std::mutex> lk(lock);
+	while (!stop) {
+		cv.wait_for(lk, kShrinkInterval, [this] { return stop; });
+		if (stop)
+			break;
+		for (auto& t : tables)
+			t.second();
+	}
+}
+
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+bool CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Recovery(void) {
 	bool recovered = false;
 	size_t i = 0;
 	while (i < dir->capacity) {
@@ -418,32 +895,18 @@ bool CCEH::Recovery(void) {
 	return recovered;
 }
 
-double CCEH::Utilization(void){
-	size_t sum = 0;
-	size_t cnt = 0;
-	for(size_t i=0; i<dir->capacity; cnt++){
-		auto target = dir->_[i];
-		auto pattern = (i >> (dir->depth - target->local_depth));
-		for(unsigned j=0; j<Segment::kNumSlot; ++j){
-			auto key_hash = h(&target->_[j].key, sizeof(Key_t));
-			if(((key_hash >> (8*sizeof(key_hash)-target->local_depth)) == pattern) && (target->_[j].key != INVALID)){
-				sum++;
-			}
-		}
-		i += pow(2, dir->depth - target->local_depth); 
-	}
-	return ((double)sum) / ((double)cnt * Segment::kNumSlot)*100.0;
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+double CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Utilization(void){
+	return ((double)elements.read()) / ((double)Capacity())*100.0;
 }
 
-size_t CCEH::Capacity(void) {
-	std::unordered_map<Segment*, bool> set;
-	for (size_t i = 0; i < dir->capacity; ++i) {
-		set[dir->_[i]] = true;
-	}
-	return set.size() * Segment::kNumSlot;
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+size_t CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::Capacity(void) {
+	return segments.read() * Segment::kNumSlot;
 }
 
-size_t Segment::numElem(void) {
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+size_t SegmentT<SegmentBits, ProbeLines, FingerprintBits, Hash>::numElem(void) {
 	size_t sum = 0;
 	for (unsigned i = 0; i < kNumSlot; ++i) {
 		if (_[i].key != INVALID) {
@@ -453,19 +916,54 @@ size_t Segment::numElem(void) {
 	return sum;
 }
 
+/* number of live entries that belong to this segment under @pattern */
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+size_t SegmentT<SegmentBits, ProbeLines, FingerprintBits, Hash>::numValid(size_t pattern) {
+	size_t sum = 0;
+	for (unsigned i = 0; i < kNumSlot; ++i) {
+		if (_[i].key == INVALID || _[i].key == SENTINEL)
+			continue;
+		auto key_hash = Hash::hash(_[i].key);
+		if ((key_hash >> (8*sizeof(key_hash) - local_depth)) == pattern)
+			sum++;
+	}
+	return sum;
+}
+
 // for debugging
-Value_t CCEH::FindAnyway(Key_t& key) {
+template <size_t SegmentBits, size_t ProbeLines, size_t FingerprintBits, class Hash>
+Value_t CCEHT<SegmentBits, ProbeLines, FingerprintBits, Hash>::FindAnyway(Key_t& key) {
 	using namespace std;
-	for (size_t i = 0; i < dir->capacity; ++i) {
+	EpochManager::Guard g(epoch);
+	auto d = dir;
+	for (size_t i = 0; i < d->capacity; ++i) {
 		for (size_t j = 0; j < Segment::kNumSlot; ++j) {
-			if (dir->_[i]->_[j].key == key) {
+			if (d->_[i]->_[j].key == key) {
 				cout << "segment(" << i << ")" << endl;
-				cout << "global_depth(" << dir->depth << "), local_depth(" << dir->_[i]->local_depth << ")" << endl;
-				cout << "pattern: " << bitset<sizeof(int64_t)>(i >> (dir->depth - dir->_[i]->local_depth)) << endl;
-				cout << "Key MSB: " << bitset<sizeof(int64_t)>(h(&key, sizeof(key)) >> (8*sizeof(key) - dir->_[i]->local_depth)) << endl;
-				return dir->_[i]->_[j].value;
+				cout << "global_depth(" << d->depth << "), local_depth(" << d->_[i]->local_depth << ")" << endl;
+				cout << "pattern: " << bitset<sizeof(int64_t)>(i >> (d->depth - d->_[i]->local_depth)) << endl;
+				cout << "Key MSB: " << bitset<sizeof(int64_t)>(Hash::hash(key) >> (8*sizeof(key) - d->_[i]->local_depth)) << endl;
+				return d->_[i]->_[j].value;
 			}
 		}
 	}
 	return NONE;
 }
+
+/* geometries selectable by name, see KV.cpp */
+template class CCEHT<8, 8, 0>;		// default
+template class CCEHT<6, 4, 0>;		// small
+template class CCEHT<10, 16, 0>;	// large
+template class CCEHT<8, 8, 8>;		// fp8
+template class CCEHT<8, 8, 16>;		// fp16
+template class CCEHT<10, 16, 8>;	// large-fp8
+
+/* the default geometry under every policy, to compare them in one binary */
+template class CCEHT<8, 8, 0, StdHash>;
+template class CCEHT<8, 8, 0, Crc32cHash>;
+template class CCEHT<8, 8, 0, Xxh3Hash>;
+template class CCEHT<8, 8, 0, WyHash>;
+
+const char* CCEHGeometries(void) {
+	return "default, small, large, fp8, fp16, large-fp8";
+}
@@ -6,30 +6,101 @@
 #include <vector>
 #include <pthread.h>
 #include <iostream>
-
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "util/epoch.h"
+#include "util/hash_policy.h"
 #include "util/pair.h"
+#include "util/sharded_counter.h"
 #include "IHash.h"
 #include "variables.h"
 
-constexpr size_t kSegmentBits = 8;
-constexpr size_t kMask = (1 << kSegmentBits)-1;
-constexpr size_t kShift = kSegmentBits;
-constexpr size_t kSegmentSize = (1 << kSegmentBits) * 16 * 4; // 2**kSegmentBits * Pair * Bucket Size
 constexpr size_t kNumPairPerCacheLine = 4;
-constexpr size_t kNumCacheLine = 8;
+/* buddy segments are merged when both fit in a quarter of one segment */
+constexpr double kMergeThreshold = 0.25;
+constexpr auto kShrinkInterval = std::chrono::seconds(10);
+
+/*
+ * One background thread shrinking every CCEH that asked for it
+ * (CCEHT::StartShrinker), a Shrink() pass each kShrinkInterval per table
+ * that lost keys since its last pass.
+ * The thread starts with the first table; Remove() waits for a running
+ * pass, so a table can be destroyed right after.
+ */
+class CCEHShrinker {
+  public:
+    static CCEHShrinker& Get(void);
+    ~CCEHShrinker(void);
+
+    void Add(void* table, std::function<void(void)> shrink);
+    void Remove(void* table);
+
+  private:
+    void run(void);
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<std::pair<void*, std::function<void(void)>>> tables;
+    std::thread thread;
+    bool stop = false;
+};
+
+/*
+ * Per-slot fingerprints kept in front of the pairs, so a probe touches the
+ * compact tag array first and only reads keys whose tag matches.
+ * FingerprintBits == 0 disables them (empty base, no space overhead).
+ */
+template <size_t FingerprintBits, size_t NumSlot>
+struct Fingerprints {
+  using fp_t = typename std::conditional<(FingerprintBits <= 8), uint8_t, uint16_t>::type;
+  static constexpr fp_t kFpMask = (fp_t)((1UL << FingerprintBits) - 1);
+
+  void set_fp(size_t loc, size_t tag) { fp[loc] = (fp_t)tag & kFpMask; }
+  bool match_fp(size_t loc, size_t tag) const { return fp[loc] == ((fp_t)tag & kFpMask); }
+  char* fp_addr(size_t loc) { return (char*)&fp[loc]; }
+
+  fp_t fp[NumSlot];
+};
 
-struct Segment {
-  static const size_t kNumSlot = kSegmentSize/sizeof(Pair);  // 2**kSegmentBits * Bucket Size  per Segment
+template <size_t NumSlot>
+struct Fingerprints<0, NumSlot> {
+  void set_fp(size_t, size_t) { }
+  bool match_fp(size_t, size_t) const { return true; }
+  char* fp_addr(size_t) { return nullptr; }
+};
+
+template <size_t SegmentBits = 8, size_t ProbeLines = 8, size_t FingerprintBits = 0, class Hash = DefaultHash>
+struct SegmentT : public Fingerprints<FingerprintBits, (1 << SegmentBits) * kNumPairPerCacheLine> {
+  static_assert(FingerprintBits <= 16, "fingerprints are at most 16 bits");
+
+  static constexpr size_t kSegmentBits = SegmentBits;
+  static constexpr size_t kMask = (1 << kSegmentBits)-1;
+  static constexpr size_t kShift = kSegmentBits;
+  static constexpr size_t kSegmentSize = (1 << kSegmentBits) * 16 * 4; // 2**kSegmentBits * Pair * Bucket Size
+  static constexpr size_t kNumCacheLine = ProbeLines;
+  static constexpr size_t kNumSlot = kSegmentSize/sizeof(Pair);  // 2**kSegmentBits * Bucket Size  per Segment
+  static constexpr size_t kProbeDistance = kNumPairPerCacheLine * kNumCacheLine;
+  static constexpr size_t kFingerprintBits = FingerprintBits;
 
-  Segment(void)
+  /* fingerprint uses hash bits above the bucket index */
+  static size_t tag(size_t key_hash) { return key_hash >> kSegmentBits; }
+  static size_t bucket(size_t key_hash) { return (key_hash & kMask) * kNumPairPerCacheLine; }
+
+  SegmentT(void)
   : local_depth{0}
   {  }
 
-  Segment(size_t depth)
+  SegmentT(size_t depth)
   :local_depth{depth}
   {  }
 
-  ~Segment(void) {  }
+  ~SegmentT(void) {  }
 
   bool suspend(void){
       int64_t val;
@@ -75,25 +146,30 @@ struct Segment {
 	if (posix_memalign(&ret, 64, size) ) ret=NULL;
     return ret;
   }
+  void operator delete(void* p) { free(p); }
 
   void* operator new[](size_t size) {
     void* ret;
 	if (posix_memalign(&ret, 64, size) ) ret=NULL;
     return ret;
   }
+  void operator delete[](void* p) { free(p); }
 
   int Insert(Key_t&, Value_t, size_t, size_t);
   void Insert4split(Key_t&, Value_t, size_t);
+  bool Insert4merge(Key_t&, Value_t, size_t);
   bool Put(Key_t&, Value_t, size_t);
-  Segment** Split(void);
-  size_t numElem(void); 
+  SegmentT** Split(void);
+  size_t numElem(void);
+  size_t numValid(size_t);
 
   Pair _[kNumSlot];
   int64_t sema = 0;
   size_t local_depth;
 };
 
-struct Directory {
+template <class Segment>
+struct DirectoryT {
   static const size_t kDefaultDepth = 10;
   Segment** _;
   int64_t sema = 0;
@@ -139,21 +215,21 @@ struct Directory {
       }
   }
 
-  Directory(void) {
+  DirectoryT(void) {
     depth = kDefaultDepth;
     capacity = pow(2, depth);
     _ = new Segment*[capacity];
     sema = 0;
   }
 
-  Directory(size_t _depth) {
+  DirectoryT(size_t _depth) {
     depth = _depth;
     capacity = pow(2, depth);
     _ = new Segment*[capacity];
     sema = 0;
   }
 
-  ~Directory(void) {
+  ~DirectoryT(void) {
     delete [] _;
   }
 
@@ -161,11 +237,21 @@ struct Directory {
   void LSBUpdate(int, int, int, int, Segment**);
 };
 
-class CCEH : public IHash {
+/*
+ * @SegmentBits: log2 of buckets (cache lines) per segment
+ * @ProbeLines: cache lines probed for a key
+ * @FingerprintBits: 0 (off), 8 or 16 bit per-slot fingerprints
+ * @Hash: hash policy (util/hash_policy.h), inlined into every probe
+ */
+template <size_t SegmentBits = 8, size_t ProbeLines = 8, size_t FingerprintBits = 0, class Hash = DefaultHash>
+class CCEHT final : public IHash {
   public:
-    CCEH(void);
-    CCEH(size_t);
-    ~CCEH(void);
+    using Segment = SegmentT<SegmentBits, ProbeLines, FingerprintBits, Hash>;
+    using Directory = DirectoryT<Segment>;
+
+    CCEHT(void);
+    CCEHT(size_t);
+    ~CCEHT(void);
 
 	Key_t Insert(Key_t&, Value_t);
     bool InsertOnly(Key_t&, Value_t);
@@ -174,6 +260,9 @@ class CCEH : public IHash {
     double Utilization(void);
     size_t Capacity(void);
 
+    void InsertBatch(Key_t*, Value_t*, Key_t*, size_t);
+    void GetBatch(Key_t*, Value_t*, size_t);
+
 	void Insert_extent(Key_t, uint64_t, uint64_t, Value_t);
 	Value_t Get_extent(Key_t&, uint64_t);
     Value_t FindAnyway(Key_t&);
@@ -184,14 +273,71 @@ class CCEH : public IHash {
 	std::vector<unsigned> Freqs(void);
 	std::vector<double> Metrics(void);
 
+	/* one merge/halving pass, also run after deletes once StartShrinker is called */
+	void Shrink(void);
+	void StartShrinker(void);
+	size_t Depth(void) { EpochManager::Guard g(epoch); return dir->depth; }
+
 	void* operator new(size_t size) {
 		void *ret;
 		if (posix_memalign(&ret, 64, size) ) ret=NULL;
 		return ret;
 	}
+	void operator delete(void* p) { free(p); }
 
   private:
+    bool place(Segment*, size_t, Key_t&, Value_t, size_t, char**);
+    Value_t lookup(Key_t&, size_t);
+
+    /*
+     * GetBatch state machine (util/amac.h), one miss per step: the
+     * directory entry, the bucket in the segment, then the probe.
+     */
+    struct Lookup {
+      CCEHT* table;
+      Key_t* key;
+      Value_t* value;
+      size_t key_hash;
+      Directory* dir;
+      size_t x;
+      int stage;
+
+      bool step(void);
+    };
+    bool merge(size_t);
+    bool halve(void);
+
     Directory* dir;
+    /* never shrink below the initial global depth */
+    size_t min_depth;
+
+    /* live entries and live segments, so stats never walk the table */
+    ShardedCounter elements;
+    ShardedCounter segments;
+
+    bool shrinking = false;
+    /* set by Delete, cleared by the shrinker pass it triggers */
+    std::atomic<bool> deleted{false};
+    /*
+     * Every operation runs in a Guard, so segments replaced by a split or
+     * merge and directories replaced by doubling or halving are freed
+     * once the lock-free readers that may still be in them have left.
+     */
+    EpochManager epoch;
 };
 
+/* the original geometry: 256 buckets per segment, 8 cache line probing */
+using Segment = SegmentT<>;
+using Directory = DirectoryT<Segment>;
+using CCEH = CCEHT<>;
+
+/*
+ * Geometries instantiated in cceh.cpp, selectable by name at runtime (KV.cpp):
+ *   default <8,8,0>  small <6,4,0>  large <10,16,0>
+ *   fp8     <8,8,8>  fp16  <8,8,16> large-fp8 <10,16,8>
+ * all with DefaultHash; the default one also with each policy of
+ * util/hash_policy.h, e.g. CCEHT<8, 8, 0, WyHash>.
+ */
+const char* CCEHGeometries(void);
+
 #endif  // EXTENDIBLE_PTR_H_
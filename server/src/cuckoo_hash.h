@@ -9,7 +9,7 @@
 #include "util/pair.h"
 #include "IHash.h"
 
-class CuckooHash : public IHash {
+class CuckooHash final : public IHash {
   size_t _seed = 0xc70f6907UL;
   const size_t kCuckooThreshold = 16;
   const size_t kNumHash = 2;
@@ -2,24 +2,26 @@
 #include <cstring>
 #include <thread>
 #include <mutex>
-#include <shared_mutex>
 #include "util/persist.h"
-#include "util/hash.h"
+#include "util/hash_policy.h"
 #include "cuckoo_probing.h"
 
 CuckooProbingHash::CuckooProbingHash(void)
 	: capacity{0}, dict{nullptr} { }
 
 CuckooProbingHash::CuckooProbingHash(size_t _capacity)
-	: capacity{_capacity}, dict{new Pair[capacity]}
 {
 	locksize = 16;
+	/* whole clusters only, so the last one never runs off the table */
+	capacity = (_capacity + locksize - 1) / locksize * locksize;
+	dict = new Pair[capacity];
 	nlocks = (capacity)/locksize+1;
-	mutex = new std::shared_mutex[nlocks];
+	locks = new VersionLock[nlocks];
 }
 
 CuckooProbingHash::~CuckooProbingHash(void) {
 	if (dict != nullptr) delete[] dict;
+	delete[] locks;
 }
 
 
@@ -33,25 +35,34 @@ CuckooProbingHash::~CuckooProbingHash(void) {
  */
 Key_t CuckooProbingHash::Insert(Key_t& key, Value_t value) {
 	using namespace std;
-	auto key_hash = h(&key, sizeof(key));
+	auto key_hash = DefaultHash::hash(key);
 
 	auto slot = key_hash % capacity;
 	auto off = slot % locksize;
 	auto firstIndex = slot - off;
-	unique_lock<shared_mutex> lock(mutex[slot/locksize]);
+
+	/*
+	 * A cuckoo move writes the second cluster too, so lock both
+	 * up front in index order.
+	 */
+	auto next_hash = DefaultHash::hash(key, 951125);
+	size_t c[2] = { slot/locksize, (next_hash % capacity)/locksize };
+	if (c[0] > c[1]) swap(c[0], c[1]);
+	lock_guard<VersionLock> lock0(locks[c[0]]);
+	unique_lock<VersionLock> lock1(locks[c[1]], defer_lock);
+	if (c[1] != c[0]) lock1.lock();
+
 	for ( int j = 0 ; j < locksize - 1; j++ ) {
 		slot = firstIndex + j;
 
 		// if there is available slot, insert and return
 		if (dict[slot].key == INVALID || dict[slot].key == key) {
+			if (dict[slot].key == INVALID)
+				size.inc();
 			dict[slot].value = value;
 			mfence();
 			dict[slot].key = key;
 			clflush((char*)&dict[slot].key, sizeof(Pair));
-			auto _size = size;
-			while (!CAS(&size, &_size, _size+1)) {
-				_size = size;
-			}
 			return -1;
 		}
 	}
@@ -88,7 +99,6 @@ Key_t CuckooProbingHash::Insert(Key_t& key, Value_t value) {
 	clflush((char*)&dict[firstIndex].key, sizeof(Pair) * locksize);
 
 	// Check Next hash position.
-	auto next_hash = hash_funcs[0](&key, sizeof(key), 951125);
 	slot = next_hash % capacity;
 	off = slot % locksize;
 	firstIndex = slot - off;
@@ -110,10 +120,7 @@ Key_t CuckooProbingHash::Insert(Key_t& key, Value_t value) {
 			mfence();
 			dict[firstIndex].value = (Value_t)((uint64_t)cuckooPair.value | cuckooBit);
 			clflush((char*)&dict[firstIndex].key, sizeof(Pair) * locksize);
-			auto _size = size;
-			while (!CAS(&size, &_size, _size+1)) {
-				_size = size;
-			}
+			size.inc();
 
 			return -1;
 		}
@@ -130,7 +137,7 @@ Key_t CuckooProbingHash::Insert(Key_t& key, Value_t value) {
 }
 
 bool CuckooProbingHash::InsertOnly(Key_t& key, Value_t value) {
-	auto key_hash = h(&key, sizeof(key)) % capacity;
+	auto key_hash = DefaultHash::hash(key) % capacity;
 	auto loc = getLocation(key_hash, capacity, dict);
 	if (loc == INVALID) {
 		return false;
@@ -139,42 +146,68 @@ bool CuckooProbingHash::InsertOnly(Key_t& key, Value_t value) {
 		mfence();
 		dict[loc].key = key;
 		clflush((char*)&dict[loc], sizeof(Pair));
-		size++;
+		size.inc();
 		return true;
 	}
 }
 
 bool CuckooProbingHash::Delete(Key_t& key) {
+	size_t hashes[2] = { DefaultHash::hash(key), DefaultHash::hash(key, 951125) };
+	for (auto key_hash : hashes) {
+		auto loc = key_hash % capacity;
+		auto firstIndex = loc - (loc % locksize);
+		std::lock_guard<VersionLock> lock(locks[loc/locksize]);
+		for (int i = 0; i < locksize; ++i) {
+			auto id = firstIndex + i;
+			if (id < capacity && dict[id].key == key) {
+				dict[id].key = INVALID;
+				clflush((char*)&dict[id].key, sizeof(Key_t));
+				size.dec();
+				return true;
+			}
+		}
+	}
 	return false;
 }
 
 Value_t CuckooProbingHash::Get(Key_t& key) {
-	auto key_hash = h(&key, sizeof(key)) % capacity;
+	auto key_hash = DefaultHash::hash(key) % capacity;
 	auto loc = key_hash % capacity; // target location of key
 	auto off = loc % locksize;
 	auto firstIndex = loc - off;
-	{
-		std::shared_lock<std::shared_mutex> lock(mutex[loc/locksize]);
-		for (int i = 0; i < locksize - 1; ++i) {
-			auto id = firstIndex + i;
-			if (dict[id].key == key) return std::move(dict[id].value);
+	uint64_t version;
+FIRST:
+	version = locks[loc/locksize].read_begin();
+	for (int i = 0; i < locksize; ++i) {
+		auto id = firstIndex + i;
+		if (dict[id].key == key) {
+			auto value = dict[id].value;
+			if (!locks[loc/locksize].read_validate(version))
+				goto FIRST;
+			return value;
 		}
 	}
+	if (!locks[loc/locksize].read_validate(version))
+		goto FIRST;
 
 	// Check Next hash position.
-	auto next_hash = hash_funcs[0](&key, sizeof(key),951125);
+	auto next_hash = DefaultHash::hash(key, 951125);
 	loc = next_hash % capacity; // target location of key
 	off = loc % locksize;
 	firstIndex = loc - off;
-	{
-		std::shared_lock<std::shared_mutex> lock(mutex[loc/locksize]);
-		for (int i = 0; i < locksize - 1; ++i) {
-			auto id = firstIndex + i;
-			if (dict[id].key == key) {
-				return std::move((Value_t)((uint64_t)dict[id].value & ~cuckooBit));
-			}
+SECOND:
+	version = locks[loc/locksize].read_begin();
+	for (int i = 0; i < locksize; ++i) {
+		auto id = firstIndex + i;
+		if (dict[id].key == key) {
+			auto value = dict[id].value;
+			if (!locks[loc/locksize].read_validate(version))
+				goto SECOND;
+			return (Value_t)((uint64_t)value & ~cuckooBit);
 		}
 	}
+	if (!locks[loc/locksize].read_validate(version))
+		goto SECOND;
 
 	return NONE;
 }
@@ -191,13 +224,7 @@ Value_t CuckooProbingHash::FindAnyway(Key_t&) {
 }
 
 double CuckooProbingHash::Utilization(void) {
-	size_t size = 0;
-	for (size_t i = 0; i < capacity; ++i) {
-		if (dict[i].key != INVALID) {
-			++size;
-		}
-	}
-	return ((double)size)/((double)capacity)*100;
+	return ((double)size.read())/((double)capacity)*100;
 }
 
 size_t CuckooProbingHash::getLocation(size_t hash_value, size_t _capacity, Pair* _dict) {
@@ -220,24 +247,23 @@ FAILED:
 }
 
 void CuckooProbingHash::resize(size_t _capacity) {
-	std::unique_lock<std::shared_mutex> *lock[nlocks];
 	for(int i=0; i<nlocks; i++){
-		lock[i] = new std::unique_lock<std::shared_mutex>(mutex[i]);
+		locks[i].lock();
 	}
 	int prev_nlocks = nlocks;
 	nlocks = _capacity/locksize+1;
-	std::shared_mutex* old_mutex = mutex;
+	VersionLock* old_locks = locks;
 
 	Pair* newDict = new Pair[_capacity];
 	for (size_t i = 0; i < capacity; i++) {
 		if (dict[i].key != INVALID) {
-			auto key_hash = h(&dict[i].key, sizeof(Key_t)) % _capacity;
+			auto key_hash = DefaultHash::hash(dict[i].key) % _capacity;
 			auto loc = getLocation(key_hash, _capacity, newDict);
 			newDict[loc].key = dict[i].key;
 			newDict[loc].value = dict[i].value;
 		}
 	}
-	mutex = new std::shared_mutex[nlocks];
+	locks = new VersionLock[nlocks];
 	clflush((char*)&newDict[0], sizeof(Pair)*_capacity);
 	old_cap = capacity;
 	old_dic = dict;
@@ -255,7 +281,7 @@ void CuckooProbingHash::resize(size_t _capacity) {
 
 	delete [] tmp;
 	for(int i=0; i<prev_nlocks; i++) {
-		delete lock[i];
+		old_locks[i].unlock();
 	}
-	delete[] old_mutex;
+	delete[] old_locks;
 }
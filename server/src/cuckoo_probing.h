@@ -3,11 +3,12 @@
 
 #include <stddef.h>
 #include <mutex>
-#include <shared_mutex>
 #include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
 #include "IHash.h"
 
-class CuckooProbingHash : public IHash {
+class CuckooProbingHash final : public IHash {
 	const float kResizingFactor = 2;
 	const float kResizingThreshold = 0.95;
 	const uint64_t cuckooBit = (uint64_t)1 << 63;
@@ -38,12 +39,14 @@ class CuckooProbingHash : public IHash {
 		posix_memalign(&ret, 64, size);
 		return ret;
 	}
+	void operator delete[](void* p) { free(p); }
 
 	void* operator new(size_t size) {
 		void *ret;
 		posix_memalign(&ret, 64, size);
 		return ret;
 	}
+	void operator delete(void* p) { free(p); }
 
 	private:
 	void resize(size_t);
@@ -55,10 +58,15 @@ class CuckooProbingHash : public IHash {
 	size_t old_cap;
 	Pair* old_dic;
 
-	size_t size = 0;
+	/* live entries, updated on insert/evict/delete */
+	ShardedCounter size;
 
 	int resizing_lock = 0;
-	std::shared_mutex *mutex;
+	/*
+	 * One version lock per cluster: CAS for writers, optimistic readers.
+	 * Kept apart from dict for the reasons in linear_probing.h.
+	 */
+	VersionLock *locks;
 	int nlocks;
 	int locksize;
 };
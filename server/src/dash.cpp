@@ -0,0 +1,419 @@
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#include "util/persist.h"
+#include "util/hash_policy.h"
+#include "dash.h"
+
+using namespace std;
+using namespace dash;
+
+#define DASH_FP(key_hash) ((uint8_t)((key_hash) >> 8))
+#define DASH_SEG(key_hash, depth) ((key_hash) >> (8*sizeof(size_t) - (depth)))
+
+int Bucket::find(Key_t& key, uint8_t _fp) const {
+  uint32_t mask = bitmap;
+  while (mask) {
+    int i = __builtin_ctz(mask);
+    mask &= mask - 1;
+    if (fp[i] == _fp && _[i].key == key)
+      return i;
+  }
+  return -1;
+}
+
+/* pair first, then the bitmap bit that makes it visible after a crash */
+void Bucket::put(Key_t& key, Value_t value, uint8_t _fp) {
+  int i = free_slot();
+  _[i].value = value;
+  _[i].key = key;
+  fp[i] = _fp;
+  clflush((char*)&_[i], sizeof(Pair));
+  mfence();
+  bitmap |= (1U << i);
+  clflush((char*)this, 32);
+}
+
+void Bucket::erase(int i) {
+  bitmap &= ~(1U << i);
+  clflush((char*)this, 32);
+}
+
+/* bucket order: normal buckets ascending, then the stash */
+void Segment::lock_all(void) {
+  for (size_t i = 0; i < kNumBucket + kNumStash; ++i)
+    bucket[i].lock.lock();
+}
+
+void Segment::unlock_all(void) {
+  for (size_t i = 0; i < kNumBucket + kNumStash; ++i)
+    bucket[i].lock.unlock();
+}
+
+/*
+ * A pair keeps the bucket it had in the segment being split: the sibling
+ * gets a subset of that segment's pairs, so every bucket has room.
+ */
+void Segment::Insert4split(Key_t& key, Value_t value, size_t key_hash, size_t b) {
+  bucket[b].put(key, value, DASH_FP(key_hash));
+  if (b >= kNumBucket)
+    bucket[key_hash & kBucketMask].overflow++;
+}
+
+/* optimistic probe of one bucket */
+static Value_t probe(Bucket& b, Key_t& key, uint8_t fp) {
+  uint64_t version;
+  Value_t value;
+  do {
+    version = b.lock.read_begin();
+    int i = b.find(key, fp);
+    value = i < 0 ? NONE : b._[i].value;
+  } while (!b.lock.read_validate(version));
+  return value;
+}
+
+Dash::Dash(void)
+  : Dash(kNumBucket * kNumSlot * 2)
+{ }
+
+Dash::Dash(size_t initCap) {
+  size_t nseg = (initCap + Segment::kCapacity - 1) / Segment::kCapacity;
+  size_t depth = max((size_t)1, (size_t)ceil(log2(nseg)));
+  auto d = new Directory(depth);
+  for (size_t i = 0; i < d->capacity; ++i) {
+    d->_[i] = new Segment(depth, i);
+    segments.inc();
+  }
+  clflush((char*)&d->_[0], sizeof(Segment*)*d->capacity);
+  dir.store(d);
+}
+
+Dash::~Dash(void) {
+  auto d = dir.load();
+  size_t i = 0;
+  while (i < d->capacity) {
+    auto seg = d->_[i];
+    i += (size_t)1 << (d->depth - seg->local_depth);
+    delete seg;
+  }
+  delete d;
+}
+
+Dash::InsertResult Dash::insert(Segment* seg, Key_t& key, Value_t value, size_t key_hash) {
+  auto y = key_hash & kBucketMask;
+  auto z = (y + 1) & kBucketMask;
+  auto fp = DASH_FP(key_hash);
+  Bucket* home = &seg->bucket[y];
+  Bucket* next = &seg->bucket[z];
+
+  lock_guard<VersionLock> l0(seg->bucket[min(y, z)].lock);
+  lock_guard<VersionLock> l1(seg->bucket[max(y, z)].lock);
+  if (!seg->owns(key_hash))
+    return STALE;
+
+  // update in place
+  int i;
+  if ((i = home->find(key, fp)) >= 0) {
+    home->_[i].value = value;
+    clflush((char*)&home->_[i].value, sizeof(Value_t));
+    return UPDATED;
+  }
+  if ((i = next->find(key, fp)) >= 0) {
+    next->_[i].value = value;
+    clflush((char*)&next->_[i].value, sizeof(Value_t));
+    return UPDATED;
+  }
+  if (home->overflow) {
+    for (size_t s = kNumBucket; s < kNumBucket + kNumStash; ++s) {
+      Bucket* stash = &seg->bucket[s];
+      lock_guard<VersionLock> l(stash->lock);
+      if ((i = stash->find(key, fp)) >= 0) {
+        stash->_[i].value = value;
+        clflush((char*)&stash->_[i].value, sizeof(Value_t));
+        return UPDATED;
+      }
+    }
+  }
+
+  // balanced insert: the less loaded of the two candidates
+  Bucket* target = home->count() <= next->count() ? home : next;
+  if (!target->full()) {
+    target->put(key, value, fp);
+    return INSERTED;
+  }
+
+  for (size_t s = kNumBucket; s < kNumBucket + kNumStash; ++s) {
+    Bucket* stash = &seg->bucket[s];
+    lock_guard<VersionLock> l(stash->lock);
+    if (!stash->full()) {
+      stash->put(key, value, fp);
+      home->overflow++;
+      clflush((char*)home, 32);
+      return INSERTED;
+    }
+  }
+  return FULL;
+}
+
+Key_t Dash::Insert(Key_t& key, Value_t value) {
+  auto key_hash = DefaultHash::hash(key);
+  EpochManager::Guard g(epoch);
+RETRY:
+  auto d = dir.load(memory_order_acquire);
+  auto seg = d->_[DASH_SEG(key_hash, d->depth)];
+
+  switch (insert(seg, key, value, key_hash)) {
+    case INSERTED:
+      elements.inc();
+      return -1;
+    case UPDATED:
+      return -1;
+    case FULL:
+      split(seg, key_hash);
+      goto RETRY;
+    case STALE:
+    default:
+      goto RETRY;
+  }
+}
+
+/* caller holds dir_lock */
+void Dash::doubling(void) {
+  auto d = dir.load();
+  auto nd = new Directory(d->depth + 1);
+  for (size_t i = 0; i < d->capacity; ++i) {
+    nd->_[2*i] = d->_[i];
+    nd->_[2*i+1] = d->_[i];
+  }
+  clflush((char*)&nd->_[0], sizeof(Segment*)*nd->capacity);
+  dir.store(nd, memory_order_release);
+  clflush((char*)&dir, sizeof(void*));
+  epoch.retire(d);
+}
+
+/*
+ * Split order, so a crash at any point is recoverable:
+ *   1. sibling filled and flushed, old segment marked SEG_SPLITTING
+ *   2. upper half of the directory range points at the sibling
+ *   3. old segment takes the lower pattern, moved pairs are dropped
+ * Recovery() redoes 3 if 2 completed, otherwise drops the sibling.
+ */
+void Dash::split(Segment* seg, size_t key_hash) {
+  seg->lock_all();
+  if (!seg->owns(key_hash)) {
+    // split by someone else meanwhile
+    seg->unlock_all();
+    return;
+  }
+
+  lock_guard<mutex> g(dir_lock);
+  auto d = dir.load();
+  if (seg->local_depth == d->depth) {
+    doubling();
+    d = dir.load();
+  }
+
+  auto depth = seg->local_depth + 1;
+  auto sibling = new Segment(depth, (seg->pattern << 1) | 1);
+  seg->sibling = sibling;
+  seg->state = SEG_SPLITTING;
+  clflush((char*)&seg->local_depth, 4*sizeof(size_t));
+
+  for (size_t b = 0; b < kNumBucket + kNumStash; ++b) {
+    uint32_t mask = seg->bucket[b].bitmap;
+    while (mask) {
+      int i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      auto& p = seg->bucket[b]._[i];
+      auto kh = DefaultHash::hash(p.key);
+      if (sibling->owns(kh))
+        sibling->Insert4split(p.key, p.value, kh, b);
+    }
+  }
+  clflush((char*)sibling, sizeof(Segment));
+
+  auto stride = (size_t)1 << (d->depth - seg->local_depth);
+  auto start = seg->pattern << (d->depth - seg->local_depth);
+  for (auto i = start + stride/2; i < start + stride; ++i)
+    d->_[i] = sibling;
+  clflush((char*)&d->_[start + stride/2], sizeof(Segment*)*stride/2);
+
+  seg->pattern = seg->pattern << 1;
+  seg->local_depth = depth;
+  clflush((char*)&seg->local_depth, 2*sizeof(size_t));
+  finish_split(seg);
+  segments.inc();
+
+  seg->unlock_all();
+}
+
+/* drop pairs that moved to the sibling and rebuild the overflow counts */
+void Dash::finish_split(Segment* seg) {
+  for (size_t b = 0; b < kNumBucket + kNumStash; ++b)
+    seg->bucket[b].overflow = 0;
+  for (size_t b = 0; b < kNumBucket + kNumStash; ++b) {
+    auto& bucket = seg->bucket[b];
+    uint32_t mask = bucket.bitmap;
+    while (mask) {
+      int i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      auto kh = DefaultHash::hash(bucket._[i].key);
+      if (!seg->owns(kh))
+        bucket.bitmap &= ~(1U << i);
+      else if (b >= kNumBucket)
+        seg->bucket[kh & kBucketMask].overflow++;
+    }
+  }
+  for (size_t b = 0; b < kNumBucket + kNumStash; ++b)
+    clflush((char*)&seg->bucket[b], 32);
+
+  seg->state = SEG_NORMAL;
+  seg->sibling = nullptr;
+  clflush((char*)&seg->state, 2*sizeof(size_t));
+}
+
+Value_t Dash::Get(Key_t& key) {
+  auto key_hash = DefaultHash::hash(key);
+  auto fp = DASH_FP(key_hash);
+  auto y = key_hash & kBucketMask;
+  auto z = (y + 1) & kBucketMask;
+  EpochManager::Guard g(epoch);
+
+RETRY:
+  auto d = dir.load(memory_order_acquire);
+  auto seg = d->_[DASH_SEG(key_hash, d->depth)];
+  auto& home = seg->bucket[y];
+
+  auto version = home.lock.read_begin();
+  if (!seg->owns(key_hash))
+    goto RETRY;
+  int i = home.find(key, fp);
+  Value_t value = i < 0 ? NONE : home._[i].value;
+  auto overflow = home.overflow;
+  if (!home.lock.read_validate(version))
+    goto RETRY;
+  if (value != NONE)
+    return value;
+
+  if ((value = probe(seg->bucket[z], key, fp)) != NONE)
+    return value;
+
+  if (overflow) {
+    for (size_t s = kNumBucket; s < kNumBucket + kNumStash; ++s) {
+      if ((value = probe(seg->bucket[s], key, fp)) != NONE)
+        return value;
+    }
+  }
+
+  // a split in between may have moved the key out of this segment
+  if (!home.lock.read_validate(version))
+    goto RETRY;
+  return NONE;
+}
+
+bool Dash::Delete(Key_t& key) {
+  auto key_hash = DefaultHash::hash(key);
+  auto fp = DASH_FP(key_hash);
+  auto y = key_hash & kBucketMask;
+  auto z = (y + 1) & kBucketMask;
+  EpochManager::Guard g(epoch);
+
+RETRY:
+  auto d = dir.load(memory_order_acquire);
+  auto seg = d->_[DASH_SEG(key_hash, d->depth)];
+  Bucket* home = &seg->bucket[y];
+  Bucket* next = &seg->bucket[z];
+
+  lock_guard<VersionLock> l0(seg->bucket[min(y, z)].lock);
+  lock_guard<VersionLock> l1(seg->bucket[max(y, z)].lock);
+  if (!seg->owns(key_hash))
+    goto RETRY;
+
+  int i;
+  if ((i = home->find(key, fp)) >= 0) {
+    home->erase(i);
+    elements.dec();
+    return true;
+  }
+  if ((i = next->find(key, fp)) >= 0) {
+    next->erase(i);
+    elements.dec();
+    return true;
+  }
+  if (home->overflow) {
+    for (size_t s = kNumBucket; s < kNumBucket + kNumStash; ++s) {
+      Bucket* stash = &seg->bucket[s];
+      lock_guard<VersionLock> l(stash->lock);
+      if ((i = stash->find(key, fp)) >= 0) {
+        stash->erase(i);
+        home->overflow--;
+        clflush((char*)home, 32);
+        elements.dec();
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+Value_t Dash::FindAnyway(Key_t& key) {
+  EpochManager::Guard g(epoch);
+  auto d = dir.load();
+  for (size_t i = 0; i < d->capacity; ++i) {
+    auto seg = d->_[i];
+    for (size_t b = 0; b < kNumBucket + kNumStash; ++b) {
+      auto& bucket = seg->bucket[b];
+      for (size_t j = 0; j < kNumSlot; ++j) {
+        if ((bucket.bitmap & (1U << j)) && bucket._[j].key == key)
+          return bucket._[j].value;
+      }
+    }
+  }
+  return NONE;
+}
+
+/* finish or roll back splits interrupted by a crash */
+bool Dash::Recovery(void) {
+  bool recovered = false;
+  auto d = dir.load();
+  size_t i = 0;
+  while (i < d->capacity) {
+    auto seg = d->_[i];
+    size_t stride = (size_t)1 << (d->depth - seg->local_depth);
+    if (seg->state == SEG_SPLITTING) {
+      auto sibling = seg->sibling;
+      auto start = seg->pattern << (d->depth - seg->local_depth);
+      // step 3 only starts after the directory points at the sibling
+      bool published = sibling && (seg->local_depth == sibling->local_depth
+          || d->_[start + stride - 1] == sibling);
+      if (published) {
+        if (seg->local_depth < sibling->local_depth) {
+          seg->pattern = seg->pattern << 1;
+          seg->local_depth = sibling->local_depth;
+          clflush((char*)&seg->local_depth, 2*sizeof(size_t));
+        }
+        finish_split(seg);
+        segments.inc();
+      } else {
+        // never published, the old segment still holds everything
+        delete sibling;
+        seg->state = SEG_NORMAL;
+        seg->sibling = nullptr;
+        clflush((char*)&seg->state, 2*sizeof(size_t));
+      }
+      recovered = true;
+      stride = (size_t)1 << (d->depth - seg->local_depth);
+    }
+    i += stride;
+  }
+  return recovered;
+}
+
+double Dash::Utilization(void) {
+  return ((double)elements.read()) / ((double)Capacity())*100.0;
+}
+
+size_t Dash::Capacity(void) {
+  return segments.read() * Segment::kCapacity;
+}
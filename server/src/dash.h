@@ -0,0 +1,159 @@
+#ifndef DASH_H_
+#define DASH_H_
+
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+#include "util/epoch.h"
+#include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
+#include "IHash.h"
+
+/*
+ * Dash-style extendible hashing.
+ *
+ * A segment is kNumBucket normal buckets plus kNumStash stash buckets.
+ * A key hashes to bucket y and may live in y or y+1 (whichever is less
+ * full on insert), then in the stash. Each bucket keeps one byte
+ * fingerprints, so a probe reads the 256B bucket header line first and
+ * only the pairs whose fingerprint matches. Buckets are guarded by
+ * version locks, readers never write. A home bucket counts its keys
+ * that went to the stash, so negative lookups skip the stash.
+ *
+ * Segments are addressed by the most significant hash bits, so a split
+ * only touches a contiguous range of directory entries.
+ */
+
+namespace dash {
+
+constexpr size_t kNumSlot = 14;         // pairs per bucket
+constexpr size_t kNumBucket = 64;       // normal buckets per segment
+constexpr size_t kNumStash = 2;         // stash buckets per segment
+constexpr size_t kBucketMask = kNumBucket - 1;
+
+struct Bucket {
+  VersionLock lock;
+  uint16_t bitmap;      // bit i set if _[i] holds a pair
+  uint8_t overflow;     // keys homed here that live in the stash
+  uint8_t pad;
+  uint8_t fp[kNumSlot];
+  uint8_t pad2[6];
+  Pair _[kNumSlot];
+
+  size_t count(void) const { return __builtin_popcount(bitmap); }
+  bool full(void) const { return count() == kNumSlot; }
+  int find(Key_t&, uint8_t) const;
+  int free_slot(void) const { return __builtin_ctz(~bitmap & ((1U << kNumSlot) - 1)); }
+  void put(Key_t&, Value_t, uint8_t);
+  void erase(int);
+};
+
+static_assert(sizeof(Bucket) == 256, "Dash bucket must be four cache lines");
+
+enum SegmentState {
+  SEG_NORMAL = 0,
+  SEG_SPLITTING = 1,    // sibling holds the upper half, old copies not yet cleared
+};
+
+struct Segment {
+  Bucket bucket[kNumBucket + kNumStash];
+  size_t local_depth;
+  size_t pattern;
+  int64_t state;
+  Segment* sibling;
+
+  static constexpr size_t kCapacity = kNumSlot * (kNumBucket + kNumStash);
+
+  Segment(size_t depth, size_t _pattern)
+  : local_depth{depth}, pattern{_pattern}, state{SEG_NORMAL}, sibling{nullptr}
+  { memset((void*)bucket, 0, sizeof(bucket)); }
+
+  void* operator new(size_t size) {
+    void* ret;
+    if (posix_memalign(&ret, 64, size) ) ret=NULL;
+    return ret;
+  }
+  void operator delete(void* p) { free(p); }
+
+  /* does a key with @key_hash belong here? caller is inside a bucket lock or read section */
+  bool owns(size_t key_hash) const {
+    return (key_hash >> (8*sizeof(key_hash) - local_depth)) == pattern;
+  }
+
+  void lock_all(void);
+  void unlock_all(void);
+  /* insert without locks into bucket @b of a segment nobody else can see yet */
+  void Insert4split(Key_t&, Value_t, size_t, size_t);
+};
+
+struct Directory {
+  Segment** _;
+  size_t capacity;
+  size_t depth;
+
+  Directory(size_t _depth)
+  : capacity{(size_t)1 << _depth}, depth{_depth}
+  { _ = new Segment*[capacity]; }
+
+  ~Directory(void) {
+    delete [] _;
+  }
+
+  void* operator new(size_t size) {
+    void* ret;
+    if (posix_memalign(&ret, 64, size) ) ret=NULL;
+    return ret;
+  }
+  void operator delete(void* p) { free(p); }
+};
+
+}  // namespace dash
+
+class Dash final : public IHash {
+  public:
+    Dash(void);
+    Dash(size_t);
+    ~Dash(void);
+
+    Key_t Insert(Key_t&, Value_t);
+    bool Delete(Key_t&);
+    Value_t Get(Key_t&);
+    double Utilization(void);
+    size_t Capacity(void);
+
+    void Insert_extent(Key_t, uint64_t, uint64_t, Value_t) { return ; }
+    Value_t Get_extent(Key_t&, uint64_t) { return NONE; }
+    Value_t FindAnyway(Key_t&);
+
+    bool Recovery(void);
+
+    void* operator new(size_t size) {
+      void *ret;
+      if (posix_memalign(&ret, 64, size) ) ret=NULL;
+      return ret;
+    }
+    void operator delete(void* p) { free(p); }
+
+  private:
+    enum InsertResult { INSERTED, UPDATED, FULL, STALE };
+
+    InsertResult insert(dash::Segment*, Key_t&, Value_t, size_t);
+    void split(dash::Segment*, size_t);
+    void doubling(void);
+    void finish_split(dash::Segment*);
+
+    std::atomic<dash::Directory*> dir;
+    /* serializes directory updates (split publish, doubling) */
+    std::mutex dir_lock;
+    /* directories replaced by doubling are retired, readers may still hold them */
+    EpochManager epoch;
+
+    ShardedCounter elements;
+    ShardedCounter segments;
+};
+
+#endif  // DASH_H_
@@ -5,7 +5,7 @@
 #include <cassert>
 #include <unordered_map>
 #include "util/persist.h"
-#include "util/hash.h"
+#include "util/hash_policy.h"
 #include "src/extendible_hash.h"
 
 extern size_t lockCount;
@@ -27,9 +27,9 @@ int Block::Insert(Key_t& key, Value_t value, size_t key_hash) {
   Key_t LOCK = INVALID;
   for (unsigned i = 0; i < kNumSlot; ++i) {
 #ifdef LSB
-    if ((h(&_[i].key,sizeof(Key_t)) & (size_t)pow(2, local_depth)-1) != pattern) {
+    if ((DefaultHash::hash(_[i].key) & (size_t)pow(2, local_depth)-1) != pattern) {
 #else
-    if ((h(&_[i].key,sizeof(Key_t)) >> (8*sizeof(key_hash)-local_depth)) != pattern) {
+    if ((DefaultHash::hash(_[i].key) >> (8*sizeof(key_hash)-local_depth)) != pattern) {
 #endif
       _[i].key = INVALID;
       // auto invalid = _[slot].key;
@@ -105,7 +105,7 @@ Block** Block::Split(void) {
   split[1] = new Block(local_depth+1);
 
   for (unsigned i = 0; i < kNumSlot; ++i) {
-    auto key_hash = h(&_[i].key, sizeof(Key_t));
+    auto key_hash = DefaultHash::hash(_[i].key);
 #ifdef LSB
     if (key_hash & ((size_t) 1 << local_depth)) {
 #else
@@ -126,7 +126,7 @@ Block** Block::Split(void) {
   split[1] = new Block(local_depth+1);
 
   for (unsigned i = 0; i < kNumSlot; ++i) {
-    auto key_hash = h(&_[i].key, sizeof(Key_t));
+    auto key_hash = DefaultHash::hash(_[i].key);
 #ifdef LSB
     if (key_hash & ((size_t) 1 << (local_depth))) {
 #else
@@ -197,7 +197,7 @@ void Directory::LSBUpdate(int local_depth, int global_depth, int dir_cap, int x,
 void ExtendibleHash::Insert(Key_t& key, Value_t value) {
   using namespace std;
   // timer.Start();
-  auto key_hash = h(&key, sizeof(key));
+  auto key_hash = DefaultHash::hash(key);
   // timer.Stop();
   // breakdown += timer.GetSeconds();
 
@@ -359,7 +359,7 @@ RETRY:
 
 // This function does not allow resizing
 bool ExtendibleHash::InsertOnly(Key_t& key, Value_t value) {
-  auto key_hash = h(&key, sizeof(key));
+  auto key_hash = DefaultHash::hash(key);
 #ifdef LSB
   auto x = (key_hash % dir.capacity);
 #else
@@ -381,7 +381,7 @@ bool ExtendibleHash::Delete(Key_t& key) {
 }
 
 Value_t ExtendibleHash::Get(Key_t& key) {
-  auto key_hash = h(&key, sizeof(key));
+  auto key_hash = DefaultHash::hash(key);
 #ifdef LSB
   auto x = (key_hash % dir.capacity);
 #else
@@ -425,7 +425,7 @@ Value_t ExtendibleHash::FindAnyway(Key_t& key) {
   for (size_t i = 0; i < dir.capacity; ++i) {
      for (size_t j = 0; j < Block::kNumSlot; ++j) {
        if (dir._[i]->_[j].key == key) {
-         auto key_hash = h(&key, sizeof(key));
+         auto key_hash = DefaultHash::hash(key);
          auto x = (key_hash >> (8*sizeof(key_hash)-global_depth));
          return dir._[i]->_[j].value;
        }
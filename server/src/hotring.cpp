@@ -0,0 +1,476 @@
+#include <iostream>
+#include <cstring>
+#include <thread>
+#include "util/persist.h"
+#include "util/hash_policy.h"
+#include "hotring.h"
+
+/* requests of this thread since its last hotspot shift */
+static thread_local size_t nr_request = 0;
+
+/* rings are sorted by (hash, key) */
+static inline bool less(size_t h1, Key_t k1, size_t h2, Key_t k2) {
+	return h1 < h2 || (h1 == h2 && k1 < k2);
+}
+
+HotRing::HotRing(size_t capacity)
+{
+	max_buckets = 2;
+	while (max_buckets * kMaxRing < capacity)
+		max_buckets <<= 1;
+
+	auto nbuckets = max_buckets < kInitialBuckets ? max_buckets : kInitialBuckets;
+	unsigned bits = 0;
+	while ((1UL << bits) < nbuckets)
+		bits++;
+	table = new Table(bits, true);
+}
+
+/* unlinked nodes are freed by the epoch manager */
+HotRing::~HotRing(void) {
+	auto t = table.load();
+	auto n = t->next.load();
+	for (size_t b = 0; b < (1UL << t->bits); ++b) {
+		for (auto bk : rings(t, b)) {
+			auto cur = ptr(bk->first.load());
+			while (cur) {
+				auto next = ptr(cur->next.load());
+				delete cur;
+				cur = next;
+			}
+		}
+	}
+	delete t;
+	delete n;
+}
+
+/*
+ * The live buckets for bucket @b of the oldest table @t: itself, or the
+ * two it was split into. Buckets of the next table are only valid once
+ * their ring has been split.
+ */
+std::vector<HotRing::Bucket*> HotRing::rings(Table* t, size_t b) {
+	auto& bk = t->buckets[b];
+	if (!(bk.first.load() & kSplit))
+		return { &bk };
+	auto n = t->next.load();
+	return { &n->buckets[2 * b], &n->buckets[2 * b + 1] };
+}
+
+/* bucket of @hash in the table that holds it now, that table in @tp */
+HotRing::Bucket& HotRing::bucket_of(size_t hash, Table** tp) {
+	auto t = table.load(std::memory_order_acquire);
+	while (true) {
+		auto& bk = t->buckets[t->index(hash)];
+		if (!(bk.first.load(std::memory_order_acquire) & kSplit)) {
+			if (tp)
+				*tp = t;
+			return bk;
+		}
+		t = t->next.load(std::memory_order_acquire);
+	}
+}
+
+/*
+ * Find the position of (@hash, @key): the link to CAS and the first live
+ * node at or after it, NULL at the end of the ring. Marked nodes on the
+ * way are unlinked (Michael's list search). Starts after the hot node when
+ * the key does not come before it. Waits while the ring is being split.
+ */
+void HotRing::find(size_t hash, Key_t key, Position& pos) {
+retry:
+	auto& bk = bucket_of(hash, &pos.table);
+	pos.bucket = &bk;
+	pos.head = bk.head.load();
+	auto link = &bk.first;
+	auto hot = head_node(pos.head);
+	if (hot && less(hot->hash, hot->key, hash, key) && !(hot->next.load() & (kMarked | kFrozen)))
+		link = &hot->next;
+
+	/* a link of another table: the ring was split since we looked it up */
+	auto level = pos.table->bits;
+	auto cur_link = link->load();
+	if (frozen(cur_link)) {
+		std::this_thread::yield();
+		goto retry;
+	}
+	if (marked(cur_link) || link_bits(cur_link) != level)
+		goto retry;
+	auto cur = ptr(cur_link);
+	while (cur) {
+		auto next = cur->next.load();
+		if (frozen(next)) {
+			std::this_thread::yield();
+			goto retry;
+		}
+		if (link_bits(next) != level)
+			goto retry;
+		if (marked(next)) {
+			if (!link->compare_exchange_strong(cur_link, next & ~kMarked))
+				goto retry;
+			clflush((char*)link, sizeof(uint64_t));
+			reclaim(bk, cur);
+			cur_link = next & ~kMarked;
+			cur = ptr(next);
+			continue;
+		}
+		if (!less(cur->hash, cur->key, hash, key))
+			break;
+		link = &cur->next;
+		cur_link = next;
+		cur = ptr(next);
+	}
+	pos.link = link;
+	pos.expected = cur_link;
+	pos.right = cur;
+}
+
+/* mark @node deleted and unlink it, false if another thread deleted it first */
+bool HotRing::remove(Node* node) {
+	auto next = node->next.load();
+	while (true) {
+		if (marked(next))
+			return false;
+		if (frozen(next)) {
+			std::this_thread::yield();
+			next = node->next.load();
+			continue;
+		}
+		if (node->next.compare_exchange_weak(next, next | kMarked))
+			break;
+	}
+	clflush((char*)&node->next, sizeof(uint64_t));
+	size.dec();
+
+	Position pos;
+	find(node->hash, node->key, pos);
+	return true;
+}
+
+/*
+ * @node was just unlinked: bump the head tag, so no head move that looked
+ * at @node before can install it any more, and drop it from the head.
+ * Then free it once no operation can hold it.
+ */
+void HotRing::reclaim(Bucket& bk, Node* node) {
+	auto head = bk.head.load();
+	while (true) {
+		auto hot = head_node(head) == node ? nullptr : head_node(head);
+		if (bk.head.compare_exchange_weak(head, make_head(hot, head_tag(head) + 1)))
+			break;
+	}
+	epoch.retire(node);
+}
+
+/* make @node the hot node, unless the head changed since @head was read or @node is deleted */
+void HotRing::move_head(Bucket& bk, uint64_t head, Node* node) {
+	if (marked(node->next.load()))
+		return;
+	bk.head.compare_exchange_strong(head, make_head(node, head_tag(head)));
+}
+
+/* least accessed live node besides the hot one, the eviction victim of a full ring */
+HotRing::Node* HotRing::coldest(Bucket& bk, size_t* lenp) {
+	auto hot = head_node(bk.head.load());
+	Node* victim = nullptr;
+	size_t len = 0;
+	auto cur = ptr(bk.first.load());
+	while (cur) {
+		auto next = cur->next.load();
+		if (!marked(next)) {
+			len++;
+			if (cur != hot && (!victim || cur->counter.load(std::memory_order_relaxed)
+						< victim->counter.load(std::memory_order_relaxed)))
+				victim = cur;
+		}
+		cur = ptr(next);
+	}
+	*lenp = len;
+	return victim;
+}
+
+/*
+ * Hotspot shift: make the head the node that minimizes the walk of the
+ * accesses counted since the last shift (the "income" of server/hotring),
+ * then restart counting. A lookup walks from the hot node if its key does
+ * not come before it, else from the first node.
+ */
+void HotRing::shift(Bucket& bk) {
+	const size_t kMaxShift = 4 * kMaxRing;
+	Node* ring[kMaxShift];
+	auto head = bk.head.load();
+	size_t n = 0;
+	auto cur = ptr(bk.first.load());
+	while (cur && n < kMaxShift) {
+		auto next = cur->next.load();
+		if (!marked(next))
+			ring[n++] = cur;
+		cur = ptr(next);
+	}
+	if (cur || !n)
+		return;
+
+	size_t best = 0;
+	uint64_t best_income = UINT64_MAX;
+	for (size_t t = 0; t < n; ++t) {
+		uint64_t income = 0;
+		for (size_t i = 0; i < n; ++i)
+			income += (uint64_t)ring[i]->counter.load(std::memory_order_relaxed) * (i >= t ? i - t : i);
+		if (income < best_income) {
+			best_income = income;
+			best = t;
+		}
+	}
+	for (size_t i = 0; i < n; ++i)
+		ring[i]->counter.store(0, std::memory_order_relaxed);
+	move_head(bk, head, ring[best]);
+}
+
+/* start doubling @t unless another thread just did */
+void HotRing::grow(Table* t) {
+	auto n = new Table(t->bits + 1, false);
+	Table* expected = nullptr;
+	if (!t->next.compare_exchange_strong(expected, n))
+		delete n;
+}
+
+/*
+ * Split ring @b of @t into buckets 2b and 2b+1 of the next table. The
+ * ring is sorted by hash, so the halves are a prefix and a suffix: freeze
+ * every link, cut after the last node of the prefix, publish the new
+ * buckets with the hottest node of each half as head, mark the old bucket
+ * split and unfreeze. Deleted nodes stay for find() to unlink.
+ */
+void HotRing::split(Table* t, size_t b) {
+	auto& bk = t->buckets[b];
+	auto first = bk.first.load();
+	do {
+		if (frozen(first))
+			return;
+	} while (!bk.first.compare_exchange_weak(first, first | kFrozen));
+
+	/* a frozen link cannot change, so nothing behind the walk can either */
+	auto cur = ptr(first);
+	while (cur) {
+		auto next = cur->next.load();
+		while (!frozen(next) && !cur->next.compare_exchange_weak(next, next | kFrozen))
+			;
+		cur = ptr(next);
+	}
+
+	auto side_shift = 63 - t->bits;
+	Node* last_lo = nullptr;
+	Node* first_hi = nullptr;
+	Node* hottest[2] = { nullptr, nullptr };
+	for (cur = ptr(first); cur; cur = ptr(cur->next.load())) {
+		auto side = (cur->hash >> side_shift) & 1;
+		if (!side)
+			last_lo = cur;
+		else if (!first_hi)
+			first_hi = cur;
+		if (!marked(cur->next.load()) && (!hottest[side]
+					|| cur->counter.load(std::memory_order_relaxed)
+					> hottest[side]->counter.load(std::memory_order_relaxed)))
+			hottest[side] = cur;
+	}
+
+	auto n = t->next.load();
+	auto& lo = n->buckets[2 * b];
+	auto& hi = n->buckets[2 * b + 1];
+	auto first_lo = last_lo ? ptr(first) : nullptr;
+	lo.first.store(make_link(first_lo, n->bits), std::memory_order_relaxed);
+	lo.head.store(make_head(hottest[0], 0), std::memory_order_relaxed);
+	hi.first.store(make_link(first_hi, n->bits), std::memory_order_relaxed);
+	hi.head.store(make_head(hottest[1], 0), std::memory_order_relaxed);
+	/* the cut keeps the deleted mark, or a node deleted before the split comes back */
+	if (last_lo)
+		last_lo->next.store(kFrozen | (last_lo->next.load() & kMarked), std::memory_order_relaxed);
+	clflush((char*)&lo, sizeof(Bucket) * 2);
+	bk.first.store(first | kFrozen | kSplit, std::memory_order_release);
+
+	/* relink with the new table bits, links of the old ring cannot match any more */
+	for (auto start : { first_lo, first_hi }) {
+		for (cur = start; cur; ) {
+			auto next = cur->next.load();
+			cur->next.store(make_link(ptr(next), n->bits) | (next & kMarked));
+			cur = ptr(next);
+		}
+	}
+
+	if (t->nr_split.fetch_add(1) + 1 == (1UL << t->bits)) {
+		/* that was the last ring, the new table takes over */
+		table.store(n, std::memory_order_release);
+		epoch.retire(t);
+	}
+}
+
+/* split the next ring of a table being doubled, one per insert and delete */
+void HotRing::migrate(void) {
+	auto t = table.load(std::memory_order_acquire);
+	if (!t->next.load(std::memory_order_acquire))
+		return;
+	auto b = t->cursor.fetch_add(1);
+	if (b < (1UL << t->bits))
+		split(t, b);
+}
+
+// return deleted key
+Key_t HotRing::Insert(Key_t& key, Value_t value) {
+	auto hash = DefaultHash::hash(key);
+	Key_t deleteKey = -1;
+	bool checked = false;
+	auto node = new Node(key, value, hash);
+
+	EpochManager::Guard g(epoch);
+	while (true) {
+		Position pos;
+		find(hash, key, pos);
+		auto right = pos.right;
+		if (right && right->hash == hash && right->key == key) {
+			delete node;
+			right->value.store(value);
+			clflush((char*)&right->value, sizeof(Value_t));
+			break;
+		}
+
+		if (!checked) {
+			checked = true;
+			size_t len;
+			auto victim = coldest(*pos.bucket, &len);
+			auto t = pos.table;
+			auto oldest = table.load(std::memory_order_acquire);
+			if (len >= kMaxRing) {
+				if (t == oldest && !t->next.load() && (1UL << t->bits) < max_buckets)
+					grow(t);
+				if (t->next.load()) {
+					/* split this ring now rather than when migrate() gets to it */
+					split(t, t->index(hash));
+					checked = false;
+					continue;
+				}
+				if (t == oldest && victim) {
+					auto victim_key = victim->key;
+					if (remove(victim))
+						deleteKey = victim_key;
+					continue;
+				}
+				/* t is the table being split into, it grows after that */
+			}
+		}
+
+		auto expected = pos.expected;
+		node->next.store(expected, std::memory_order_relaxed);
+		clflush((char*)node, sizeof(Node));
+		if (!pos.link->compare_exchange_strong(expected, make_link(node, link_bits(expected))))
+			continue;
+		clflush((char*)pos.link, sizeof(uint64_t));
+		if (!head_node(pos.head))
+			move_head(*pos.bucket, pos.head, node);
+		size.inc();
+		break;
+	}
+	migrate();
+	return deleteKey;
+}
+
+bool HotRing::Delete(Key_t& key) {
+	auto hash = DefaultHash::hash(key);
+	EpochManager::Guard g(epoch);
+	Position pos;
+	find(hash, key, pos);
+	auto node = pos.right;
+	bool ret = node && node->hash == hash && node->key == key && remove(node);
+	migrate();
+	return ret;
+}
+
+Value_t HotRing::Get(Key_t& key) {
+	auto hash = DefaultHash::hash(key);
+	Value_t ret = NONE;
+
+	EpochManager::Guard g(epoch);
+	nr_request++;
+	while (true) {
+		auto& bk = bucket_of(hash, nullptr);
+		auto hot = head_node(bk.head.load());
+		Node* cur;
+		if (hot && !less(hash, key, hot->hash, hot->key) && !marked(hot->next.load()))
+			cur = hot;
+		else
+			cur = ptr(bk.first.load());
+		while (cur && less(cur->hash, cur->key, hash, key))
+			cur = ptr(cur->next.load());
+
+		if (cur && cur->hash == hash && cur->key == key && !marked(cur->next.load())) {
+			ret = cur->value.load();
+			auto count = cur->counter.load(std::memory_order_relaxed);
+			if (count < UINT32_MAX)
+				cur->counter.store(count + 1, std::memory_order_relaxed);
+			/* a cold access, see if the hotspot moved */
+			if (cur != hot && nr_request >= kShiftInterval) {
+				shift(bk);
+				nr_request = 0;
+			}
+			break;
+		}
+		/* a split may have cut the ring under the walk, look again once it is done */
+		if (!frozen(bk.first.load()))
+			break;
+		std::this_thread::yield();
+	}
+	return ret;
+}
+
+void HotRing::Insert_extent(Key_t, uint64_t, uint64_t, Value_t) {
+	return ;
+}
+
+Value_t HotRing::Get_extent(Key_t&, uint64_t) {
+	return NONE;
+}
+
+Value_t HotRing::FindAnyway(Key_t& key) {
+	EpochManager::Guard g(epoch);
+	auto t = table.load();
+	for (size_t b = 0; b < (1UL << t->bits); ++b) {
+		for (auto bk : rings(t, b)) {
+			for (auto cur = ptr(bk->first.load()); cur; ) {
+				auto next = cur->next.load();
+				if (cur->key == key && !marked(next))
+					return cur->value.load();
+				cur = ptr(next);
+			}
+		}
+	}
+	return NONE;
+}
+
+size_t HotRing::Verify(size_t* nr_nodes) {
+	size_t bad = 0;
+	*nr_nodes = 0;
+	auto t = table.load();
+	auto n = t->next.load();
+	for (size_t b = 0; b < (1UL << t->bits); ++b) {
+		auto split = t->buckets[b].first.load() & kSplit;
+		for (size_t i = 0; i < (split ? 2 : 1); ++i) {
+			auto rt = split ? n : t;
+			auto idx = split ? 2 * b + i : b;
+			auto link = rt->buckets[idx].first.load();
+			Node* prev = nullptr;
+			for (auto cur = ptr(link); cur; cur = ptr(link)) {
+				if (frozen(link) || link_bits(link) != rt->bits || rt->index(cur->hash) != idx
+						|| (prev && !less(prev->hash, prev->key, cur->hash, cur->key)))
+					bad++;
+				link = cur->next.load();
+				if (!marked(link))
+					(*nr_nodes)++;
+				prev = cur;
+			}
+		}
+	}
+	return bad;
+}
+
+double HotRing::Utilization(void) {
+	return ((double)size.read())/((double)Capacity())*100;
+}
@@ -0,0 +1,190 @@
+#ifndef HOTRING_H_
+#define HOTRING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/epoch.h"
+#include "IHash.h"
+
+/*
+ * HotRing (FAST'20), the hotspot-aware hash of server/hotring as a backend.
+ *
+ * Each bucket holds a ring of nodes ordered by (hash, key), closed through
+ * the bucket's first pointer, and a head word pointing at the hottest node,
+ * so a lookup starts where the hot items are and stops as soon as it has
+ * passed the key's position. Every kShiftInterval requests a thread that
+ * hit a cold node recomputes the head from the per-node access counters
+ * (hotspot shift).
+ *
+ * Lock-free: a node is inserted with a CAS on its predecessor's next
+ * pointer and deleted by marking its own next pointer first (bit 0), after
+ * which any thread may unlink it. The head word carries a 16-bit tag bumped
+ * by every unlink, so a head move (CAS) cannot install a node that was
+ * unlinked after the mover looked at it. Unlinked nodes are freed through
+ * epoch based reclamation (util/epoch.h).
+ *
+ * The table doubles whenever a ring grows past kMaxRing, until it has
+ * enough buckets for the capacity it was created with. From then on a full
+ * ring evicts its coldest node; inserts racing on one ring may overfill it
+ * by a few nodes.
+ *
+ * Doubling is incremental: the new table hangs off the old one, and every
+ * insert and delete splits one more old ring into its two new buckets by
+ * the next hash bit (an insert into a full ring splits its own first).
+ * A split freezes the ring's links (bit 1), so writers on it wait, cuts it
+ * in two and marks the old bucket split (bit 2 of its first pointer).
+ * Lookups go to the new table for split buckets and to the old one for the
+ * others; a miss on a ring that got frozen meanwhile is retried. Links
+ * carry the bits of their table in bit 48..63, so a CAS prepared against
+ * a ring before it was split fails afterwards.
+ */
+class HotRing final : public IHash {
+	public:
+	static constexpr size_t kMaxRing = 8;
+	static constexpr size_t kInitialBuckets = 1024;
+	/* requests per thread between hotspot checks, INTERVAL of server/hotring */
+	static constexpr size_t kShiftInterval = 10;
+
+	HotRing(size_t);
+	~HotRing(void);
+	Key_t Insert(Key_t&, Value_t);
+	bool Delete(Key_t&);
+	Value_t Get(Key_t&);
+	double Utilization(void);
+
+	void Insert_extent(Key_t, uint64_t, uint64_t, Value_t);
+	Value_t Get_extent(Key_t&, uint64_t);
+	Value_t FindAnyway(Key_t&);
+
+	bool Recovery(void) {
+		return false;
+	}
+
+	size_t Capacity(void) {
+		return max_buckets * kMaxRing;
+	}
+
+	/* with no operation running: nodes out of order, in the wrong bucket or with stale links */
+	size_t Verify(size_t* nr_nodes);
+
+	void* operator new(size_t size) {
+		void *ret;
+		if (posix_memalign(&ret, 64, size)) ret = NULL;
+		return ret;
+	}
+	void operator delete(void* p) { free(p); }
+
+	private:
+	struct Node {
+		Key_t key;
+		std::atomic<Value_t> value;
+		size_t hash;
+		/* next node, bit 0 marks this node deleted, see the link bits below */
+		std::atomic<uint64_t> next;
+		/* accesses since the last hotspot shift, relaxed so increments may be lost */
+		std::atomic<uint32_t> counter;
+
+		Node(Key_t key, Value_t value, size_t hash)
+			: key(key), value(value), hash(hash), next(0), counter(0) { }
+	};
+
+	struct Bucket {
+		/* bit 0..47 hot node address, bit 48..63 tag bumped on every unlink */
+		std::atomic<uint64_t> head;
+		/* smallest node, the sentinel link of the ring */
+		std::atomic<uint64_t> first;
+	};
+
+	struct Table {
+		unsigned bits;
+		Bucket* buckets;
+		/* the table this one is being split into */
+		std::atomic<Table*> next;
+		/* next bucket to split, buckets split so far */
+		std::atomic<size_t> cursor;
+		std::atomic<size_t> nr_split;
+
+		/* buckets of a table to split into are left to split(), so it costs no pause */
+		Table(unsigned bits, bool empty)
+			: bits(bits), buckets(new Bucket[1UL << bits]), next(nullptr), cursor(0), nr_split(0) {
+			for (size_t b = 0; empty && b < (1UL << bits); ++b) {
+				buckets[b].head.store(0, std::memory_order_relaxed);
+				buckets[b].first.store(make_link(nullptr, bits), std::memory_order_relaxed);
+			}
+		}
+		~Table(void) {
+			delete[] buckets;
+		}
+		size_t index(size_t hash) {
+			return hash >> (64 - bits);
+		}
+	};
+
+	/* where find() stopped */
+	struct Position {
+		Table* table;
+		Bucket* bucket;
+		uint64_t head;
+		std::atomic<uint64_t>* link;
+		/* value of *link, pointing at right */
+		uint64_t expected;
+		Node* right;
+	};
+
+	static constexpr uint64_t kAddrMask = (1ULL << 48) - 1;
+	/* low bits of links: node deleted, ring being split, bucket split */
+	static constexpr uint64_t kMarked = 1;
+	static constexpr uint64_t kFrozen = 2;
+	static constexpr uint64_t kSplit = 4;
+	static constexpr uint64_t kLinkBits = 7;
+	static Node* head_node(uint64_t head) {
+		return (Node*)(head & kAddrMask);
+	}
+	static uint64_t head_tag(uint64_t head) {
+		return head >> 48;
+	}
+	static uint64_t make_head(Node* node, uint64_t tag) {
+		return (tag << 48) | ((uint64_t)node & kAddrMask);
+	}
+	/* node address, table bits in bit 48..63 */
+	static uint64_t make_link(Node* node, unsigned bits) {
+		return ((uint64_t)bits << 48) | (uint64_t)node;
+	}
+	static Node* ptr(uint64_t link) {
+		return (Node*)(link & kAddrMask & ~kLinkBits);
+	}
+	static unsigned link_bits(uint64_t link) {
+		return link >> 48;
+	}
+	static bool marked(uint64_t link) {
+		return link & kMarked;
+	}
+	static bool frozen(uint64_t link) {
+		return link & kFrozen;
+	}
+
+	Bucket& bucket_of(size_t, Table**);
+	std::vector<Bucket*> rings(Table*, size_t);
+	void find(size_t, Key_t, Position&);
+	bool remove(Node*);
+	void reclaim(Bucket&, Node*);
+	void move_head(Bucket&, uint64_t, Node*);
+	Node* coldest(Bucket&, size_t*);
+	void shift(Bucket&);
+	void grow(Table*);
+	void split(Table*, size_t);
+	void migrate(void);
+
+	/* oldest table in use, its next one while it is split */
+	std::atomic<Table*> table;
+	size_t max_buckets;
+	EpochManager epoch;
+
+	ShardedCounter size;
+};
+
+#endif  // HOTRING_H_
@@ -1,53 +1,79 @@
 #include <iostream>
+#include <algorithm>
 #include <cstring>
 #include <thread>
 #include <mutex>
-#include <shared_mutex>
 #include "util/persist.h"
-#include "util/hash.h"
+#include "util/hash_policy.h"
+#include "util/amac.h"
 #include "linear_probing.h"
 
 LinearProbingHash::LinearProbingHash(void)
-	: capacity{0}, dict{nullptr} { }
+	: capacity{0}, dict{nullptr}, policy{EVICT_FIFO}, refbits{nullptr}, hands{nullptr} { }
 
-LinearProbingHash::LinearProbingHash(size_t _capacity)
-	: capacity{_capacity}, dict{new Pair[capacity]}
+LinearProbingHash::LinearProbingHash(size_t _capacity, EvictionPolicy _policy)
+	: policy{_policy}, refbits{nullptr}, hands{nullptr}
 {
 	locksize = 16;
+	/* whole clusters only, so the last one never runs off the table */
+	capacity = (_capacity + locksize - 1) / locksize * locksize;
+	dict = new Pair[capacity];
 	nlocks = (capacity)/locksize+1;
-	mutex = new std::shared_mutex[nlocks];
+	locks = new VersionLock[nlocks];
+
+	if (policy == EVICT_CLOCK) {
+		refbits = new uint16_t[nlocks]();
+		hands = new uint8_t[nlocks]();
+	}
 }
 
 LinearProbingHash::~LinearProbingHash(void) {
 	if (dict != nullptr) delete[] dict;
+	delete[] locks;
+	delete[] refbits;
+	delete[] hands;
 }
 
 // return deleted key
 Key_t LinearProbingHash::Insert(Key_t& key, Value_t value) {
-	using namespace std;
-	auto key_hash = h(&key, sizeof(key));
+	auto slot = DefaultHash::hash(key) % capacity;
+	auto firstIndex = slot - slot % locksize;
+	std::lock_guard<VersionLock> lock(locks[slot/locksize]);
+	size_t lo, hi;
+	auto deleteKey = place(firstIndex, key, value, &lo, &hi);
+	clflush((char*)&dict[lo], sizeof(Pair) * (hi - lo));
+	return deleteKey;
+}
 
-	auto slot = key_hash % capacity;
-	auto off = slot % locksize;
-	auto firstIndex = slot - off;
-	unique_lock<shared_mutex> lock(mutex[slot/locksize]);
-	for ( int j = 0 ; j < locksize - 1; j++ ) {
-		slot = firstIndex + j;
+/*
+ * Puts @key into the cluster at @firstIndex (caller holds its lock) and
+ * returns the evicted key or -1. Slots [*lo, *hi) were written and are left
+ * for the caller to flush.
+ */
+Key_t LinearProbingHash::place(size_t firstIndex, Key_t& key, Value_t value, size_t* lo, size_t* hi) {
+	for ( int j = 0 ; j < locksize; j++ ) {
+		auto slot = firstIndex + j;
 
 		// if there is available slot, insert and return
 		if (dict[slot].key == INVALID) {
+			if (policy == EVICT_CLOCK)
+				__atomic_fetch_and(&refbits[firstIndex/locksize], (uint16_t)~(1U << j), __ATOMIC_RELAXED);
 			dict[slot].value = value;
 			mfence();
 			dict[slot].key = key;
-			clflush((char*)&dict[slot].key, sizeof(Pair));
-			auto _size = size;
-			while (!CAS(&size, &_size, _size+1)) {
-				_size = size;
-			}
+			*lo = slot;
+			*hi = slot + 1;
+			size.inc();
 			return -1;
 		}
 	}
 
+	if (policy == EVICT_CLOCK) {
+		auto deleteKey = evictClock(firstIndex, key, value, lo);
+		*hi = *lo + 1;
+		return deleteKey;
+	}
+
 	// Delete first element of this cluster and shift all element to the left.
 	// Insert new element at tail.
 	auto deleteKey = dict[firstIndex].key;
@@ -59,13 +85,73 @@ Key_t LinearProbingHash::Insert(Key_t& key, Value_t value) {
 	dict[firstIndex + locksize - 1].key = key;
 	dict[firstIndex + locksize - 1].value = value;
 
-	clflush((char*)&dict[firstIndex].key, sizeof(Pair) * locksize);
-	
+	*lo = firstIndex;
+	*hi = firstIndex + locksize;
+	return deleteKey;
+}
+
+/*
+ * Second chance within a full cluster (caller holds the cluster lock).
+ * The hand clears reference bits until it finds an unreferenced slot,
+ * which is replaced in place and returned in @victim. A concurrent Get may
+ * set a bit behind the hand, so the sweep is bounded to two rounds.
+ */
+Key_t LinearProbingHash::evictClock(size_t firstIndex, Key_t& key, Value_t value, size_t* victim) {
+	auto c = firstIndex / locksize;
+	unsigned hand = hands[c];
+	for (int n = 0; n < 2*locksize && (refbits[c] & (1U << hand)); ++n) {
+		__atomic_fetch_and(&refbits[c], (uint16_t)~(1U << hand), __ATOMIC_RELAXED);
+		hand = (hand + 1) % locksize;
+	}
+
+	*victim = firstIndex + hand;
+	auto deleteKey = dict[*victim].key;
+	dict[*victim].value = value;
+	mfence();
+	dict[*victim].key = key;
+	hands[c] = (hand + 1) % locksize;
+
 	return deleteKey;
 }
 
+/*
+ * Keys are sorted by cluster, keeping their order within one, and all
+ * target clusters are prefetched before the first is locked. Every
+ * cluster is then locked once and its written slots flushed once.
+ */
+void LinearProbingHash::InsertBatch(Key_t* keys, Value_t* values, Key_t* evicted, size_t n) {
+	static_assert(kMaxBatch <= 64, "batch index must fit in the low 6 bits");
+	for (size_t off = 0; off < n; off += kMaxBatch) {
+		auto m = std::min(n - off, kMaxBatch);
+		/* cluster << 6 | position in the batch */
+		uint64_t order[kMaxBatch];
+		for (size_t i = 0; i < m; ++i) {
+			auto c = DefaultHash::hash(keys[off + i]) % capacity / locksize;
+			order[i] = c << 6 | i;
+			__builtin_prefetch(&locks[c], 1);
+			for (int j = 0; j < locksize; j += kCacheLineSize / sizeof(Pair))
+				__builtin_prefetch(&dict[c * locksize + j], 1);
+		}
+		std::sort(order, order + m);
+
+		for (size_t b = 0; b < m; ) {
+			auto c = order[b] >> 6;
+			size_t lo = capacity, hi = 0;
+			std::lock_guard<VersionLock> lock(locks[c]);
+			for (; b < m && (order[b] >> 6) == c; ++b) {
+				auto i = off + (order[b] & 63);
+				size_t l, h;
+				evicted[i] = place(c * locksize, keys[i], values[i], &l, &h);
+				lo = std::min(lo, l);
+				hi = std::max(hi, h);
+			}
+			clflush((char*)&dict[lo], sizeof(Pair) * (hi - lo));
+		}
+	}
+}
+
 bool LinearProbingHash::InsertOnly(Key_t& key, Value_t value) {
-	auto key_hash = h(&key, sizeof(key)) % capacity;
+	auto key_hash = DefaultHash::hash(key) % capacity;
 	auto loc = getLocation(key_hash, capacity, dict);
 	if (loc == INVALID) {
 		return false;
@@ -74,27 +160,79 @@ bool LinearProbingHash::InsertOnly(Key_t& key, Value_t value) {
 		mfence();
 		dict[loc].key = key;
 		clflush((char*)&dict[loc], sizeof(Pair));
-		size++;
+		size.inc();
 		return true;
 	}
 }
 
 bool LinearProbingHash::Delete(Key_t& key) {
+	auto loc = DefaultHash::hash(key) % capacity;
+	auto firstIndex = loc - (loc % locksize);
+	std::lock_guard<VersionLock> lock(locks[loc/locksize]);
+	for (int i = 0; i < locksize; ++i) {
+		auto id = firstIndex + i;
+		if (dict[id].key == key) {
+			dict[id].key = INVALID;
+			clflush((char*)&dict[id].key, sizeof(Key_t));
+			size.dec();
+			return true;
+		}
+	}
 	return false;
 }
 
 Value_t LinearProbingHash::Get(Key_t& key) {
-	auto key_hash = h(&key, sizeof(key)) % capacity;
-	auto loc = key_hash % capacity; // target location of key
+	return lookup(key, DefaultHash::hash(key) % capacity);
+}
+
+/* lookups interleaved by amac_run, so their cluster misses overlap */
+void LinearProbingHash::GetBatch(Key_t* keys, Value_t* values, size_t n) {
+	for (size_t off = 0; off < n; off += kMaxBatch) {
+		auto m = std::min(n - off, kMaxBatch);
+		Lookup ops[kMaxBatch];
+		for (size_t i = 0; i < m; ++i)
+			ops[i] = {this, &keys[off + i], &values[off + i], 0, false};
+		amac_run(ops, m);
+	}
+}
+
+bool LinearProbingHash::Lookup::step(void) {
+	if (!prefetched) {
+		loc = DefaultHash::hash(*key) % table->capacity;
+		auto c = loc / table->locksize;
+		__builtin_prefetch(&table->locks[c]);
+		for (int j = 0; j < table->locksize; j += kCacheLineSize / sizeof(Pair))
+			__builtin_prefetch(&table->dict[c * table->locksize + j]);
+		prefetched = true;
+		return false;
+	}
+	*value = table->lookup(*key, loc);
+	return true;
+}
+
+/* @loc: target location of key */
+Value_t LinearProbingHash::lookup(Key_t& key, size_t loc) {
 	auto off = loc % locksize;
 	auto firstIndex = loc - off;
-	{
-		std::shared_lock<std::shared_mutex> lock(mutex[loc/locksize]);
-		for (int i = 0; i < locksize - 1; ++i) {
-			auto id = firstIndex + i;
-			if (dict[id].key == key) return std::move(dict[id].value);
+	auto c = loc/locksize;
+RETRY:
+	auto version = locks[c].read_begin();
+	for (int i = 0; i < locksize; ++i) {
+		auto id = firstIndex + i;
+		if (dict[id].key == key) {
+			auto value = dict[id].value;
+			if (!locks[c].read_validate(version))
+				goto RETRY;
+			if (policy == EVICT_CLOCK) {
+				uint16_t bit = 1U << i;
+				if (!(refbits[c] & bit))
+					__atomic_fetch_or(&refbits[c], bit, __ATOMIC_RELAXED);
+			}
+			return value;
 		}
 	}
+	if (!locks[c].read_validate(version))
+		goto RETRY;
 	return NONE;
 }
 
@@ -110,13 +248,7 @@ Value_t LinearProbingHash::FindAnyway(Key_t&) {
 }
 
 double LinearProbingHash::Utilization(void) {
-	size_t size = 0;
-	for (size_t i = 0; i < capacity; ++i) {
-		if (dict[i].key != INVALID) {
-			++size;
-		}
-	}
-	return ((double)size)/((double)capacity)*100;
+	return ((double)size.read())/((double)capacity)*100;
 }
 
 size_t LinearProbingHash::getLocation(size_t hash_value, size_t _capacity, Pair* _dict) {
@@ -139,24 +271,23 @@ FAILED:
 }
 
 void LinearProbingHash::resize(size_t _capacity) {
-	std::unique_lock<std::shared_mutex> *lock[nlocks];
 	for(int i=0; i<nlocks; i++){
-		lock[i] = new std::unique_lock<std::shared_mutex>(mutex[i]);
+		locks[i].lock();
 	}
 	int prev_nlocks = nlocks;
 	nlocks = _capacity/locksize+1;
-	std::shared_mutex* old_mutex = mutex;
+	VersionLock* old_locks = locks;
 
 	Pair* newDict = new Pair[_capacity];
 	for (size_t i = 0; i < capacity; i++) {
 		if (dict[i].key != INVALID) {
-			auto key_hash = h(&dict[i].key, sizeof(Key_t)) % _capacity;
+			auto key_hash = DefaultHash::hash(dict[i].key) % _capacity;
 			auto loc = getLocation(key_hash, _capacity, newDict);
 			newDict[loc].key = dict[i].key;
 			newDict[loc].value = dict[i].value;
 		}
 	}
-	mutex = new std::shared_mutex[nlocks];
+	locks = new VersionLock[nlocks];
 	clflush((char*)&newDict[0], sizeof(Pair)*_capacity);
 	old_cap = capacity;
 	old_dic = dict;
@@ -174,7 +305,7 @@ void LinearProbingHash::resize(size_t _capacity) {
 
 	delete [] tmp;
 	for(int i=0; i<prev_nlocks; i++) {
-		delete lock[i];
+		old_locks[i].unlock();
 	}
-	delete[] old_mutex;
+	delete[] old_locks;
 }
@@ -3,16 +3,23 @@
 
 #include <stddef.h>
 #include <mutex>
-#include <shared_mutex>
 #include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
 #include "IHash.h"
 
-class LinearProbingHash : public IHash {
+/* victim selection when a cluster is full */
+enum EvictionPolicy {
+	EVICT_FIFO,		/* shift out the oldest entry of the cluster */
+	EVICT_CLOCK,	/* second chance: skip entries referenced since the last sweep */
+};
+
+class LinearProbingHash final : public IHash {
 	const float kResizingFactor = 2;
 	const float kResizingThreshold = 0.95;
 	public:
 	LinearProbingHash(void);
-	LinearProbingHash(size_t);
+	LinearProbingHash(size_t, EvictionPolicy = EVICT_FIFO);
 	~LinearProbingHash(void);
 	Key_t Insert(Key_t&, Value_t);
 	bool InsertOnly(Key_t&, Value_t);
@@ -20,6 +27,9 @@ class LinearProbingHash : public IHash {
 	Value_t Get(Key_t&);
 	double Utilization(void);
 
+	void InsertBatch(Key_t*, Value_t*, Key_t*, size_t);
+	void GetBatch(Key_t*, Value_t*, size_t);
+
 	void Insert_extent(Key_t, uint64_t, uint64_t, Value_t);
 	Value_t Get_extent(Key_t&, uint64_t);
 	Value_t FindAnyway(Key_t&);
@@ -37,16 +47,32 @@ class LinearProbingHash : public IHash {
 		if (posix_memalign(&ret, 64, size)) ret = NULL;
 		return ret;
 	}
+	void operator delete[](void* p) { free(p); }
 
 	void* operator new(size_t size) {
 		void *ret;
 		if (posix_memalign(&ret, 64, size)) ret = NULL;
 		return ret;
 	}
+	void operator delete(void* p) { free(p); }
 
 	private:
 	void resize(size_t);
 	size_t getLocation(size_t, size_t, Pair*);
+	Key_t place(size_t, Key_t&, Value_t, size_t*, size_t*);
+	Key_t evictClock(size_t, Key_t&, Value_t, size_t*);
+	Value_t lookup(Key_t&, size_t);
+
+	/* GetBatch state machine (util/amac.h): prefetch the cluster, then probe it */
+	struct Lookup {
+		LinearProbingHash* table;
+		Key_t* key;
+		Value_t* value;
+		size_t loc;
+		bool prefetched;
+
+		bool step(void);
+	};
 
 	size_t capacity;
 	Pair* dict;
@@ -54,12 +80,25 @@ class LinearProbingHash : public IHash {
 	size_t old_cap;
 	Pair* old_dic;
 
-	size_t size = 0;
+	/* live entries, updated on insert/evict/delete */
+	ShardedCounter size;
 
 	int resizing_lock = 0;
-	std::shared_mutex *mutex;
+	/*
+	 * One version lock per cluster: CAS for writers, optimistic readers.
+	 * Kept apart from dict: a Pair has no spare bits, and a lock inside the
+	 * 256B cluster would spread it over five cache lines and break
+	 * dict[c * locksize + j]. The array is 1/32 of the table and is
+	 * prefetched with the cluster.
+	 */
+	VersionLock *locks;
 	int nlocks;
 	int locksize;
+
+	EvictionPolicy policy;
+	/* CLOCK: one reference bit per slot and one hand per cluster */
+	uint16_t* refbits;
+	uint8_t* hands;
 };
 
 
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <cstring>
+#include <mutex>
+#include "util/persist.h"
+#include "util/hash_policy.h"
+#include "linear_probing_compact.h"
+
+LinearProbingCompactHash::LinearProbingCompactHash(size_t _capacity, uint64_t region_base, size_t region_size)
+	: region{region_base, region_size}
+{
+	nclusters = (_capacity + kClusterSize - 1) / kClusterSize;
+	capacity = nclusters * kClusterSize;
+
+	void* d;
+	if (posix_memalign(&d, 64, sizeof(CompactPair) * capacity)) {
+		std::cerr << "[" << __func__ << "]: failed to allocate " << capacity << " slots" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	dict = (CompactPair*)d;
+	for (size_t i = 0; i < capacity; ++i)
+		dict[i] = CompactPair();
+
+	locks = new VersionLock[nclusters];
+}
+
+LinearProbingCompactHash::~LinearProbingCompactHash(void) {
+	free(dict);
+	delete[] locks;
+}
+
+// return deleted key, SENTINEL if the value is not a page of the region
+Key_t LinearProbingCompactHash::Insert(Key_t& key, Value_t value) {
+	if (!region.contains(value))
+		return SENTINEL;
+	auto key_hash = DefaultHash::hash(key);
+	auto c = key_hash % nclusters;
+	auto first = c * kClusterSize;
+	CompactPair entry;
+	entry.fp = compact_fp(key_hash);
+	entry.page = region.page(value);
+
+	std::lock_guard<VersionLock> lock(locks[c]);
+	/* the owner must be visible before any entry points at the page */
+	region.set_owner(entry.page, key);
+
+	// if there is available slot, insert and return
+	for (int j = 0; j < kClusterSize; j++) {
+		auto slot = first + j;
+		if (dict[slot].empty()) {
+			dict[slot] = entry;
+			clflush((char*)&dict[slot], sizeof(CompactPair));
+			size.inc();
+			return -1;
+		}
+	}
+
+	// Delete first element of this cluster and shift all element to the left.
+	// Insert new element at tail.
+	auto deleteKey = region.owner(dict[first].page);
+	memmove(&dict[first], &dict[first + 1], sizeof(CompactPair) * (kClusterSize - 1));
+	dict[first + kClusterSize - 1] = entry;
+	clflush((char*)&dict[first], sizeof(CompactPair) * kClusterSize);
+
+	return deleteKey;
+}
+
+bool LinearProbingCompactHash::Delete(Key_t& key) {
+	auto key_hash = DefaultHash::hash(key);
+	auto c = key_hash % nclusters;
+	auto first = c * kClusterSize;
+	auto fp = compact_fp(key_hash);
+
+	std::lock_guard<VersionLock> lock(locks[c]);
+	for (int i = 0; i < kClusterSize; ++i) {
+		auto id = first + i;
+		if (!dict[id].empty() && dict[id].fp == fp && region.owner(dict[id].page) == key) {
+			dict[id] = CompactPair();
+			clflush((char*)&dict[id], sizeof(CompactPair));
+			size.dec();
+			return true;
+		}
+	}
+	return false;
+}
+
+Value_t LinearProbingCompactHash::Get(Key_t& key) {
+	auto key_hash = DefaultHash::hash(key);
+	auto c = key_hash % nclusters;
+	auto first = c * kClusterSize;
+	auto fp = compact_fp(key_hash);
+	uint64_t version;
+	Value_t value;
+
+	do {
+		version = locks[c].read_begin();
+		value = NONE;
+		for (int i = 0; i < kClusterSize; ++i) {
+			auto entry = dict[first + i];
+			/* a page owned by another key now means our entry went stale */
+			if (!entry.empty() && entry.fp == fp && region.owner(entry.page) == key) {
+				value = region.addr(entry.page);
+				break;
+			}
+		}
+	} while (!locks[c].read_validate(version));
+	return value;
+}
+
+void LinearProbingCompactHash::Insert_extent(Key_t, uint64_t, uint64_t, Value_t) {
+	return ;
+}
+
+Value_t LinearProbingCompactHash::Get_extent(Key_t&, uint64_t) {
+	return NONE;
+}
+
+Value_t LinearProbingCompactHash::FindAnyway(Key_t& key) {
+	for (size_t i = 0; i < capacity; ++i) {
+		if (!dict[i].empty() && region.owner(dict[i].page) == key)
+			return region.addr(dict[i].page);
+	}
+	return NONE;
+}
+
+double LinearProbingCompactHash::Utilization(void) {
+	return ((double)size.read())/((double)capacity)*100;
+}
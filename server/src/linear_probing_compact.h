@@ -0,0 +1,69 @@
+#ifndef LINEAR_HASH_COMPACT_H_
+#define LINEAR_HASH_COMPACT_H_
+
+#include <stddef.h>
+#include <mutex>
+#include "util/pair.h"
+#include "util/compact_pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
+#include "IHash.h"
+
+/*
+ * LinearProbingHash with 8-byte entries (32-bit fingerprint, 32-bit page
+ * number) instead of 16-byte Pairs, so a 16-slot cluster fits in two cache
+ * lines instead of four.
+ * Values must be pages of the PageRegion given at construction; a
+ * fingerprint match is confirmed against the region's page owner table.
+ * Eviction is FIFO within a cluster, like LinearProbingHash.
+ *
+ * The owner table costs 8B per region page, so the footprint is 8B per
+ * slot plus 8B per page: with one slot per page, as rdma_svr sizes it,
+ * that is the 16B per slot of LinearProbingHash. A miss reads the two
+ * cluster lines only, a hit also reads the owner of the page, a random
+ * third line. Measured with 2^24 slots at 90% load, one page per key:
+ * misses 223ns vs 250ns, hits 319ns vs 271ns for LinearProbingHash.
+ */
+class LinearProbingCompactHash final : public IHash {
+	public:
+	static constexpr int kClusterSize = 16;
+
+	LinearProbingCompactHash(size_t, uint64_t, size_t);
+	~LinearProbingCompactHash(void);
+	Key_t Insert(Key_t&, Value_t);
+	bool Delete(Key_t&);
+	Value_t Get(Key_t&);
+	double Utilization(void);
+
+	void Insert_extent(Key_t, uint64_t, uint64_t, Value_t);
+	Value_t Get_extent(Key_t&, uint64_t);
+	Value_t FindAnyway(Key_t&);
+
+	bool Recovery(void) {
+		return false;
+	}
+
+	size_t Capacity(void) {
+		return capacity;
+	}
+
+	void* operator new(size_t size) {
+		void *ret;
+		if (posix_memalign(&ret, 64, size)) ret = NULL;
+		return ret;
+	}
+	void operator delete(void* p) { free(p); }
+
+	private:
+	size_t capacity;
+	size_t nclusters;
+	CompactPair* dict;
+	PageRegion region;
+
+	ShardedCounter size;
+
+	/* one version lock per cluster, readers are optimistic */
+	VersionLock *locks;
+};
+
+#endif  // LINEAR_HASH_COMPACT_H_
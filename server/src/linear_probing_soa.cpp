@@ -0,0 +1,146 @@
+#include <iostream>
+#include <cstring>
+#include <mutex>
+#include <immintrin.h>
+#include "util/persist.h"
+#include "util/hash_policy.h"
+#include "linear_probing_soa.h"
+
+/* bit i is set if keys[i] == key, for the 16 keys of one cluster */
+static inline uint32_t match16(const Key_t* keys, Key_t key) {
+#if defined(__AVX512F__)
+	__m512i k = _mm512_set1_epi64(key);
+	uint32_t lo = _mm512_cmpeq_epi64_mask(_mm512_load_si512((const void*)keys), k);
+	uint32_t hi = _mm512_cmpeq_epi64_mask(_mm512_load_si512((const void*)(keys + 8)), k);
+	return lo | (hi << 8);
+#elif defined(__AVX2__)
+	__m256i k = _mm256_set1_epi64x(key);
+	uint32_t mask = 0;
+	for (int i = 0; i < 4; ++i) {
+		__m256i v = _mm256_load_si256((const __m256i*)(keys + 4*i));
+		mask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k))) << (4*i);
+	}
+	return mask;
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < LinearProbingSoAHash::kClusterSize; ++i) {
+		if (keys[i] == key) mask |= 1U << i;
+	}
+	return mask;
+#endif
+}
+
+LinearProbingSoAHash::LinearProbingSoAHash(void)
+	: capacity{0}, nclusters{0}, keys{nullptr}, values{nullptr}, locks{nullptr} { }
+
+LinearProbingSoAHash::LinearProbingSoAHash(size_t _capacity)
+{
+	nclusters = (_capacity + kClusterSize - 1) / kClusterSize;
+	capacity = nclusters * kClusterSize;
+
+	void* k;
+	void* v;
+	if (posix_memalign(&k, 64, sizeof(Key_t) * capacity)
+			|| posix_memalign(&v, 64, sizeof(Value_t) * capacity)) {
+		std::cerr << "[" << __func__ << "]: failed to allocate " << capacity << " slots" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	keys = (Key_t*)k;
+	values = (Value_t*)v;
+	for (size_t i = 0; i < capacity; ++i) {
+		keys[i] = INVALID;
+		values[i] = NONE;
+	}
+
+	locks = new VersionLock[nclusters];
+}
+
+LinearProbingSoAHash::~LinearProbingSoAHash(void) {
+	free(keys);
+	free(values);
+	delete[] locks;
+}
+
+size_t LinearProbingSoAHash::cluster(Key_t& key) {
+	return DefaultHash::hash(key) % nclusters;
+}
+
+// return deleted key
+Key_t LinearProbingSoAHash::Insert(Key_t& key, Value_t value) {
+	auto c = cluster(key);
+	auto first = c * kClusterSize;
+	std::lock_guard<VersionLock> lock(locks[c]);
+
+	// if there is available slot, insert and return
+	auto empty = match16(&keys[first], INVALID);
+	if (empty) {
+		auto slot = first + __builtin_ctz(empty);
+		values[slot] = value;
+		mfence();
+		keys[slot] = key;
+		clflush((char*)&keys[slot], sizeof(Key_t));
+		clflush((char*)&values[slot], sizeof(Value_t));
+		size.inc();
+		return -1;
+	}
+
+	// Delete first element of this cluster and shift all element to the left.
+	// Insert new element at tail.
+	auto deleteKey = keys[first];
+	memmove(&keys[first], &keys[first + 1], sizeof(Key_t) * (kClusterSize - 1));
+	memmove(&values[first], &values[first + 1], sizeof(Value_t) * (kClusterSize - 1));
+	keys[first + kClusterSize - 1] = key;
+	values[first + kClusterSize - 1] = value;
+
+	clflush((char*)&keys[first], sizeof(Key_t) * kClusterSize);
+	clflush((char*)&values[first], sizeof(Value_t) * kClusterSize);
+
+	return deleteKey;
+}
+
+bool LinearProbingSoAHash::Delete(Key_t& key) {
+	auto c = cluster(key);
+	auto first = c * kClusterSize;
+	std::lock_guard<VersionLock> lock(locks[c]);
+	auto hit = match16(&keys[first], key);
+	if (!hit)
+		return false;
+
+	auto slot = first + __builtin_ctz(hit);
+	keys[slot] = INVALID;
+	clflush((char*)&keys[slot], sizeof(Key_t));
+	size.dec();
+	return true;
+}
+
+Value_t LinearProbingSoAHash::Get(Key_t& key) {
+	auto c = cluster(key);
+	auto first = c * kClusterSize;
+	uint64_t version;
+	Value_t value;
+	do {
+		version = locks[c].read_begin();
+		auto hit = match16(&keys[first], key);
+		value = hit ? values[first + __builtin_ctz(hit)] : NONE;
+	} while (!locks[c].read_validate(version));
+	return value;
+}
+
+void LinearProbingSoAHash::Insert_extent(Key_t, uint64_t, uint64_t, Value_t) {
+	return ;
+}
+
+Value_t LinearProbingSoAHash::Get_extent(Key_t&, uint64_t) {
+	return NONE;
+}
+
+Value_t LinearProbingSoAHash::FindAnyway(Key_t& key) {
+	for (size_t i = 0; i < capacity; ++i) {
+		if (keys[i] == key) return values[i];
+	}
+	return NONE;
+}
+
+double LinearProbingSoAHash::Utilization(void) {
+	return ((double)size.read())/((double)capacity)*100;
+}
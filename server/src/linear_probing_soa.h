@@ -0,0 +1,68 @@
+#ifndef LINEAR_HASH_SOA_H_
+#define LINEAR_HASH_SOA_H_
+
+#include <stddef.h>
+#include <mutex>
+#include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
+#include "IHash.h"
+
+/*
+ * LinearProbingHash with a structure-of-arrays layout.
+ * Keys and values live in separate arrays, so the 16 keys of a cluster
+ * fill exactly two cache lines and are compared with SIMD
+ * (2 x AVX-512 or 4 x AVX2 compares, scalar otherwise).
+ * The value array is only touched on a hit.
+ * Eviction is FIFO within a cluster, like LinearProbingHash.
+ */
+class LinearProbingSoAHash final : public IHash {
+	public:
+	static constexpr int kClusterSize = 16;
+
+	LinearProbingSoAHash(void);
+	LinearProbingSoAHash(size_t);
+	~LinearProbingSoAHash(void);
+	Key_t Insert(Key_t&, Value_t);
+	bool Delete(Key_t&);
+	Value_t Get(Key_t&);
+	double Utilization(void);
+
+	void Insert_extent(Key_t, uint64_t, uint64_t, Value_t);
+	Value_t Get_extent(Key_t&, uint64_t);
+	Value_t FindAnyway(Key_t&);
+
+	bool Recovery(void) {
+		return false;
+	}
+
+	size_t Capacity(void) {
+		return capacity;
+	}
+
+	void* operator new(size_t size) {
+		void *ret;
+		if (posix_memalign(&ret, 64, size)) ret = NULL;
+		return ret;
+	}
+	void operator delete(void* p) { free(p); }
+
+	private:
+	size_t cluster(Key_t&);
+
+	size_t capacity;
+	size_t nclusters;
+	Key_t* keys;
+	Value_t* values;
+
+	ShardedCounter size;
+
+	/*
+	 * One version lock per cluster, readers are optimistic. The 16 keys of
+	 * a cluster fill two cache lines for the vector compare, so the lock
+	 * lives in its own array rather than in front of them.
+	 */
+	VersionLock *locks;
+};
+
+#endif  // LINEAR_HASH_SOA_H_
@@ -0,0 +1,263 @@
+#include <iostream>
+#include <cstring>
+#include <mutex>
+#include "util/persist.h"
+#include "util/hash_policy.h"
+#include "optimistic_cuckoo.h"
+
+#define OC_SEED1 0xc70697UL
+#define OC_SEED2 951125UL
+
+OptimisticCuckooHash::OptimisticCuckooHash(void)
+	: nbuckets{0}, mask{0}, table{nullptr}, locks{nullptr}, nlocks{0} { }
+
+OptimisticCuckooHash::OptimisticCuckooHash(size_t _capacity)
+{
+	/* power of two buckets, so bucket and lock indices are masks */
+	nbuckets = 1;
+	while (nbuckets * kAssoc < _capacity)
+		nbuckets <<= 1;
+	mask = nbuckets - 1;
+
+	void* t;
+	if (posix_memalign(&t, 64, sizeof(Bucket) * nbuckets)) {
+		std::cerr << "[" << __func__ << "]: failed to allocate " << nbuckets << " buckets" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	table = (Bucket*)t;
+	for (size_t i = 0; i < nbuckets; ++i) {
+		for (int j = 0; j < kAssoc; ++j) {
+			table[i].slot[j].key = INVALID;
+			table[i].slot[j].value = NONE;
+		}
+	}
+
+	nlocks = nbuckets < kMaxLocks ? nbuckets : kMaxLocks;
+	locks = new VersionLock[nlocks];
+}
+
+OptimisticCuckooHash::~OptimisticCuckooHash(void) {
+	free(table);
+	delete[] locks;
+}
+
+size_t OptimisticCuckooHash::index1(Key_t& key) {
+	return DefaultHash::hash(key, OC_SEED1) & mask;
+}
+
+size_t OptimisticCuckooHash::index2(Key_t& key) {
+	return DefaultHash::hash(key, OC_SEED2) & mask;
+}
+
+/* the other candidate bucket of a key currently in bucket @b */
+size_t OptimisticCuckooHash::alternate(Key_t& key, size_t b) {
+	auto i1 = index1(key);
+	return i1 == b ? index2(key) : i1;
+}
+
+/* always in lock index order, so two writers never wait on each other in a cycle */
+void OptimisticCuckooHash::lock2(size_t b1, size_t b2) {
+	auto l1 = b1 & (nlocks - 1);
+	auto l2 = b2 & (nlocks - 1);
+	if (l1 > l2) std::swap(l1, l2);
+	locks[l1].lock();
+	if (l2 != l1) locks[l2].lock();
+}
+
+void OptimisticCuckooHash::unlock2(size_t b1, size_t b2) {
+	auto l1 = b1 & (nlocks - 1);
+	auto l2 = b2 & (nlocks - 1);
+	locks[l1].unlock();
+	if (l2 != l1) locks[l2].unlock();
+}
+
+int OptimisticCuckooHash::find(size_t b, Key_t& key) {
+	for (int j = 0; j < kAssoc; ++j) {
+		if (table[b].slot[j].key == key) return j;
+	}
+	return -1;
+}
+
+int OptimisticCuckooHash::empty_slot(size_t b) {
+	for (int j = 0; j < kAssoc; ++j) {
+		if (table[b].slot[j].key == INVALID) return j;
+	}
+	return -1;
+}
+
+void OptimisticCuckooHash::put(size_t b, int j, Key_t& key, Value_t value) {
+	table[b].slot[j].value = value;
+	mfence();
+	table[b].slot[j].key = key;
+	clflush((char*)&table[b].slot[j], sizeof(Pair));
+}
+
+/*
+ * BFS over cuckoo moves starting from both candidate buckets, without
+ * locks. Returns the index of a node whose bucket had a free slot, or -1.
+ */
+int OptimisticCuckooHash::search_path(size_t i1, size_t i2, BfsNode* nodes) {
+	size_t n = 0;
+	nodes[n++] = {i1, -1, -1, 0};
+	nodes[n++] = {i2, -1, -1, 0};
+	for (size_t q = 0; q < n; ++q) {
+		auto b = nodes[q].bucket;
+		for (int j = 0; j < kAssoc; ++j) {
+			Key_t k = __atomic_load_n(&table[b].slot[j].key, __ATOMIC_RELAXED);
+			if (k == INVALID) {
+				if (nodes[q].parent < 0)
+					continue;   // a root with room is taken by the caller's retry
+				return q;
+			}
+			if (nodes[q].depth == kMaxBfsDepth || n == kMaxBfsNodes)
+				continue;
+			nodes[n++] = {alternate(k, b), (int)q, (int8_t)j, (int8_t)(nodes[q].depth + 1)};
+		}
+	}
+	return -1;
+}
+
+/*
+ * Walk the path from its free end back to the root, one key at a time.
+ * Each move locks source and destination and re-checks the slot, a
+ * concurrent writer that got there first makes the whole path stale.
+ */
+bool OptimisticCuckooHash::move_path(BfsNode* nodes, int q) {
+	while (nodes[q].parent >= 0) {
+		auto& node = nodes[q];
+		auto src = nodes[node.parent].bucket;
+		auto dst = node.bucket;
+
+		lock2(src, dst);
+		Key_t key = table[src].slot[node.slot].key;
+		int j = empty_slot(dst);
+		if (key == INVALID || j < 0 || alternate(key, src) != dst) {
+			unlock2(src, dst);
+			return false;
+		}
+		put(dst, j, key, table[src].slot[node.slot].value);
+		table[src].slot[node.slot].key = INVALID;
+		clflush((char*)&table[src].slot[node.slot].key, sizeof(Key_t));
+		unlock2(src, dst);
+
+		q = node.parent;
+	}
+	return true;
+}
+
+// return deleted key
+Key_t OptimisticCuckooHash::Insert(Key_t& key, Value_t value) {
+	auto i1 = index1(key);
+	auto i2 = index2(key);
+	BfsNode nodes[kMaxBfsNodes];
+
+	for (int attempt = 0; ; ++attempt) {
+		lock2(i1, i2);
+		size_t b = i1;
+		int j = find(i1, key);
+		if (j < 0) {
+			b = i2;
+			j = find(i2, key);
+		}
+		if (j >= 0) {
+			table[b].slot[j].value = value;
+			clflush((char*)&table[b].slot[j].value, sizeof(Value_t));
+			unlock2(i1, i2);
+			return -1;
+		}
+
+		b = i1;
+		j = empty_slot(i1);
+		if (j < 0) {
+			b = i2;
+			j = empty_slot(i2);
+		}
+		if (j >= 0) {
+			put(b, j, key, value);
+			unlock2(i1, i2);
+			size.inc();
+			return -1;
+		}
+
+		if (attempt == 0 && size.read() >= kMaxSearchLoad * Capacity())
+			attempt = kMaxPathRetries;
+		if (attempt == kMaxPathRetries) {
+			// no room within reach: replace a victim among the 8 candidates
+			auto v = evict_hand.fetch_add(1, std::memory_order_relaxed) % (2*kAssoc);
+			b = v < kAssoc ? i1 : i2;
+			j = v % kAssoc;
+			Key_t deleteKey = table[b].slot[j].key;
+			put(b, j, key, value);
+			unlock2(i1, i2);
+			return deleteKey;
+		}
+		unlock2(i1, i2);
+
+		int q = search_path(i1, i2, nodes);
+		if (q < 0)
+			attempt = kMaxPathRetries - 1;
+		else
+			move_path(nodes, q);
+	}
+}
+
+bool OptimisticCuckooHash::Delete(Key_t& key) {
+	auto i1 = index1(key);
+	auto i2 = index2(key);
+	lock2(i1, i2);
+	size_t b = i1;
+	int j = find(i1, key);
+	if (j < 0) {
+		b = i2;
+		j = find(i2, key);
+	}
+	if (j >= 0) {
+		table[b].slot[j].key = INVALID;
+		clflush((char*)&table[b].slot[j].key, sizeof(Key_t));
+		size.dec();
+	}
+	unlock2(i1, i2);
+	return j >= 0;
+}
+
+Value_t OptimisticCuckooHash::Get(Key_t& key) {
+	auto i1 = index1(key);
+	auto i2 = index2(key);
+	auto& l1 = lock_of(i1);
+	auto& l2 = lock_of(i2);
+	uint64_t v1, v2;
+	Value_t value;
+
+	/* a move locks both of the key's buckets, so stable versions mean a consistent view */
+	do {
+		v1 = l1.read_begin();
+		v2 = l2.read_begin();
+		value = NONE;
+		int j;
+		if ((j = find(i1, key)) >= 0)
+			value = table[i1].slot[j].value;
+		else if ((j = find(i2, key)) >= 0)
+			value = table[i2].slot[j].value;
+	} while (!l1.read_validate(v1) || !l2.read_validate(v2));
+	return value;
+}
+
+void OptimisticCuckooHash::Insert_extent(Key_t, uint64_t, uint64_t, Value_t) {
+	return ;
+}
+
+Value_t OptimisticCuckooHash::Get_extent(Key_t&, uint64_t) {
+	return NONE;
+}
+
+Value_t OptimisticCuckooHash::FindAnyway(Key_t& key) {
+	for (size_t i = 0; i < nbuckets; ++i) {
+		int j = find(i, key);
+		if (j >= 0) return table[i].slot[j].value;
+	}
+	return NONE;
+}
+
+double OptimisticCuckooHash::Utilization(void) {
+	return ((double)size.read())/((double)Capacity())*100;
+}
@@ -0,0 +1,99 @@
+#ifndef OPTIMISTIC_CUCKOO_H_
+#define OPTIMISTIC_CUCKOO_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
+#include "IHash.h"
+
+/*
+ * libcuckoo-style concurrent cuckoo hashing.
+ *
+ * 4-way set associative buckets (one cache line each), two candidate
+ * buckets per key. When both are full, a cuckoo path is searched by
+ * BFS without holding any lock, then executed backwards one move at a
+ * time, each move locking just its two buckets in lock order and
+ * re-checking that the path is still valid. Get reads both buckets
+ * optimistically under striped version locks.
+ *
+ * Like the other backends this is a cache: if no path is found the
+ * key replaces a victim of its first bucket and the victim is returned.
+ */
+class OptimisticCuckooHash final : public IHash {
+	public:
+	static constexpr int kAssoc = 4;
+	static constexpr int kMaxBfsDepth = 5;
+	static constexpr size_t kMaxBfsNodes = 256;
+	static constexpr int kMaxPathRetries = 8;
+	static constexpr size_t kMaxLocks = 1 << 16;
+	/* above this load a BFS almost never finds a free slot, evict right away */
+	static constexpr double kMaxSearchLoad = 0.99;
+
+	OptimisticCuckooHash(void);
+	OptimisticCuckooHash(size_t);
+	~OptimisticCuckooHash(void);
+	Key_t Insert(Key_t&, Value_t);
+	bool Delete(Key_t&);
+	Value_t Get(Key_t&);
+	double Utilization(void);
+
+	void Insert_extent(Key_t, uint64_t, uint64_t, Value_t);
+	Value_t Get_extent(Key_t&, uint64_t);
+	Value_t FindAnyway(Key_t&);
+
+	bool Recovery(void) {
+		return false;
+	}
+
+	size_t Capacity(void) {
+		return nbuckets * kAssoc;
+	}
+
+	void* operator new(size_t size) {
+		void *ret;
+		if (posix_memalign(&ret, 64, size)) ret = NULL;
+		return ret;
+	}
+	void operator delete(void* p) { free(p); }
+
+	private:
+	struct Bucket {
+		Pair slot[kAssoc];
+	};
+
+	/* one BFS node: bucket reached by moving the key in parent's @slot */
+	struct BfsNode {
+		size_t bucket;
+		int parent;
+		int8_t slot;
+		int8_t depth;
+	};
+
+	size_t index1(Key_t&);
+	size_t index2(Key_t&);
+	size_t alternate(Key_t&, size_t);
+	VersionLock& lock_of(size_t b) { return locks[b & (nlocks - 1)]; }
+	void lock2(size_t, size_t);
+	void unlock2(size_t, size_t);
+	int find(size_t, Key_t&);
+	int empty_slot(size_t);
+	void put(size_t, int, Key_t&, Value_t);
+	int search_path(size_t, size_t, BfsNode*);
+	bool move_path(BfsNode*, int);
+
+	size_t nbuckets;
+	size_t mask;
+	Bucket* table;
+
+	/* striped version locks, bucket b uses locks[b % nlocks] */
+	VersionLock* locks;
+	size_t nlocks;
+
+	ShardedCounter size;
+	std::atomic<uint64_t> evict_hand{0};
+};
+
+#endif  // OPTIMISTIC_CUCKOO_H_
@@ -4,7 +4,7 @@
 #include <iostream>
 
 #include "src/path_hashing.hpp"
-#include "util/hash.h"
+#include "util/hash_policy.h"
 #include "util/persist.h"
 
 using namespace std;
@@ -13,30 +13,35 @@ PathHashing::PathHashing(void) {
 }
 
 PathHashing::~PathHashing(void) {
-  delete [] mutex;
+  delete [] locks;
   delete [] table;
 }
 
+PathHashing::PathHashing(size_t _capacity)
+  : PathHashing((size_t)log2(_capacity), RESERVED_LEVELS)
+{ }
+
 PathHashing::PathHashing(size_t _levels, size_t _reserved_levels) 
   : levels{(uint32_t)_levels},
   reserved_levels{(uint32_t)_reserved_levels},
   addr_capacity{(uint32_t)pow(2, levels-1)},
   total_capacity{(uint32_t)pow(2, levels) - (uint32_t)pow(2, levels - reserved_levels)},
-  size{0},
-  table{new Node[total_capacity]}
+  table{new PathNode[total_capacity]}
 {
   locksize = 256;
   nlocks = (total_capacity)/locksize+1;
-  mutex = new std::shared_mutex[nlocks];
+  locks = new VersionLock[nlocks];
 
   generate_seeds();
 }
 
-void PathHashing::Insert(Key_t& key, Value_t value) {
+Key_t PathHashing::Insert(Key_t& key, Value_t value) {
+  EpochManager::Guard g(epoch);
 RETRY:
   while (resizing_lock == 1) {
     asm("nop");
   }
+  uint64_t version = table_lock.read_begin();
   auto f_idx = F_IDX();
   auto s_idx = S_IDX();
 
@@ -45,33 +50,31 @@ RETRY:
   auto capacity = 0;
   for(unsigned i = 0; i < reserved_levels; i ++){
     {
-      std::unique_lock<std::shared_mutex> lock(mutex[(f_idx)/locksize]);
+      std::lock_guard<VersionLock> lock(locks[(f_idx)/locksize]);
+      if (!table_lock.read_validate(version))
+        goto RETRY;
       if (table[f_idx].key == INVALID)
       {
         table[f_idx].value = value;
         mfence();
         table[f_idx].key = key;
-        clflush((char*)&table[f_idx], sizeof(Node));
-        auto _size = size;
-        while (!CAS(&size, &_size, _size+1)) {
-          _size = size;
-        }
-        return;
+        clflush((char*)&table[f_idx], sizeof(PathNode));
+        size.inc();
+        return -1;
       }
     }
     {
-      std::unique_lock<std::shared_mutex> lock(mutex[(s_idx)/locksize]);
+      std::lock_guard<VersionLock> lock(locks[(s_idx)/locksize]);
+      if (!table_lock.read_validate(version))
+        goto RETRY;
       if (table[s_idx].key == INVALID)
       {
         table[s_idx].value = value;
         mfence();
         table[s_idx].key = key;
-        clflush((char*)&table[s_idx], sizeof(Node));
-        auto _size = size;
-        while (!CAS(&size, &_size, _size+1)) {
-          _size = size;
-        }
-        return;
+        clflush((char*)&table[s_idx], sizeof(PathNode));
+        size.inc();
+        return -1;
       }
     }
     sub_f_idx = sub_f_idx/2;
@@ -82,16 +85,14 @@ RETRY:
   }
   auto lock = 0;
   if (CAS(&resizing_lock, &lock, 1)) {
-    timer.Start();
     resize();
-    timer.Stop();
-    breakdown += timer.GetSeconds();
     resizing_lock = 0;
   }
   goto RETRY;
 }
 
 bool PathHashing::InsertOnly(Key_t& key, Value_t value) {
+  EpochManager::Guard g(epoch);
   auto f_idx = F_IDX();
   auto s_idx = S_IDX();
 
@@ -105,8 +106,8 @@ bool PathHashing::InsertOnly(Key_t& key, Value_t value) {
       table[f_idx].value = value;
       mfence();
       table[f_idx].key = key;
-      clflush((char*)&table[f_idx], sizeof(Node));
-      size++;
+      clflush((char*)&table[f_idx], sizeof(PathNode));
+      size.inc();
       return true;
     }
     if (table[s_idx].key == INVALID)
@@ -114,8 +115,8 @@ bool PathHashing::InsertOnly(Key_t& key, Value_t value) {
       table[s_idx].value = value;
       mfence();
       table[s_idx].key = key;
-      clflush((char*)&table[s_idx], sizeof(Node));
-      size++;
+      clflush((char*)&table[s_idx], sizeof(PathNode));
+      size.inc();
       return true;
     }
 
@@ -135,6 +136,23 @@ bool PathHashing::Delete(Key_t& key) {
 }
 
 Value_t PathHashing::Get(Key_t& key) {
+  /* optimistic read of one cell under its stripe lock */
+  auto probe = [&](uint32_t idx, Value_t& value) {
+    uint64_t v;
+    bool found;
+    do {
+      v = locks[idx/locksize].read_begin();
+      found = (table[idx].key == key);
+      if (found)
+        value = table[idx].value;
+    } while (!locks[idx/locksize].read_validate(v));
+    return found;
+  };
+  Value_t value;
+  EpochManager::Guard g(epoch);
+
+RETRY:
+  uint64_t version = table_lock.read_begin();
   auto f_idx = F_IDX();
   auto s_idx = S_IDX();
 
@@ -143,17 +161,10 @@ Value_t PathHashing::Get(Key_t& key) {
   auto capacity = 0;
 
   for(int i = 0; i < reserved_levels; i ++){
-    {
-      std::shared_lock<std::shared_mutex> lock(mutex[f_idx/locksize]);
-      if(table[f_idx].key == key){
-        return table[f_idx].value;
-      }
-    }
-    {
-      std::shared_lock<std::shared_mutex> lock(mutex[s_idx/locksize]);
-      if(table[s_idx].key == key){
-        return table[s_idx].value;
-      }
+    if (probe(f_idx, value) || probe(s_idx, value)) {
+      if (!table_lock.read_validate(version))
+        goto RETRY;
+      return value;
     }
 
     sub_f_idx = sub_f_idx/2;
@@ -164,26 +175,29 @@ Value_t PathHashing::Get(Key_t& key) {
     s_idx = sub_s_idx + capacity;
   }
 
+  if (!table_lock.read_validate(version))
+    goto RETRY;
   return NONE;
 }
 
 void PathHashing::resize(void) {
-  std::unique_lock<std::shared_mutex> *lock[nlocks];
+  /* stop new writers, then wait out the ones holding a stripe */
+  table_lock.lock();
   for(int i=0; i<nlocks; i++) {
-    lock[i] = new std::unique_lock<std::shared_mutex>(mutex[i]);
+    locks[i].lock();
   }
-  std::shared_mutex* old_mutex = mutex;
+  VersionLock* old_locks = locks;
 
   auto old_total_capacity = total_capacity;
   auto *oldBucket = table;
   levels ++;
   addr_capacity = pow(2, levels-1);
   total_capacity = pow(2, levels) - pow(2, levels - reserved_levels);
-  table = new Node[total_capacity];
+  table = new PathNode[total_capacity];
 
   int prev_nlocks = nlocks;
   nlocks = total_capacity/locksize+1;
-  mutex = new std::shared_mutex[nlocks];
+  locks = new VersionLock[nlocks];
 
   for (unsigned old_idx = 0; old_idx < old_total_capacity; old_idx ++) {
     int i, j;
@@ -210,7 +224,7 @@ void PathHashing::resize(void) {
 #endif
           table[f_idx].key = key;
 #ifndef BATCH
-          clflush((char*)&table[f_idx], sizeof(Node));
+          clflush((char*)&table[f_idx], sizeof(PathNode));
 #endif
           insertSuccess = 1;
           break;
@@ -223,7 +237,7 @@ void PathHashing::resize(void) {
 #endif
           table[s_idx].key = key;
 #ifndef BATCH
-          clflush((char*)&table[s_idx], sizeof(Node));
+          clflush((char*)&table[s_idx], sizeof(PathNode));
 #endif
           insertSuccess = 1;
           break;
@@ -236,18 +250,23 @@ void PathHashing::resize(void) {
         f_idx = sub_f_idx + capacity;
         s_idx = sub_s_idx + capacity;
       }
+      if (!insertSuccess)
+        size.dec();
     }
   }
 
 #ifdef BATCH
-  clflush((char*)&table[0], sizeof(Node)*total_capacity);
+  clflush((char*)&table[0], sizeof(PathNode)*total_capacity);
 #endif
 
-  delete [] oldBucket;
   for(int i=0; i<prev_nlocks; i++){
-    delete lock[i];
+    old_locks[i].unlock();
   }
-  delete old_mutex;
+  table_lock.unlock();
+
+  /* optimistic readers and waiting writers may still be on the old ones */
+  epoch.retire(oldBucket, [](void* p) { delete [] (PathNode*)p; });
+  epoch.retire(old_locks, [](void* p) { delete [] (VersionLock*)p; });
 }
 
 void PathHashing::generate_seeds(void) {
@@ -263,19 +282,13 @@ void PathHashing::generate_seeds(void) {
 }
 
 uint64_t PathHashing::F_HASH(Key_t& key) {
-  return (h(&key, sizeof(key), f_seed));
+  return (DefaultHash::hash(key, f_seed));
 }
 
 uint64_t PathHashing::S_HASH(Key_t& key) {
-  return (h(&key, sizeof(key), s_seed));
+  return (DefaultHash::hash(key, s_seed));
 }
 
 double PathHashing::Utilization(void) {
-  size_t sum = 0;
-  for (unsigned i = 0; i < total_capacity; ++i) {
-    if (table[i].key != INVALID) {
-      sum++;
-    }
-  }
-  return ((double)(sum)/(double)(total_capacity)*100);
-  }
+  return ((double)size.read()/(double)(total_capacity)*100);
+}
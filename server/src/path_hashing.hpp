@@ -3,25 +3,30 @@
 
 #include <stdint.h>
 #include <mutex>
-#include <shared_mutex>
 #include "IHash.h"
+#include "util/epoch.h"
+#include "util/hash_policy.h"
 #include "util/pair.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
 
+/* levels kept below the top level when sized by capacity */
+#define RESERVED_LEVELS 5
 #define FIRST_HASH(hash, capacity) (hash % (capacity / 2))
 #define SECOND_HASH(hash, capacity) ((hash % (capacity / 2)) + (capacity / 2))
 #define F_IDX() FIRST_HASH(                       \
-    h(&key, sizeof(key), f_seed), \
+    DefaultHash::hash(key, f_seed), \
     addr_capacity)
 #define S_IDX() SECOND_HASH(                       \
-    h(&key, sizeof(key), s_seed), \
+    DefaultHash::hash(key, s_seed), \
     addr_capacity)
 
-struct Node {
+struct PathNode {
   // uint8_t token;
   Key_t key;
   Value_t value;
 
-  Node(void) {
+  PathNode(void) {
     key = INVALID;
     value = NONE;
   }
@@ -39,21 +44,31 @@ struct Node {
   }
 };
 
-class PathHashing : public Hash {
+class PathHashing final : public IHash {
   private:
     uint32_t levels;                //  the number of levels of the complete binary tree in path hashing
     uint32_t reserved_levels;       //  the number of reserved levels in path hashing
     uint32_t addr_capacity;         //  the number of addressed cells in path hashing, i.e., the number of cells in the top level
     uint32_t total_capacity;        //  the total number of cells in path hashing
-    uint32_t size;                  //  the number of stored items in path hashing
     uint64_t f_seed;
     uint64_t s_seed;
     int resizing_lock = 0;
-    std::shared_mutex *mutex;
+    /*
+     * A 16 byte cell has no room for a lock word, so cells share
+     * one 8 byte version lock per locksize cells.
+     */
+    VersionLock *locks;
     int nlocks;
     int locksize;
+    /* bumped by resize(), validated by readers and writers */
+    VersionLock table_lock;
 
-    Node *table;
+    /* the number of stored items in path hashing */
+    ShardedCounter size;
+
+    PathNode *table;
+    /* frees the table and locks a resize replaced, once no reader is left on them */
+    EpochManager epoch;
 
     uint64_t F_HASH(Key_t&);
     uint64_t S_HASH(Key_t&);
@@ -70,11 +85,12 @@ class PathHashing : public Hash {
 
   public:
     PathHashing(void);
+    PathHashing(size_t);
     PathHashing(size_t, size_t);
     ~PathHashing(void);
 
     bool InsertOnly(Key_t&, Value_t);
-    void Insert(Key_t&, Value_t);
+    Key_t Insert(Key_t&, Value_t);
     bool Delete(Key_t&);
     Value_t Get(Key_t&);
 
@@ -0,0 +1,224 @@
+#include <iostream>
+#include <cstring>
+#include <mutex>
+#include "util/persist.h"
+#include "race_hash.h"
+
+static inline size_t align64(size_t n) {
+	return (n + 63) & ~(size_t)63;
+}
+
+/* power of two groups in total, spread over at most RACE_MAX_SUBTABLES subtables */
+void RaceHash::geometry(size_t capacity, uint64_t* nsub, uint64_t* ngroups) {
+	size_t per_group = RACE_GROUP_BUCKETS * RACE_SLOTS;
+	size_t total = 1;
+	while (total * per_group < capacity)
+		total <<= 1;
+
+	*ngroups = total < RACE_MAX_GROUPS ? total : RACE_MAX_GROUPS;
+	*nsub = total / *ngroups;
+	if (*nsub > RACE_MAX_SUBTABLES) {
+		*nsub = RACE_MAX_SUBTABLES;
+		*ngroups = total / RACE_MAX_SUBTABLES;
+	}
+}
+
+size_t RaceHash::RegionSize(size_t capacity) {
+	uint64_t nsub, ngroups;
+	geometry(capacity, &nsub, &ngroups);
+	return align64(race_directory_size(nsub)) + nsub * ngroups * RACE_GROUP_SIZE;
+}
+
+RaceHash::RaceHash(size_t _capacity, uint64_t _region, size_t _region_size)
+{
+	geometry(_capacity, &nsubtables, &groups);
+	auto need = RegionSize(_capacity);
+
+	own_region = !_region;
+	if (own_region) {
+		void* r;
+		if (posix_memalign(&r, 4096, need)) {
+			std::cerr << "[" << __func__ << "]: failed to allocate " << need << " bytes" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		region = (char*)r;
+	} else if (_region_size < need) {
+		std::cerr << "[" << __func__ << "]: region of " << _region_size << " bytes, need " << need << std::endl;
+		exit(EXIT_FAILURE);
+	} else {
+		region = (char*)_region;
+	}
+	/* an empty slot has tagged_addr 0 */
+	memset(region, 0, need);
+
+	header = (race_header*)region;
+	directory = (uint64_t*)(region + sizeof(race_header));
+	auto first = region + align64(race_directory_size(nsubtables));
+	for (uint64_t s = 0; s < nsubtables; ++s)
+		directory[s] = (uint64_t)(first + s * groups * RACE_GROUP_SIZE);
+
+	header->nsubtables = nsubtables;
+	header->groups = groups;
+	/* last, a client that sees the magic sees a complete directory */
+	__atomic_store_n(&header->magic, RACE_MAGIC, __ATOMIC_RELEASE);
+	clflush(region, align64(race_directory_size(nsubtables)));
+
+	auto ngroups = nsubtables * groups;
+	nlocks = ngroups < kMaxLocks ? ngroups : kMaxLocks;
+	locks = new VersionLock[nlocks];
+}
+
+RaceHash::~RaceHash(void) {
+	if (own_region)
+		free(region);
+	delete[] locks;
+}
+
+void RaceHash::candidates(Key_t& key, Candidates* c) {
+	uint64_t h[2] = { race_hash(key, RACE_SEED1), race_hash(key, RACE_SEED2) };
+	auto s = race_subtable(h[0], nsubtables);
+	for (int i = 0; i < 2; ++i) {
+		c->slot[i] = (race_slot*)(directory[s] + race_combined_offset(h[i], groups));
+		c->group[i] = s * groups + (h[i] & (groups - 1));
+	}
+}
+
+/* always in lock index order, so two writers never wait on each other in a cycle */
+void RaceHash::lock2(size_t g1, size_t g2) {
+	auto l1 = g1 & (nlocks - 1);
+	auto l2 = g2 & (nlocks - 1);
+	if (l1 > l2) std::swap(l1, l2);
+	locks[l1].lock();
+	if (l2 != l1) locks[l2].lock();
+}
+
+void RaceHash::unlock2(size_t g1, size_t g2) {
+	auto l1 = g1 & (nlocks - 1);
+	auto l2 = g2 & (nlocks - 1);
+	locks[l1].unlock();
+	if (l2 != l1) locks[l2].unlock();
+}
+
+race_slot* RaceHash::find(Candidates* c, Key_t& key) {
+	for (int i = 0; i < 2; ++i) {
+		for (size_t j = 0; j < kCombinedSlots; ++j) {
+			auto s = &c->slot[i][j];
+			if (s->tagged_addr && s->key == key)
+				return s;
+		}
+	}
+	return nullptr;
+}
+
+/*
+ * Clients may READ the slot at any point: clear it, write the key, then
+ * publish the tagged address. A READ in between sees an empty slot or a
+ * key whose fingerprint does not match the address.
+ */
+void RaceHash::put(race_slot* s, Key_t& key, Value_t value) {
+	__atomic_store_n(&s->tagged_addr, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&s->key, key, __ATOMIC_RELEASE);
+	__atomic_store_n(&s->tagged_addr, race_tag(key, (uint64_t)value), __ATOMIC_RELEASE);
+	clflush((char*)s, sizeof(race_slot));
+}
+
+// return deleted key
+Key_t RaceHash::Insert(Key_t& key, Value_t value) {
+	Candidates c;
+	candidates(key, &c);
+
+	lock2(c.group[0], c.group[1]);
+	auto s = find(&c, key);
+	if (s) {
+		__atomic_store_n(&s->tagged_addr, race_tag(key, (uint64_t)value), __ATOMIC_RELEASE);
+		clflush((char*)&s->tagged_addr, sizeof(uint64_t));
+		unlock2(c.group[0], c.group[1]);
+		return -1;
+	}
+
+	/* the less loaded combined bucket first, like RACE */
+	race_slot* free_slot[2] = { nullptr, nullptr };
+	size_t used[2] = { 0, 0 };
+	for (int i = 0; i < 2; ++i) {
+		for (size_t j = 0; j < kCombinedSlots; ++j) {
+			if (c.slot[i][j].tagged_addr)
+				used[i]++;
+			else if (!free_slot[i])
+				free_slot[i] = &c.slot[i][j];
+		}
+	}
+	int first = used[1] < used[0];
+	s = free_slot[first] ? free_slot[first] : free_slot[!first];
+	if (s) {
+		put(s, key, value);
+		unlock2(c.group[0], c.group[1]);
+		size.inc();
+		return -1;
+	}
+
+	// all 16 candidate slots are taken: replace a victim among them
+	auto v = evict_hand.fetch_add(1, std::memory_order_relaxed) % (2 * kCombinedSlots);
+	s = &c.slot[v / kCombinedSlots][v % kCombinedSlots];
+	Key_t deleteKey = s->key;
+	put(s, key, value);
+	unlock2(c.group[0], c.group[1]);
+	return deleteKey;
+}
+
+bool RaceHash::Delete(Key_t& key) {
+	Candidates c;
+	candidates(key, &c);
+
+	lock2(c.group[0], c.group[1]);
+	auto s = find(&c, key);
+	if (s) {
+		__atomic_store_n(&s->tagged_addr, 0, __ATOMIC_RELEASE);
+		clflush((char*)&s->tagged_addr, sizeof(uint64_t));
+		size.dec();
+	}
+	unlock2(c.group[0], c.group[1]);
+	return s != nullptr;
+}
+
+/* the server side of a lookup, the same search a client does on its READ buffers */
+Value_t RaceHash::Get(Key_t& key) {
+	Candidates c;
+	candidates(key, &c);
+	auto& l1 = locks[c.group[0] & (nlocks - 1)];
+	auto& l2 = locks[c.group[1] & (nlocks - 1)];
+	uint64_t v1, v2, addr;
+
+	do {
+		v1 = l1.read_begin();
+		v2 = l2.read_begin();
+		addr = 0;
+		for (int i = 0; i < 2 && !addr; ++i)
+			for (size_t j = 0; j < kCombinedSlots && !addr; ++j)
+				addr = race_slot_match(&c.slot[i][j], key);
+	} while (!l1.read_validate(v1) || !l2.read_validate(v2));
+	return (Value_t)addr;
+}
+
+void RaceHash::Insert_extent(Key_t, uint64_t, uint64_t, Value_t) {
+	return ;
+}
+
+Value_t RaceHash::Get_extent(Key_t&, uint64_t) {
+	return NONE;
+}
+
+Value_t RaceHash::FindAnyway(Key_t& key) {
+	for (uint64_t s = 0; s < nsubtables; ++s) {
+		auto slot = (race_slot*)directory[s];
+		for (size_t i = 0; i < groups * RACE_GROUP_BUCKETS * RACE_SLOTS; ++i) {
+			auto addr = race_slot_match(&slot[i], key);
+			if (addr)
+				return (Value_t)addr;
+		}
+	}
+	return NONE;
+}
+
+double RaceHash::Utilization(void) {
+	return ((double)size.read())/((double)Capacity())*100;
+}
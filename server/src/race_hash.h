@@ -0,0 +1,97 @@
+#ifndef RACE_HASH_H_
+#define RACE_HASH_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include "util/pair.h"
+#include "util/race_layout.h"
+#include "util/sharded_counter.h"
+#include "util/version_lock.h"
+#include "IHash.h"
+
+/*
+ * RACE-style index laid out for one-sided client lookups (util/race_layout.h).
+ *
+ * Buckets live in one flat region the server registers as an RDMA MR, so
+ * clients can find a page with READs only, given the header and directory
+ * they cached at connect time. The table has a fixed size: like the other
+ * backends it is a cache, and a key whose four candidate buckets are full
+ * replaces a victim among them.
+ *
+ * Server threads serialize on version locks kept outside the region, one
+ * per group; a key locks its two groups in index order. Clients never
+ * lock: slots are written key first, tagged address last, and a client
+ * drops any slot whose fingerprint does not match its key.
+ */
+class RaceHash final : public IHash {
+	public:
+	static constexpr size_t kCombinedSlots = 2 * RACE_SLOTS;
+	static constexpr size_t kMaxLocks = 1 << 16;
+
+	/* capacity, region (0: allocate one), region size */
+	RaceHash(size_t, uint64_t, size_t);
+	~RaceHash(void);
+	Key_t Insert(Key_t&, Value_t);
+	bool Delete(Key_t&);
+	Value_t Get(Key_t&);
+	double Utilization(void);
+
+	void Insert_extent(Key_t, uint64_t, uint64_t, Value_t);
+	Value_t Get_extent(Key_t&, uint64_t);
+	Value_t FindAnyway(Key_t&);
+
+	bool Recovery(void) {
+		return false;
+	}
+
+	size_t Capacity(void) {
+		return nsubtables * groups * RACE_GROUP_BUCKETS * RACE_SLOTS;
+	}
+
+	/* bytes of region needed for @capacity entries */
+	static size_t RegionSize(size_t);
+
+	/* the region clients read, header and directory first */
+	uint64_t RegionBase(void) {
+		return (uint64_t)region;
+	}
+
+	void* operator new(size_t size) {
+		void *ret;
+		if (posix_memalign(&ret, 64, size)) ret = NULL;
+		return ret;
+	}
+	void operator delete(void* p) { free(p); }
+
+	private:
+	static void geometry(size_t, uint64_t*, uint64_t*);
+
+	/* the two combined buckets of a key and the groups they belong to */
+	struct Candidates {
+		race_slot* slot[2];
+		size_t group[2];
+	};
+
+	void candidates(Key_t&, Candidates*);
+	void lock2(size_t, size_t);
+	void unlock2(size_t, size_t);
+	race_slot* find(Candidates*, Key_t&);
+	void put(race_slot*, Key_t&, Value_t);
+
+	char* region;
+	bool own_region;
+	race_header* header;
+	uint64_t* directory;
+	uint64_t nsubtables;
+	uint64_t groups;
+
+	/* striped, group g of subtable s uses locks[(s * groups + g) % nlocks] */
+	VersionLock* locks;
+	size_t nlocks;
+
+	ShardedCounter size;
+	std::atomic<uint64_t> evict_hand{0};
+};
+
+#endif  // RACE_HASH_H_
@@ -9,8 +9,11 @@
 #include <getopt.h>
 #include <vector>
 #include <ctime>
+#include <unordered_map>
+#include <sys/mman.h>
 
 #include "KV.h"
+#include "ShardedKV.h"
 #include "variables.h"
 
 #define POOL_SIZE (10737418240) // 10GB
@@ -26,6 +29,17 @@ bool numa_on = false;
 bool verbose_flag = false;
 bool bf_flag = false;
 bool human = false;
+/* keys per InsertBatch/GetBatch call, 0 for one call per key */
+size_t batch = 0;
+/* KV shards by key hash, served by -K CPUs if given */
+size_t nr_shards = 1;
+const char* kv_backend = NULL;
+const char* cceh_geometry = "default";
+bool clock_eviction = false;
+uint64_t page_region = 0;
+size_t page_region_size = 0;
+uint64_t index_region = 0;
+size_t index_region_size = 0;
 struct bitmask *netcpubuf;
 struct bitmask *kvcpubuf;
 struct bitmask *pollcpubuf;
@@ -42,6 +56,11 @@ static void dprintf( const char* format, ... ) {
 static void usage(){
 	printf("Usage : \n");
 	printf("./bin/kv --dataset <text file> --nr_data 10000000 -W 0-3 -K 4-7,14-17 -P 8-9,18-19 --tablesize 32768 --verbose\n");
+	printf("  --backend <name>   hash backend: %s\n", KVBackends());
+	printf("  --geometry <name>  CCEH geometry: default, small, large, fp8, fp16, large-fp8\n");
+	printf("  --clock            CLOCK eviction for LinearProbing (default FIFO)\n");
+	printf("  --batch <n>        insert and search <n> keys per InsertBatch/GetBatch call\n");
+	printf("  --shards <n>       split the KV into <n> shards, one worker per -K CPU (inline without -K)\n");
 }
 
 void clear_cache(){
@@ -74,7 +93,7 @@ static void printCpuBuf(size_t nr_cpus, struct bitmask *bm, const char *str) {
 int main(int argc, char* argv[]){
 	char *data_path;
 
-	const char *short_options = "vbut:n:d:z:hK:P:W:";
+	const char *short_options = "vbut:n:d:z:hK:P:W:B:g:cx:k:";
 	static struct option long_options[] =
 	{
 		// --verbose 옵션을 만나면 "verbose_flag = 1"이 세팅된다.
@@ -87,6 +106,11 @@ int main(int argc, char* argv[]){
 		{"kvcpubind", 1, NULL, 'K'},
 		{"pollcpubind", 1, NULL, 'P'},
 		{"numa", 0, NULL, 'u'},
+		{"backend", 1, NULL, 'B'},
+		{"geometry", 1, NULL, 'g'},
+		{"clock", 0, NULL, 'c'},
+		{"batch", 1, NULL, 'x'},
+		{"shards", 1, NULL, 'k'},
 		{0, 0, 0, 0} 
 	};
 
@@ -144,6 +168,21 @@ int main(int argc, char* argv[]){
 			case 'u':
 				numa_on = true;
 				break;
+			case 'B':
+				kv_backend = strdup(optarg);
+				break;
+			case 'g':
+				cceh_geometry = strdup(optarg);
+				break;
+			case 'c':
+				clock_eviction = true;
+				break;
+			case 'x':
+				batch = strtol(optarg, NULL, 0);
+				break;
+			case 'k':
+				nr_shards = strtol(optarg, NULL, 0);
+				break;
 			default:
 				usage();
 				return 0;
@@ -177,8 +216,28 @@ int main(int argc, char* argv[]){
 		dprintf("[  OK  ] BF Initialized\n");
 	}
 
+	auto backend = FindKVBackend(kv_backend);
+	if (!backend) {
+		printf("unknown backend %s (%s)\n", kv_backend, KVBackends());
+		return 0;
+	}
+	dprintf("[ INFO ] %s backend\n", backend->name);
+
 	auto totalSize = 10737418240 * 10 ; // 10GiB
-	kv = new KV( totalSize / 4096, bf );
+	if (backend->needs_page_region) {
+		/* address space only, the index never touches page contents */
+		page_region_size = numData * 4096;
+		page_region = (uint64_t)mmap(NULL, page_region_size, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if ((void*)page_region == MAP_FAILED) {
+			perror("mmap page region");
+			return 0;
+		}
+	}
+	if (nr_shards > 1)
+		kv = new ShardedKV(backend, totalSize / 4096, bf, nr_shards, kvcpubuf);
+	else
+		kv = backend->create( totalSize / 4096, bf );
 	dprintf("[  OK  ] KVStore Initialized\n");
 
 	uint64_t* keys = (uint64_t*)malloc(sizeof(uint64_t)*numData);
@@ -196,23 +255,47 @@ int main(int argc, char* argv[]){
 	}
 	dprintf("[  OK  ] Completed reading dataset\n");
 
+	/* the key itself, or one page of the region per distinct key like the server hands out */
+	Value_t* values = (Value_t*)malloc(sizeof(Value_t)*numData);
+	unordered_map<Key_t, Value_t> pages;
+	for(unsigned int i=0; i<numData; i++){
+		if (page_region)
+			values[i] = pages.emplace(keys[i], (Value_t)(page_region + 4096 * pages.size())).first->second;
+		else
+			values[i] = reinterpret_cast<Value_t>(keys[i]);
+	}
+
 	vector<thread> insertingThreads;
 	vector<thread> searchingThreads;
 	vector<int> failed(numNetworkThreads);
 	vector<Key_t> notfoundKeys[numNetworkThreads];
 
-	auto insert = [&kv, &keys](int from, int to){
+	auto insert = [&kv, &keys, &values](int from, int to){
+		if (batch) {
+			for(int i=from; i<to; i+=batch)
+				kv->InsertBatch(&keys[i], &values[i], min(batch, (size_t)(to-i)));
+			return;
+		}
 		for(int i=from; i<to; i++){
-			kv->Insert(keys[i], reinterpret_cast<Value_t>(keys[i]));
+			kv->Insert(keys[i], values[i]);
 		}
 	};
 
-	auto search = [&kv, &keys, &failed, &notfoundKeys](int from, int to, int tid){
+	auto search = [&kv, &keys, &values, &failed, &notfoundKeys](int from, int to, int tid){
 		sleep(1);
 		int fail = 0;
+		vector<Value_t> rets(batch);
 		for(int i = from; i < to; i++){
-			auto ret = kv->Get(keys[i]);
-			if(ret != reinterpret_cast<Value_t>(keys[i])){
+			Value_t ret;
+			if (batch) {
+				/* one GetBatch per batch, checked key by key */
+				if ((i - from) % batch == 0)
+					kv->GetBatch(&keys[i], rets.data(), min(batch, (size_t)(to-i)));
+				ret = rets[(i - from) % batch];
+			} else {
+				ret = kv->Get(keys[i]);
+			}
+			if(ret != values[i]){
 				fail++;
 				notfoundKeys[tid].push_back(keys[i]);
 			}
@@ -0,0 +1,44 @@
+#ifndef UTIL_AMAC_H_
+#define UTIL_AMAC_H_
+
+#include <cstddef>
+
+/* lookups a thread keeps in flight, enough to cover a DRAM miss */
+constexpr size_t kLookupsInFlight = 16;
+
+/*
+ * Asynchronous memory access chaining (AMAC) for batched lookups.
+ *
+ * A lookup is a small state machine. Each step() works on memory it
+ * prefetched in the step before, prefetches what it needs next and returns
+ * false, or stores its result and returns true:
+ *
+ *   struct Lookup {
+ *     bool step(void);
+ *   };
+ *   amac_run(ops, n);
+ *
+ * Up to Width lookups are stepped round robin, so while one waits for its
+ * cache miss the others make progress and the misses overlap. Lookups
+ * finish in any order.
+ */
+template <size_t Width = kLookupsInFlight, class Lookup>
+void amac_run(Lookup* ops, size_t n) {
+	Lookup* slots[Width];
+	size_t next = 0, active = 0;
+	for (; active < Width && next < n; ++active)
+		slots[active] = &ops[next++];
+
+	while (active) {
+		for (size_t s = 0; s < active; ) {
+			if (!slots[s]->step())
+				++s;
+			else if (next < n)
+				slots[s++] = &ops[next++];
+			else
+				slots[s] = slots[--active];
+		}
+	}
+}
+
+#endif  // UTIL_AMAC_H_
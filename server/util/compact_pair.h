@@ -0,0 +1,91 @@
+#ifndef UTIL_COMPACT_PAIR_H_
+#define UTIL_COMPACT_PAIR_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include "util/pair.h"
+
+#define PAGE_SHIFT_COMPACT 12
+
+/*
+ * 8-byte index entry: a 32-bit key fingerprint and a 32-bit page number.
+ * Page numbers are stored +1, so page == 0 marks an empty entry.
+ * The fingerprint only filters; the full key is checked in PageRegion.
+ */
+struct CompactPair {
+	uint32_t fp;
+	uint32_t page;
+
+	CompactPair(void)
+	: fp{0}, page{0} { }
+
+	bool empty(void) const { return page == 0; }
+};
+
+static_assert(sizeof(CompactPair) == 8, "CompactPair must stay 8 bytes");
+
+/* fingerprint from the hash bits above the ones used for the table index */
+static inline uint32_t compact_fp(size_t key_hash) {
+	return (uint32_t)(key_hash >> 32);
+}
+
+/*
+ * The 4KB-aligned page region the compact index points into.
+ * Pages carry raw client data with no room for a header, so the owner
+ * key of every page lives in a side array (8B per 4KB page), which is
+ * what an entry is verified against after a fingerprint match, and where
+ * the key an eviction drops is read back from for the bloom filter.
+ */
+class PageRegion {
+	public:
+		PageRegion(uint64_t _base, size_t _size)
+			: base{_base}, npages{_size >> PAGE_SHIFT_COMPACT}
+		{
+			if (npages >= UINT32_MAX) {
+				std::cerr << "[" << __func__ << "]: region of " << npages << " pages does not fit 32-bit page numbers" << std::endl;
+				exit(EXIT_FAILURE);
+			}
+			owners = new Key_t[npages];
+			for (size_t i = 0; i < npages; ++i)
+				owners[i] = INVALID;
+		}
+
+		~PageRegion(void) {
+			delete[] owners;
+		}
+
+		bool contains(Value_t value) const {
+			uint64_t addr = (uint64_t)value;
+			return addr >= base && ((addr - base) >> PAGE_SHIFT_COMPACT) < npages
+				&& !((addr - base) & ((1UL << PAGE_SHIFT_COMPACT) - 1));
+		}
+
+		/* entry page number (+1) of a page in the region */
+		uint32_t page(Value_t value) const {
+			return (uint32_t)(((uint64_t)value - base) >> PAGE_SHIFT_COMPACT) + 1;
+		}
+
+		Value_t addr(uint32_t page) const {
+			return (Value_t)(base + ((uint64_t)(page - 1) << PAGE_SHIFT_COMPACT));
+		}
+
+		void set_owner(uint32_t page, Key_t key) {
+			__atomic_store_n(&owners[page - 1], key, __ATOMIC_RELEASE);
+		}
+
+		Key_t owner(uint32_t page) const {
+			return __atomic_load_n(&owners[page - 1], __ATOMIC_ACQUIRE);
+		}
+
+		size_t Pages(void) const {
+			return npages;
+		}
+
+	private:
+		uint64_t base;
+		size_t npages;
+		Key_t* owners;
+};
+
+#endif  // UTIL_COMPACT_PAIR_H_
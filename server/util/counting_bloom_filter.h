@@ -2,7 +2,9 @@
 #define CountingBloomFilter_H
 
 #include <vector>
+#include <algorithm>
 #include <cstdbool>
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <functional>
@@ -10,10 +12,15 @@
 #include <set>
 #include <string.h>
 #include <mutex>
-#include <openssl/sha.h>
+#include <atomic>
+#include <unordered_map>
+#include <openssl/evp.h>
 #include "util/hash.h"
 
-#define SENDINGBLOCKSIZE 		1024 * 8
+/* bytes of the bit array tracked and sent to clients as one dirty block */
+#define SENDINGBLOCKSIZE 		4096
+/* counter indexes hashed ahead by a batched Insert, at least one object's */
+#define BATCH_INDEXES			256
 
 #define BITS_PER_BYTE           8
 #define DIV_ROUND_UP(n,d) (((n) + (d) - 1) / (d))
@@ -38,8 +45,33 @@ template <typename T>
 using HashParams = struct HashParams_S;
 
 /** A counting Bloom filter. Instead of an array of bits, maintains an array of
- *  bytes. Each byte is incremented for an added item, or decremented for a
- *  deleted item, thereby supporting a delete operation.
+ *  4-bit counters, two per byte (counter i is the low nibble of byte i/2 if
+ *  i is even, the high one if odd). Each counter is incremented for an added
+ *  item, or decremented for a deleted item, thereby supporting a delete
+ *  operation.
+ *
+ *  Blocked (blockBits > 0): all counters of an object fall in one block of
+ *  blockBits positions, 64B of counters at the default 128, so a query is
+ *  one cache line here, one 64B RDMA READ of the counters or one line of
+ *  the client's bitmap. The block is picked by the hash with salt 0, the
+ *  positions in it by double hashing on the hash with salt 1:
+ *
+ *    index(i) = block * blockBits + ((h1 + i * (h1 >> 16 | 1)) % blockBits)
+ *
+ *  client/bloom_filter.c computes the same. The false-positive rate is a
+ *  little higher than unblocked, more so the smaller the block.
+ *
+ *  A counter saturates at kCounterMax, further increments are kept in a
+ *  small overflow table and taken back from it first, so counts stay exact
+ *  and a delete never clears a counter other objects still hold. Counters
+ *  are updated with byte CAS, the neighbour nibble may change concurrently.
+ *
+ *  The ordinary bit array clients get is kept up to date as counters go
+ *  0 <-> 1, and every SENDINGBLOCKSIZE block of it has a version bumped
+ *  after each bit flip in it. A sync sends the blocks whose version moved
+ *  since it last looked (CollectDirtyBlocks), O(changes) instead of
+ *  rebuilding the array from every counter. Versions instead of one dirty
+ *  bitmap, so each client's sync has its own view.
  *
  *  @param T Contained type being indexed
  */
@@ -48,6 +80,10 @@ class CountingBloomFilter {
 
 	public:
 
+		static constexpr uint8_t kCounterMax = 15;
+		/* indexes of one object are kept on the stack */
+		static constexpr uint8_t kMaxHashes = 16;
+
 		/** Constructor: Creates a BloomFilter with the requested bit array size
 		 *  and number of hashes.
 		 *  
@@ -56,15 +92,40 @@ class CountingBloomFilter {
 		 *  @param numBits   The size of the bit array to allocate. If the
 		 *                   BloomFilter is not an OrdinaryBloomFilter, the actual
 		 *                   storage size will differ from this.
+		 *  @param blockBits Positions per block, a power of two from 64 on, or 0
+		 *                   for independent positions over the whole array.
 		 */
 		explicit
-			CountingBloomFilter(uint8_t numHashes, uint64_t numBits)
-			: m_numHashes(numHashes), m_numBits(numBits), m_numLongs(BITS_TO_LONGS(numBits))
+			CountingBloomFilter(uint8_t numHashes, uint64_t numBits, uint32_t blockBits = 0)
+			: m_numHashes(numHashes), m_numBits(numBits), m_numLongs(BITS_TO_LONGS(numBits)),
+			m_blockBits(blockBits), m_numBlocks(blockBits ? numBits / blockBits : 0)
 			{
-				m_bitarray = (uint8_t *)calloc(numBits , sizeof(uint8_t));
-				m_boolbitarray = (uint64_t *)calloc(BITS_TO_LONGS(numBits), sizeof(uint64_t));
+				if (numHashes == 0 || numHashes > kMaxHashes) {
+					fprintf(stderr, "[ FAIL ] %d bloom filter hashes, 1 to %d supported\n", numHashes, kMaxHashes);
+					exit(EXIT_FAILURE);
+				}
+				if (blockBits && (blockBits < 64 || (blockBits & (blockBits - 1)) || numBits < blockBits)) {
+					fprintf(stderr, "[ FAIL ] bloom filter block of %u bits for %lu bits\n", blockBits, numBits);
+					exit(EXIT_FAILURE);
+				}
+				/* blocks start on a cache line of both arrays */
+				if (posix_memalign((void **)&m_bitarray, 64, DIV_ROUND_UP(numBits, 2)) ||
+						posix_memalign((void **)&m_boolbitarray, 64, m_numLongs * sizeof(uint64_t))) {
+					fprintf(stderr, "[ FAIL ] bloom filter of %lu bits\n", numBits);
+					exit(EXIT_FAILURE);
+				}
+				memset(m_bitarray, 0, DIV_ROUND_UP(numBits, 2));
+				memset(m_boolbitarray, 0, m_numLongs * sizeof(uint64_t));
+				m_numDirtyBlocks = DIV_ROUND_UP(m_numLongs * sizeof(uint64_t), SENDINGBLOCKSIZE);
+				m_blockVersion = new std::atomic<uint32_t>[m_numDirtyBlocks]();
 			}
 
+		virtual ~CountingBloomFilter() {
+			free(m_bitarray);
+			free(m_boolbitarray);
+			delete[] m_blockVersion;
+		}
+
 		/** Returns the number of hashes used by this Bloom filter
 		*/
 		uint8_t GetNumHashes() const {
@@ -86,6 +147,16 @@ class CountingBloomFilter {
 			return m_numBits;
 		}
 
+		/** Size of the counter array at GetBaseAddr(), in bytes */
+		uint64_t GetCounterBytes() const {
+			return DIV_ROUND_UP(m_numBits, 2);
+		}
+
+		/** Positions per block, 0 if unblocked */
+		uint32_t GetBlockBits() const {
+			return m_blockBits;
+		}
+
 		uint64_t GetNumLongs() const {
 			return m_numLongs;
 		}
@@ -98,33 +169,68 @@ class CountingBloomFilter {
 			return m_boolbitarray[idx];
 		}
 
-		std::set<uint64_t> GetUpdatedBlocks() const {
-			return modified_blocks;
+		/** Number of SENDINGBLOCKSIZE blocks of the bit array */
+		uint64_t GetNumDirtyBlocks() const {
+			return m_numDirtyBlocks;
 		}
 
-		void ResetUpdatedBlocks() {
-			modified_blocks.clear();
+		/** Appends to @blocks the bit array blocks that changed since the
+		 *  versions in @seen were taken and updates @seen. An empty @seen
+		 *  is filled in and reports nothing, send the whole array then.
+		 *  A block is read for sending after it is collected, so it holds
+		 *  at least the flips its version counted.
+		 */
+		void CollectDirtyBlocks(std::vector<uint32_t>& seen, std::vector<uint64_t>& blocks) const {
+			bool first = seen.empty();
+			if (first)
+				seen.resize(m_numDirtyBlocks);
+			for (uint64_t b = 0; b < m_numDirtyBlocks; b++) {
+				uint32_t v = m_blockVersion[b].load(std::memory_order_acquire);
+				if (v == seen[b])
+					continue;
+				seen[b] = v;
+				if (!first)
+					blocks.push_back(b);
+			}
 		}
 
 		void Insert(T const& o) {
-			for(uint8_t i = 0; i < GetNumHashes(); i++){
-				auto idx = ComputeHash(o, i);
-//				printf("idx: %d\n", idx);
-				if (m_bitarray[idx] < 255)
-					m_bitarray[idx] += 1;
-//				else
-//					printf("idx: %lu exceed 256\n", idx);
+			uint64_t idx[kMaxHashes];
+			ComputeIndexes(o, idx);
+			for(uint8_t i = 0; i < GetNumHashes(); i++)
+				Increment(idx[i]);
+		}
+
+		/** Inserts @n objects. All counters of a group of objects are hashed
+		 *  and prefetched before the first is incremented, so their misses
+		 *  overlap instead of being taken one by one.
+		 */
+		void Insert(T const* o, size_t n) {
+			uint64_t idx[BATCH_INDEXES];
+			size_t per_group = BATCH_INDEXES / GetNumHashes();
+			for (size_t off = 0; off < n; off += per_group) {
+				size_t m = std::min(n - off, per_group);
+				size_t nr_idx = 0;
+				for (size_t k = 0; k < m; k++) {
+					ComputeIndexes(o[off + k], &idx[nr_idx]);
+					for (uint8_t i = 0; i < GetNumHashes(); i++) {
+						__builtin_prefetch(&m_bitarray[idx[nr_idx] >> 1], 1);
+						/* in case the counter goes 0 -> 1 */
+						__builtin_prefetch(&m_boolbitarray[idx[nr_idx] / 64], 1);
+						nr_idx++;
+					}
+				}
+				for (size_t j = 0; j < nr_idx; j++)
+					Increment(idx[j]);
 			}
 		}
 
 		bool Delete(T const& o) {
 			if(Query(o)){
-				for(uint8_t i = 0; i < GetNumHashes(); i++){
-					auto idx = ComputeHash(o, i);
-					m_bitarray[idx] -= 1;
-					if (m_bitarray[idx] == 0)
-						modified_blocks.insert(idx/SENDINGBLOCKSIZE);
-				}
+				uint64_t idx[kMaxHashes];
+				ComputeIndexes(o, idx);
+				for(uint8_t i = 0; i < GetNumHashes(); i++)
+					Decrement(idx[i]);
 				return true;
 			}
 			return false;
@@ -132,10 +238,11 @@ class CountingBloomFilter {
 
 		bool Query(T const& o) const {
 //			printf("Query : ");
+			uint64_t idx[kMaxHashes];
+			ComputeIndexes(o, idx);
 			for(uint8_t i = 0; i < GetNumHashes(); i++){
-				auto idx = ComputeHash(o, i);
-//				printf("%lu, ", idx);
-				if(m_bitarray[idx] == 0){
+//				printf("%lu, ", idx[i]);
+				if(Counter(idx[i]) == 0){
 					return false;
 				}
 			}
@@ -144,13 +251,15 @@ class CountingBloomFilter {
 
 		bool QueryBitBloom(T const& o) const {
 //			printf("Query BB : ");
+			uint64_t idxs[kMaxHashes];
+			ComputeIndexes(o, idxs);
 			for(uint8_t i = 0; i < GetNumHashes(); i++){
-				auto idx = ComputeHash(o, i);
+				auto idx = idxs[i];
 //				printf("%lu, ", idx);
 				auto j = idx / 64; 
 				uint8_t bitShift = 64 - 1 - (idx % 64);   // i == 65 -> 62 
 				uint64_t checkBit = (uint64_t) 1 << bitShift;
-				if ((m_boolbitarray[j] & checkBit) == 0) {
+				if ((__atomic_load_n(&m_boolbitarray[j], __ATOMIC_RELAXED) & checkBit) == 0) {
 					return false;
 				}
 			}
@@ -165,7 +274,7 @@ class CountingBloomFilter {
 			os.write((const char *) &numBits, sizeof(uint16_t));
 
 			for(uint16_t i = 0; i < numBits; i++){
-				uint8_t byte = m_bitarray[i];
+				uint8_t byte = Counter(i);
 				os.write((const char *) &byte, sizeof(uint8_t));
 			}
 		}
@@ -174,28 +283,30 @@ class CountingBloomFilter {
 		 * stream. No validation is performed.
 		 *
 		 * @param  is Input stream to read from
-		 * @return Deserialized CountingBloomFilter
+		 * @return Deserialized CountingBloomFilter, allocated with new
 		 */
-		static CountingBloomFilter<T> Deserialize(std::istream &is){
+		static CountingBloomFilter<T>* Deserialize(std::istream &is){
 			uint8_t numHashes;
 			uint16_t numBits;
 
 			is.read((char *) &numHashes, sizeof(uint8_t));
 			is.read((char *) &numBits, sizeof(uint16_t));
 
-			CountingBloomFilter<T> r (numHashes, numBits);
+			auto r = new CountingBloomFilter<T>(numHashes, numBits);
 
 			for(uint16_t i = 0; i < numBits; i++){
 				uint8_t byte;
 				is.read((char *) &byte, sizeof(uint8_t));
-				r.m_bitarray[i] = byte;
+				while (byte--)
+					r->Increment(i);
 			}
 
 			return r;
 		}
 
 		/** Returns an ordinary BF with the same set represented by this counting
-		 *  BF.
+		 *  BF. The bit array is maintained by Insert and Delete, this rebuilds
+		 *  it from every counter and must not run concurrently with them.
 		 *
 		 *  @return The new OrdinaryBloomFilter
 		 */
@@ -205,7 +316,7 @@ class CountingBloomFilter {
 			}
 			for(uint64_t i = 0; i < GetNumBits(); i++){
 				auto j = i / 64; 
-				if (m_bitarray[i] > 0) {
+				if (Counter(i) > 0) {
 					uint8_t bitShift = 64 - 1 - (i % 64);   // i == 65 -> 62 
 					uint64_t checkBit = (uint64_t) 1 << bitShift;
 					m_boolbitarray[j] |= checkBit;
@@ -225,18 +336,19 @@ class CountingBloomFilter {
 		 *  @return Index in bit array corresponding to the (object, salt) pair
 		 */
 		uint16_t ComputeSHA256(T const& o, uint8_t salt) const {
-			unsigned char hash[SHA256_DIGEST_LENGTH];
+			unsigned char hash[EVP_MAX_MD_SIZE];
+			unsigned int hash_len = 0;
 			std::string str  = o + std::to_string(salt);
 			const char * c = str.c_str();
 
-			SHA256_CTX sha256;
-			SHA256_Init(&sha256);
-			SHA256_Update(&sha256, c, str.size());
-			SHA256_Final(hash, &sha256);
+			if (!EVP_Digest(c, str.size(), hash, &hash_len, EVP_sha256(), NULL)) {
+				fprintf(stderr, "[ FAIL ] %s: EVP_Digest failed\n", __func__);
+				exit(EXIT_FAILURE);
+			}
 
 			char outputBuffer[17];
-			int i = 0;
-			for (i = 0; i < SHA256_DIGEST_LENGTH/4; i++)
+			unsigned int i = 0;
+			for (i = 0; i < hash_len/4; i++)
 			{
 				sprintf(outputBuffer + (i * 2),"%02x", hash[i]);
 			}
@@ -253,8 +365,102 @@ class CountingBloomFilter {
 			return idx;
 		}
 
+		/* the GetNumHashes() counter indexes of @key */
+		void ComputeIndexes(T const& key, uint64_t* idx) const {
+			if (!m_blockBits) {
+				for (uint8_t i = 0; i < GetNumHashes(); i++)
+					idx[i] = ComputeHash(key, i);
+				return;
+			}
+			uint64_t base = hash_funcs[1](&key, sizeof(key), 0) % m_numBlocks * m_blockBits;
+			uint64_t h1 = hash_funcs[1](&key, sizeof(key), 1);
+			uint64_t step = (h1 >> 16) | 1;
+			for (uint8_t i = 0; i < GetNumHashes(); i++)
+				idx[i] = base + ((h1 + i * step) & (m_blockBits - 1));
+		}
+
 	private:
 
+		uint8_t Counter(uint64_t idx) const {
+			uint8_t byte = __atomic_load_n(&m_bitarray[idx >> 1], __ATOMIC_RELAXED);
+			return (byte >> ((idx & 1) << 2)) & kCounterMax;
+		}
+
+		/* a counter spills into m_overflow only while it is saturated,
+		 * both sides of that are decided under m_overflowLock */
+		void Increment(uint64_t idx) {
+			uint8_t* p = &m_bitarray[idx >> 1];
+			unsigned shift = (idx & 1) << 2;
+			uint8_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+			while (true) {
+				if (((old >> shift) & kCounterMax) == kCounterMax) {
+					std::lock_guard<std::mutex> l(m_overflowLock);
+					old = __atomic_load_n(p, __ATOMIC_RELAXED);
+					if (((old >> shift) & kCounterMax) == kCounterMax) {
+						m_overflow[idx]++;
+						return;
+					}
+					continue;
+				}
+				if (__atomic_compare_exchange_n(p, &old, (uint8_t)(old + (1 << shift)),
+							true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					if (((old >> shift) & kCounterMax) == 0)
+						SetBit(idx);
+					return;
+				}
+			}
+		}
+
+		/* returns true if the counter dropped to zero */
+		bool Decrement(uint64_t idx) {
+			uint8_t* p = &m_bitarray[idx >> 1];
+			unsigned shift = (idx & 1) << 2;
+			uint8_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+			while (true) {
+				uint8_t c = (old >> shift) & kCounterMax;
+				if (c == 0)
+					return false;
+				if (c == kCounterMax) {
+					std::lock_guard<std::mutex> l(m_overflowLock);
+					auto it = m_overflow.find(idx);
+					if (it != m_overflow.end()) {
+						if (--it->second == 0)
+							m_overflow.erase(it);
+						return false;
+					}
+					/* leaves saturation under the lock, the other nibble may still move */
+					while (!__atomic_compare_exchange_n(p, &old, (uint8_t)(old - (1 << shift)),
+								true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+						;
+					return false;
+				}
+				if (__atomic_compare_exchange_n(p, &old, (uint8_t)(old - (1 << shift)),
+							true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					if (c == 1)
+						ClearBit(idx);
+					return c == 1;
+				}
+			}
+		}
+
+		/* bit i is bit 63 - i % 64 of long i / 64, as the clients read it */
+		void SetBit(uint64_t idx) {
+			uint64_t bit = (uint64_t)1 << (64 - 1 - (idx % 64));
+			__atomic_fetch_or(&m_boolbitarray[idx / 64], bit, __ATOMIC_RELEASE);
+			m_blockVersion[idx / 8 / SENDINGBLOCKSIZE].fetch_add(1, std::memory_order_release);
+		}
+
+		/* an increment may have set the counter again since it dropped to
+		 * zero, and its SetBit may have run before this clear: set it back.
+		 * The acq_rel clear reads that SetBit, so the recheck sees its count. */
+		void ClearBit(uint64_t idx) {
+			uint64_t bit = (uint64_t)1 << (64 - 1 - (idx % 64));
+			__atomic_fetch_and(&m_boolbitarray[idx / 64], ~bit, __ATOMIC_ACQ_REL);
+			if (Counter(idx))
+				__atomic_fetch_or(&m_boolbitarray[idx / 64], bit, __ATOMIC_RELEASE);
+			m_blockVersion[idx / 8 / SENDINGBLOCKSIZE].fetch_add(1, std::memory_order_release);
+		}
+
 		/** Number of hashes
 		*/
 		uint8_t m_numHashes;
@@ -264,10 +470,20 @@ class CountingBloomFilter {
 		uint64_t m_numBits;
 		uint64_t m_numLongs;
 
+		uint32_t m_blockBits;
+		uint64_t m_numBlocks;
+
+		/* 4-bit counters, two per byte */
 		uint8_t *m_bitarray;
 		uint64_t *m_boolbitarray;
 
-		std::set<uint64_t> modified_blocks;
+		/* counts above kCounterMax, by counter index */
+		std::unordered_map<uint64_t, uint64_t> m_overflow;
+		std::mutex m_overflowLock;
+
+		/* bumped after every bit flip in a SENDINGBLOCKSIZE block of m_boolbitarray */
+		std::atomic<uint32_t>* m_blockVersion;
+		uint64_t m_numDirtyBlocks;
 
 }; // class CountingBloomFilter
 
@@ -0,0 +1,174 @@
+#ifndef UTIL_EPOCH_H_
+#define UTIL_EPOCH_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/*
+ * Epoch based reclamation for lock-free structures.
+ *
+ * Every operation runs between enter() and exit() (or in a Guard). Nodes
+ * unlinked from the structure are handed to retire() and freed once every
+ * thread that was inside an operation at that time has left it:
+ *
+ *   EpochManager::Guard g(epoch);
+ *   ... traverse, unlink node ...
+ *   epoch.retire(node);
+ *
+ * A thread announces the global epoch it entered in, the global epoch only
+ * advances when all threads inside have announced the current one, and
+ * nodes retired in epoch e are freed once it reaches e + 2.
+ * synchronize() waits for such a grace period without retiring anything.
+ *
+ * Threads get a slot on first use and give it back when they exit, at most
+ * kMaxThreads at a time. enter() nests.
+ */
+class EpochManager {
+	public:
+		static constexpr size_t kMaxThreads = 256;
+		/* retires between attempts to advance the epoch */
+		static constexpr size_t kReclaimBatch = 64;
+
+		class Guard {
+			public:
+				Guard(EpochManager& m) : m(m) { m.enter(); }
+				~Guard(void) { m.exit(); }
+			private:
+				EpochManager& m;
+		};
+
+		EpochManager(void) : global{1} { }
+
+		~EpochManager(void) {
+			for (size_t i = 0; i < kMaxThreads; ++i) {
+				for (auto& limbo : slots[i].limbo)
+					free_all(limbo);
+			}
+		}
+
+		void enter(void) {
+			auto& s = slots[thread_id()];
+			if (s.depth++ == 0) {
+				s.epoch.store(global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+		}
+
+		void exit(void) {
+			auto& s = slots[thread_id()];
+			if (--s.depth == 0)
+				s.epoch.store(0, std::memory_order_release);
+		}
+
+		template <class T>
+		void retire(T* p) {
+			retire(p, [](void* q) { delete (T*)q; });
+		}
+
+		void retire(void* p, void (*free)(void*)) {
+			auto& s = slots[thread_id()];
+			auto e = global.load(std::memory_order_seq_cst);
+			auto i = e % 3;
+			if (s.tag[i] != e) {
+				/* retired three epochs ago at least */
+				free_all(s.limbo[i]);
+				s.tag[i] = e;
+			}
+			s.limbo[i].push_back({p, free});
+			if (++s.nr_retired % kReclaimBatch == 0)
+				reclaim(s);
+		}
+
+		/* wait until all threads inside an operation now have left it */
+		void synchronize(void) {
+			auto e = global.load(std::memory_order_seq_cst);
+			while (true) {
+				size_t i = 0;
+				for (; i < kMaxThreads; ++i) {
+					auto v = slots[i].epoch.load(std::memory_order_acquire);
+					if (v != 0 && v <= e)
+						break;
+				}
+				if (i == kMaxThreads)
+					return;
+				try_advance();
+				asm volatile("pause");
+			}
+		}
+
+	private:
+		struct Retired {
+			void* p;
+			void (*free)(void*);
+		};
+
+		struct alignas(64) Slot {
+			/* epoch the owner entered in, 0 outside of operations */
+			std::atomic<uint64_t> epoch{0};
+			/* below only touched by the owner */
+			size_t depth = 0;
+			size_t nr_retired = 0;
+			uint64_t tag[3] = {0, 0, 0};
+			std::vector<Retired> limbo[3];
+		};
+
+		struct ThreadId {
+			size_t id;
+			ThreadId(void) {
+				for (id = 0; id < kMaxThreads; ++id) {
+					if (!used()[id].exchange(true))
+						return;
+				}
+				std::cerr << "EpochManager: more than " << kMaxThreads << " threads" << std::endl;
+				abort();
+			}
+			~ThreadId(void) {
+				used()[id].store(false);
+			}
+		};
+
+		static std::atomic<bool>* used(void) {
+			static std::atomic<bool> ids[kMaxThreads];
+			return ids;
+		}
+
+		static size_t thread_id(void) {
+			thread_local ThreadId tid;
+			return tid.id;
+		}
+
+		static void free_all(std::vector<Retired>& limbo) {
+			for (auto& r : limbo)
+				r.free(r.p);
+			limbo.clear();
+		}
+
+		/* advance the epoch if every thread inside has seen the current one */
+		bool try_advance(void) {
+			auto e = global.load(std::memory_order_seq_cst);
+			for (size_t i = 0; i < kMaxThreads; ++i) {
+				auto v = slots[i].epoch.load(std::memory_order_acquire);
+				if (v != 0 && v != e)
+					return false;
+			}
+			return global.compare_exchange_strong(e, e + 1);
+		}
+
+		void reclaim(Slot& s) {
+			try_advance();
+			auto e = global.load(std::memory_order_seq_cst);
+			for (size_t i = 0; i < 3; ++i) {
+				if (s.tag[i] + 2 <= e)
+					free_all(s.limbo[i]);
+			}
+		}
+
+		std::atomic<uint64_t> global;
+		Slot slots[kMaxThreads];
+};
+
+#endif  // UTIL_EPOCH_H_
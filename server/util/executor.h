@@ -0,0 +1,263 @@
+#ifndef UTIL_EXECUTOR_H_
+#define UTIL_EXECUTOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <numa.h>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Work-stealing task executor.
+ *
+ * One worker per given CPU, pinned to it. Every worker owns a deque: it
+ * pushes and pops its own tasks at the back (newest first, still warm in
+ * its cache), idle workers steal from the front of the others, trying the
+ * workers of their own NUMA node before remote ones.
+ *
+ *   Executor ex(cpus);
+ *   ex.Submit([&] { ... }, node);
+ *
+ * A task submitted from a worker goes to that worker's deque, one from
+ * another thread to a worker of the given node (round robin, any node if
+ * -1). A worker that finds nothing to run or steal for kSpinRounds rounds
+ * parks on a condition variable and is woken by the next Submit, so idle
+ * workers leave their cores to other threads instead of spinning.
+ *
+ * The destructor runs the tasks still queued, then stops the workers.
+ */
+class Executor {
+	public:
+		using Task = std::function<void(void)>;
+
+		/* empty steal rounds before a worker parks */
+		static constexpr size_t kSpinRounds = 64;
+
+		/* @cpus: worker CPUs, every configured CPU if NULL */
+		Executor(struct bitmask* cpus) {
+			bool numable = numa_available() >= 0;
+			int nr_cpus = numable ? numa_num_configured_cpus()
+				: (int)std::thread::hardware_concurrency();
+			for (int cpu = 0; cpu < nr_cpus; ++cpu) {
+				if (cpus && !numa_bitmask_isbitset(cpus, cpu))
+					continue;
+				auto w = new Worker();
+				w->cpu = cpu;
+				w->node = numable ? numa_node_of_cpu(cpu) : 0;
+				if (w->node < 0)
+					w->node = 0;
+				workers.push_back(w);
+			}
+			if (workers.empty()) {
+				fprintf(stderr, "[ FAIL ] no CPU given for executor workers\n");
+				exit(EXIT_FAILURE);
+			}
+
+			int max_node = 0;
+			for (auto w : workers)
+				max_node = std::max(max_node, w->node);
+			by_node.resize(max_node + 1);
+			for (size_t i = 0; i < workers.size(); ++i)
+				by_node[workers[i]->node].push_back(i);
+			next_in_node = new std::atomic<size_t>[by_node.size()]();
+
+			/* steal order: same node first, then the other nodes in turn */
+			for (size_t i = 0; i < workers.size(); ++i) {
+				auto node = workers[i]->node;
+				for (size_t d = 0; d < by_node.size(); ++d) {
+					for (auto v : by_node[(node + d) % by_node.size()]) {
+						if (v != i)
+							workers[i]->victims.push_back(v);
+					}
+					if (d == 0)
+						workers[i]->nr_local = workers[i]->victims.size();
+				}
+			}
+
+			for (size_t i = 0; i < workers.size(); ++i)
+				workers[i]->thread = std::thread(&Executor::run, this, i);
+		}
+
+		~Executor(void) {
+			{
+				std::lock_guard<std::mutex> l(park_lock);
+				stop = true;
+			}
+			park_cv.notify_all();
+			/* thieves look into every deque until they stop */
+			for (auto w : workers)
+				w->thread.join();
+			for (auto w : workers)
+				delete w;
+			delete[] next_in_node;
+		}
+
+		void Submit(Task task, int node = -1) {
+			size_t id;
+			if (self.owner == this) {
+				id = self.id;
+			} else if (node >= 0 && (size_t)node < by_node.size() && !by_node[node].empty()) {
+				auto& local = by_node[node];
+				id = local[next_in_node[node].fetch_add(1, std::memory_order_relaxed) % local.size()];
+			} else {
+				id = next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+			}
+
+			/* counted before it is visible, a worker taking it can not underflow */
+			pending.fetch_add(1);
+			{
+				std::lock_guard<std::mutex> l(workers[id]->lock);
+				workers[id]->tasks.push_back(std::move(task));
+			}
+			/* pairs with the nr_parked increment before a worker checks pending */
+			if (nr_parked.load() > 0) {
+				std::lock_guard<std::mutex> l(park_lock);
+				park_cv.notify_one();
+			}
+		}
+
+		size_t Workers(void) const { return workers.size(); }
+		size_t Nodes(void) const { return by_node.size(); }
+		/* workers on @node */
+		size_t Workers(int node) const {
+			return (size_t)node < by_node.size() ? by_node[node].size() : 0;
+		}
+		/* tasks taken from another worker's deque, of those from another node */
+		uint64_t Steals(void) const { return nr_steals.load(std::memory_order_relaxed); }
+		uint64_t RemoteSteals(void) const { return nr_remote_steals.load(std::memory_order_relaxed); }
+
+	private:
+		struct alignas(64) Worker {
+			std::mutex lock;
+			std::deque<Task> tasks;
+			int cpu;
+			int node;
+			/* worker ids to steal from, the first nr_local on the same node */
+			std::vector<size_t> victims;
+			size_t nr_local = 0;
+			std::thread thread;
+
+			void* operator new(size_t size) {
+				void *ret;
+				if (posix_memalign(&ret, 64, size) ) ret=NULL;
+				return ret;
+			}
+			void operator delete(void* p) { free(p); }
+		};
+
+		struct Self {
+			Executor* owner = NULL;
+			size_t id = 0;
+		};
+		static thread_local Self self;
+
+		bool pop(Worker* w, Task& task) {
+			std::lock_guard<std::mutex> l(w->lock);
+			if (w->tasks.empty())
+				return false;
+			task = std::move(w->tasks.back());
+			w->tasks.pop_back();
+			return true;
+		}
+
+		bool steal_from(size_t victim, Task& task) {
+			auto v = workers[victim];
+			std::unique_lock<std::mutex> l(v->lock, std::try_to_lock);
+			if (!l.owns_lock() || v->tasks.empty())
+				return false;
+			task = std::move(v->tasks.front());
+			v->tasks.pop_front();
+			return true;
+		}
+
+		/* a random start within each group spreads the thieves */
+		bool steal(Worker* w, Task& task, uint64_t& seed) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			size_t nr_local = w->nr_local;
+			size_t nr_remote = w->victims.size() - nr_local;
+			for (size_t i = 0; i < nr_local; ++i) {
+				if (steal_from(w->victims[(seed + i) % nr_local], task)) {
+					nr_steals.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			for (size_t i = 0; i < nr_remote; ++i) {
+				if (steal_from(w->victims[nr_local + (seed + i) % nr_remote], task)) {
+					nr_steals.fetch_add(1, std::memory_order_relaxed);
+					nr_remote_steals.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void run(size_t id) {
+			Worker* w = workers[id];
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(w->cpu, &cpuset);
+			int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+			if (rc != 0)
+				fprintf(stderr, "[ FAIL ] executor worker can not bind to CPU %d: %d\n", w->cpu, rc);
+			self.owner = this;
+			self.id = id;
+
+			uint64_t seed = 0x9E3779B97F4A7C15ULL * (id + 1);
+			size_t idle = 0;
+			Task task;
+			while (true) {
+				if (pop(w, task) || steal(w, task, seed)) {
+					pending.fetch_sub(1, std::memory_order_relaxed);
+					task();
+					task = nullptr;
+					idle = 0;
+					continue;
+				}
+				if (++idle < kSpinRounds) {
+					std::this_thread::yield();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> l(park_lock);
+				nr_parked.fetch_add(1);
+				park_cv.wait(l, [this] { return pending.load() > 0 || stop; });
+				nr_parked.fetch_sub(1);
+				if (stop && pending.load() == 0)
+					break;
+				idle = 0;
+			}
+			self.owner = NULL;
+		}
+
+		std::vector<Worker*> workers;
+		/* worker ids per NUMA node */
+		std::vector<std::vector<size_t>> by_node;
+		std::atomic<size_t>* next_in_node;
+		std::atomic<size_t> next{0};
+
+		/* queued and not yet taken by a worker */
+		std::atomic<size_t> pending{0};
+		std::atomic<size_t> nr_parked{0};
+		std::mutex park_lock;
+		std::condition_variable park_cv;
+		bool stop = false;
+
+		std::atomic<uint64_t> nr_steals{0};
+		std::atomic<uint64_t> nr_remote_steals{0};
+};
+
+inline thread_local Executor::Self Executor::self;
+
+#endif  // UTIL_EXECUTOR_H_
@@ -0,0 +1,122 @@
+#ifndef UTIL_HASH_POLICY_H_
+#define UTIL_HASH_POLICY_H_
+
+#include <cstdint>
+#include <cstring>
+#include "util/hash.h"
+#include "util/pair.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+/*
+ * Hash policies for 8-byte keys, chosen at compile time so backends call
+ * the hash directly (and inline it) instead of through hash_funcs[].
+ *
+ *   struct Policy { static size_t hash(Key_t key, size_t seed = kHashSeed); };
+ *
+ * CCEH takes the policy as a template parameter, DefaultHash unless given
+ * another, the other backends use DefaultHash. It is set with
+ * -DKV_HASH=<policy> (make ... HASH=<policy>).
+ * hashbench.cpp measures speed, chi-square and avalanche of each.
+ */
+
+constexpr size_t kHashSeed = 0xc70697UL;
+
+/* std::_Hash_bytes, what h() has always returned */
+struct StdHash {
+	static size_t hash(Key_t key, size_t seed = kHashSeed) {
+		return standard(&key, sizeof(key), seed);
+	}
+	static const char* name(void) { return "std"; }
+};
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/*
+ * Two CRC32C (SSE4.2 crc32 instruction, 3 cycles each) over the key and
+ * the key with its halves swapped. CRC is linear, so it spreads keys
+ * evenly but avalanches poorly; fine for bucket indices, weak as a
+ * fingerprint source.
+ */
+struct Crc32cHash {
+	/*
+	 * Bitwise fallback, only so a build without -msse4.2 still works. Like
+	 * the instruction it neither inverts @crc nor the result, tables and
+	 * clients built either way must agree (hashbench checks it).
+	 */
+	static uint32_t crc32c_soft(uint32_t crc, uint64_t v) {
+		for (int i = 0; i < 64; i++) {
+			crc ^= (uint32_t)(v >> i) & 1;
+			crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+		}
+		return crc;
+	}
+
+	static uint32_t crc32c(uint32_t crc, uint64_t v) {
+#if defined(__SSE4_2__)
+		return (uint32_t)_mm_crc32_u64(crc, v);
+#else
+		return crc32c_soft(crc, v);
+#endif
+	}
+
+	static size_t hash(Key_t key, size_t seed = kHashSeed) {
+		uint64_t lo = crc32c((uint32_t)seed, key);
+		uint64_t hi = crc32c((uint32_t)(seed >> 32) ^ 0x9e3779b9, rotl64(key, 32));
+		return (hi << 32) | lo;
+	}
+	static const char* name(void) { return "crc32c"; }
+};
+
+/* XXH3_64bits_withSeed for a 4 to 8 byte input, at length 8 */
+struct Xxh3Hash {
+	static size_t hash(Key_t key, size_t seed = kHashSeed) {
+		/* readLE64(kSecret + 8) ^ readLE64(kSecret + 16) of the default secret */
+		const uint64_t secret = 0x1cad21f72c81017cULL ^ 0xdb979083e96dd4deULL;
+		seed ^= (uint64_t)__builtin_bswap32((uint32_t)seed) << 32;
+		uint64_t input64 = (key >> 32) + (key << 32);
+		uint64_t h64 = input64 ^ (secret - seed);
+		/* XXH3_rrmxmx */
+		h64 ^= rotl64(h64, 49) ^ rotl64(h64, 24);
+		h64 *= 0x9fb21c651e98df25ULL;
+		h64 ^= (h64 >> 35) + sizeof(key);
+		h64 *= 0x9fb21c651e98df25ULL;
+		return h64 ^ (h64 >> 28);
+	}
+	static const char* name(void) { return "xxh3"; }
+};
+
+/* wyhash (final version 4) for an 8 byte input */
+struct WyHash {
+	static uint64_t mix(uint64_t a, uint64_t b) {
+		__uint128_t r = (__uint128_t)a * b;
+		return (uint64_t)r ^ (uint64_t)(r >> 64);
+	}
+
+	static size_t hash(Key_t key, size_t seed = kHashSeed) {
+		const uint64_t s0 = 0x2d358dccaa6c78a5ULL, s1 = 0x8bb84b93962eacc9ULL;
+		seed ^= mix(seed ^ s0, s1);
+		uint64_t a = rotl64(key, 32) ^ s1;
+		uint64_t b = key ^ seed;
+		__uint128_t r = (__uint128_t)a * b;
+		a = (uint64_t)r;
+		b = (uint64_t)(r >> 64);
+		return mix(a ^ s0 ^ sizeof(key), b ^ s1);
+	}
+	static const char* name(void) { return "wyhash"; }
+};
+
+#ifndef KV_HASH
+#define KV_HASH StdHash
+#endif
+/*
+ * A type of its own rather than an alias, so CCEHT<..., DefaultHash> and
+ * CCEHT<..., WyHash> can both be instantiated when KV_HASH is WyHash.
+ */
+struct DefaultHash : KV_HASH { };
+
+#endif  // UTIL_HASH_POLICY_H_
@@ -0,0 +1,67 @@
+#ifndef UTIL_MPSC_RING_H_
+#define UTIL_MPSC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Bounded ring many threads push into and one thread pops from, after
+ * Vyukov's bounded MPMC queue. Each cell carries a sequence number, so a
+ * producer claims a cell with one CAS on the tail and publishes it with a
+ * release store; the consumer never writes a shared index.
+ *
+ * push() returns false when the ring is full, pop() when it is empty.
+ */
+template <class T, size_t Size>
+class MPSCRing {
+	static_assert((Size & (Size - 1)) == 0, "ring size must be a power of two");
+
+	public:
+		MPSCRing(void) : tail{0}, head{0} {
+			for (size_t i = 0; i < Size; ++i)
+				cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		bool push(T value) {
+			size_t pos = tail.load(std::memory_order_relaxed);
+			while (true) {
+				Cell& c = cells[pos & (Size - 1)];
+				auto dif = (intptr_t)c.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+				if (dif == 0) {
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						c.value = value;
+						c.seq.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (dif < 0) {
+					return false;
+				} else {
+					pos = tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/* owner thread only */
+		bool pop(T* value) {
+			Cell& c = cells[head & (Size - 1)];
+			if (c.seq.load(std::memory_order_acquire) != head + 1)
+				return false;
+			*value = c.value;
+			c.seq.store(head + Size, std::memory_order_release);
+			++head;
+			return true;
+		}
+
+	private:
+		struct alignas(64) Cell {
+			std::atomic<size_t> seq;
+			T value;
+		};
+
+		Cell cells[Size];
+		alignas(64) std::atomic<size_t> tail;
+		alignas(64) size_t head;
+};
+
+#endif  // UTIL_MPSC_RING_H_
@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 #include <stdint.h>
+#include <algorithm>
 
 #define CPU_FREQ_MHZ (1994)  // cat /proc/cpuinfo
 #define CAS(_p, _u, _v)  (__atomic_compare_exchange_n (_p, _u, _v, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
@@ -40,5 +41,21 @@ inline void clflush(char* data, size_t len) {
   mfence();
 }
 
+/* clflush() of scattered lines behind one pair of fences, each line flushed once */
+inline void clflush_lines(char** addrs, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    addrs[i] = (char*)((unsigned long)addrs[i] & (~(kCacheLineSize-1)));
+  std::sort(addrs, addrs + n);
+  mfence();
+  for (size_t i = 0; i < n; ++i) {
+    if (i > 0 && addrs[i] == addrs[i-1])
+      continue;
+    unsigned long etcs = ReadTSC() + (unsigned long) (kWriteLatencyInNS*CPU_FREQ_MHZ/1000);
+    asm volatile("clflush %0" : "+m" (*(volatile char*)addrs[i]));
+    while (ReadTSC() < etcs) CPUPause();
+  }
+  mfence();
+}
+
 
 #endif  // UTIL_PERSIST_H_
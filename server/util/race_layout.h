@@ -0,0 +1,145 @@
+#ifndef UTIL_RACE_LAYOUT_H_
+#define UTIL_RACE_LAYOUT_H_
+
+/*
+ * Memory layout of the one-sided (RACE-style) index, shared by the server
+ * (src/race_hash.cpp) and by clients that look pages up with RDMA READs
+ * only. Plain C, so the client module can include it as is.
+ *
+ *   region   : | header | directory | subtable 0 | subtable 1 | ...
+ *   subtable : groups of three 64B buckets | main 0 | overflow | main 1 |
+ *
+ * A key picks a subtable from its hash and has two candidate groups in it.
+ * In each group it may use one main bucket plus the overflow bucket it
+ * shares with the other main bucket, 128 contiguous bytes a client fetches
+ * with a single READ (a combined bucket). A client reads the header and the
+ * directory once and caches them, then a lookup is
+ *
+ *   1. READ both combined buckets (posted together, one round trip)
+ *   2. READ the page the matching slot points to
+ *
+ * with no server CPU involved. Slots carry the full key and a 16-bit key
+ * fingerprint next to the page address. The server updates a slot with
+ * plain 8-byte stores while clients may be reading it, so a READ can see
+ * the key of one entry and the address of another; the fingerprint of a
+ * torn slot does not match its key and the client ignores it.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#define RACE_MAGIC              0x5241434549445821ULL   /* "RACEIDX!" */
+#define RACE_SLOTS              4       /* slots per 64B bucket */
+#define RACE_GROUP_BUCKETS      3
+#define RACE_MAX_SUBTABLES      1024
+#define RACE_MAX_GROUPS         (1UL << 16)     /* groups per subtable, 12MB */
+#define RACE_SEED1              0xc70697ULL
+#define RACE_SEED2              0x951125ULL
+#define RACE_ADDR_BITS          48
+#define RACE_ADDR_MASK          ((1ULL << RACE_ADDR_BITS) - 1)
+
+struct race_slot {
+	uint64_t key;
+	uint64_t tagged_addr;   /* fingerprint << 48 | page address, 0 if empty */
+};
+
+struct race_bucket {
+	struct race_slot slot[RACE_SLOTS];
+};
+
+struct race_header {
+	uint64_t magic;
+	uint64_t nsubtables;    /* power of two */
+	uint64_t groups;        /* groups per subtable, power of two */
+	uint64_t pad[5];
+};
+
+/* what a client caches: the header and the subtable addresses behind it */
+struct race_directory {
+	struct race_header hdr;
+	uint64_t subtable[RACE_MAX_SUBTABLES];
+};
+
+#define RACE_GROUP_SIZE         (RACE_GROUP_BUCKETS * sizeof(struct race_bucket))
+#define RACE_COMBINED_SIZE      (2 * sizeof(struct race_bucket))
+
+/* bytes of header plus directory, the first READ a client does */
+static inline size_t race_directory_size(uint64_t nsubtables)
+{
+	return sizeof(struct race_header) + nsubtables * sizeof(uint64_t);
+}
+
+/* murmur3 finalizer, identical on both sides of the wire */
+static inline uint64_t race_hash(uint64_t key, uint64_t seed)
+{
+	uint64_t h = key ^ seed;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static inline uint64_t race_tag(uint64_t key, uint64_t addr)
+{
+	return (race_hash(key, RACE_SEED2) >> RACE_ADDR_BITS) << RACE_ADDR_BITS
+		| (addr & RACE_ADDR_MASK);
+}
+
+/* page address of @s if it is a consistent entry for @key, else 0 */
+static inline uint64_t race_slot_match(const struct race_slot *s, uint64_t key)
+{
+	uint64_t tagged = s->tagged_addr;
+
+	if (!tagged || s->key != key || race_tag(key, tagged) != tagged)
+		return 0;
+	return tagged & RACE_ADDR_MASK;
+}
+
+static inline uint64_t race_subtable(uint64_t h1, uint64_t nsubtables)
+{
+	return (h1 >> 32) & (nsubtables - 1);
+}
+
+/* byte offset of the combined bucket for hash @h inside its subtable */
+static inline uint64_t race_combined_offset(uint64_t h, uint64_t groups)
+{
+	uint64_t group = h & (groups - 1);
+	uint64_t side = (h >> 31) & 1;
+
+	return group * RACE_GROUP_SIZE + side * sizeof(struct race_bucket);
+}
+
+/* remote addresses of the two combined buckets @key may live in */
+static inline void race_candidates(const struct race_directory *dir,
+		uint64_t key, uint64_t addr[2])
+{
+	uint64_t h1 = race_hash(key, RACE_SEED1);
+	uint64_t h2 = race_hash(key, RACE_SEED2);
+	uint64_t base = dir->subtable[race_subtable(h1, dir->hdr.nsubtables)];
+
+	addr[0] = base + race_combined_offset(h1, dir->hdr.groups);
+	addr[1] = base + race_combined_offset(h2, dir->hdr.groups);
+}
+
+/* search the two fetched combined buckets, page address or 0 on a miss */
+static inline uint64_t race_search(const struct race_bucket combined[2][2],
+		uint64_t key)
+{
+	int c, b, i;
+	uint64_t addr;
+
+	for (c = 0; c < 2; c++)
+		for (b = 0; b < 2; b++)
+			for (i = 0; i < RACE_SLOTS; i++)
+				if ((addr = race_slot_match(&combined[c][b].slot[i], key)))
+					return addr;
+	return 0;
+}
+
+#endif  // UTIL_RACE_LAYOUT_H_
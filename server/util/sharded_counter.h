@@ -0,0 +1,53 @@
+#ifndef UTIL_SHARDED_COUNTER_H_
+#define UTIL_SHARDED_COUNTER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Occupancy counter split into cache-line sized shards.
+ * Each thread sticks to one shard, so updates on the insert path do not
+ * bounce a shared line between cores. Reading sums all shards, which is
+ * O(kShards) and may be slightly stale while updates are in flight.
+ */
+class ShardedCounter {
+	public:
+		static constexpr size_t kShards = 64;
+
+		void add(int64_t delta) {
+			shards[shard_id()].v.fetch_add(delta, std::memory_order_relaxed);
+		}
+
+		void inc(void) { add(1); }
+		void dec(void) { add(-1); }
+
+		int64_t read(void) const {
+			int64_t sum = 0;
+			for (size_t i = 0; i < kShards; ++i)
+				sum += shards[i].v.load(std::memory_order_relaxed);
+			return sum;
+		}
+
+		void reset(int64_t value = 0) {
+			for (size_t i = 0; i < kShards; ++i)
+				shards[i].v.store(0, std::memory_order_relaxed);
+			shards[0].v.store(value, std::memory_order_relaxed);
+		}
+
+	private:
+		struct alignas(64) Shard {
+			std::atomic<int64_t> v{0};
+		};
+
+		/* threads are assigned shards round robin on first use */
+		static size_t shard_id(void) {
+			static std::atomic<size_t> next{0};
+			thread_local size_t id = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+			return id;
+		}
+
+		Shard shards[kShards];
+};
+
+#endif  // UTIL_SHARDED_COUNTER_H_
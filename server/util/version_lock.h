@@ -0,0 +1,65 @@
+#ifndef UTIL_VERSION_LOCK_H_
+#define UTIL_VERSION_LOCK_H_
+
+#include <cstdint>
+
+/*
+ * 8-byte version lock (seqlock) meant to sit next to the data it guards.
+ *
+ * bit 0     : write locked
+ * bit 1..63 : version, bumped by every unlock
+ *
+ * Writers take it with a CAS, readers never write it:
+ *
+ *   retry:
+ *     auto v = l.read_begin();
+ *     ... read the bucket ...
+ *     if (!l.read_validate(v)) goto retry;
+ *
+ * Satisfies BasicLockable, so std::lock_guard/std::unique_lock work for writers.
+ */
+class VersionLock {
+	public:
+		VersionLock(void) : word{0} { }
+
+		uint64_t read_begin(void) const {
+			uint64_t v;
+			while ((v = __atomic_load_n(&word, __ATOMIC_ACQUIRE)) & 1)
+				asm volatile("pause");
+			return v;
+		}
+
+		bool read_validate(uint64_t v) const {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			return __atomic_load_n(&word, __ATOMIC_RELAXED) == v;
+		}
+
+		bool try_lock(void) {
+			uint64_t v = __atomic_load_n(&word, __ATOMIC_RELAXED);
+			if (v & 1)
+				return false;
+			return __atomic_compare_exchange_n(&word, &v, v + 1, false,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+		}
+
+		void lock(void) {
+			while (!try_lock())
+				asm volatile("pause");
+		}
+
+		void unlock(void) {
+			/* only the holder writes the word, a plain add is enough */
+			__atomic_store_n(&word, __atomic_load_n(&word, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+		}
+
+		bool is_locked(void) const {
+			return __atomic_load_n(&word, __ATOMIC_RELAXED) & 1;
+		}
+
+	private:
+		uint64_t word;
+};
+
+static_assert(sizeof(VersionLock) == 8, "VersionLock must stay one word");
+
+#endif  // UTIL_VERSION_LOCK_H_
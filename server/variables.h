@@ -1,7 +1,8 @@
 #ifndef VARIABLES_H
 #define VARIABLES_H
 
-#define NUM_NUMA 2
+/* most NUMA nodes NUMA_KV spreads over */
+#define NUM_NUMA 8
 
 extern size_t initialTableSize;
 extern size_t numData;
@@ -13,6 +14,16 @@ extern bool verbose_flag;
 extern bool bf_flag;
 extern struct bitmask *netcpubuf;
 extern size_t BUFFER_SIZE;
+/* hash backend by name (--backend), NULL for the only or the linear one */
+extern const char* kv_backend;
+extern const char* cceh_geometry;
+extern bool clock_eviction;
+/* 4KB page region values point into, required by the compact index */
+extern uint64_t page_region;
+extern size_t page_region_size;
+/* where the one-sided index puts its buckets, 0 lets it allocate them */
+extern uint64_t index_region;
+extern size_t index_region_size;
 
 extern int putcnt;
 extern int getcnt;